@@ -0,0 +1,88 @@
+#include "ack.h"
+
+#include "batch.h"
+
+#include <string.h>
+
+
+void ack_init(struct ack_state *st, uint32_t rcv_nxt)
+{
+	memset(st, 0, sizeof(struct ack_state));
+	st->rcv_nxt = rcv_nxt;
+}
+
+
+void ack_set_mss(struct ack_state *st, struct ack_conf *cf, int mss)
+{
+	if(mss <= 0) {
+		mss = ACK_DEFAULT_MSS;
+	}
+
+	st->mss = (mss > cf->mss) ? cf->mss : mss;
+}
+
+
+int ack_on_segment(struct ack_state *st, struct ack_conf *cf, uint32_t seq,
+		int pldlen, int flags, uint64_t now)
+{
+	/* Never acknowledge an ACK */
+	if(pldlen == 0 && !(flags & TCP_F_FIN)) {
+		return ACK_NONE;
+	}
+	st->segs_recv++;
+
+	/* A duplicate or a segment after a gap, tell the other end at once */
+	if(seq != st->rcv_nxt) {
+		return ACK_NOW;
+	}
+
+	st->rcv_nxt += pldlen;
+	if(flags & TCP_F_FIN) {
+		st->rcv_nxt++;
+		return ACK_NOW;
+	}
+
+	if(cf->delay == 0 || ((flags & TCP_F_PSH) && (cf->flags & ACK_F_PSH))) {
+		return ACK_NOW;
+	}
+
+	/* Stretch the ACK over several full-sized segments */
+	if(pldlen >= (st->mss > 0 ? st->mss : cf->mss) && ++st->full >= cf->segs) {
+		return ACK_NOW;
+	}
+
+	if(st->deadline == 0) {
+		st->deadline = now + (uint64_t)cf->delay * 1000;
+	}
+	return ACK_LATER;
+}
+
+
+int ack_timeout(struct ack_state *st, uint64_t now)
+{
+	if(st->deadline == 0) {
+		return -1;
+	}
+
+	if(now >= st->deadline) {
+		return 0;
+	}
+
+	/* Round up, so the ACK isn't sent before it is due */
+	return (st->deadline - now + 999) / 1000;
+}
+
+
+void ack_sent(struct ack_state *st, int reason)
+{
+	st->acks_sent++;
+	if(reason == ACK_LATER) {
+		st->acks_delayed++;
+	}
+	else if(reason == ACK_PIGGYBACK) {
+		st->acks_piggybacked++;
+	}
+
+	st->full = 0;
+	st->deadline = 0;
+}
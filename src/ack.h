@@ -0,0 +1,126 @@
+#ifndef _ACK_H
+#define _ACK_H
+
+#include <stdint.h>
+
+/* The default delay of an ACK in milliseconds, like Linux' minimum */
+#define ACK_DELAY 40
+
+/* By default every second full-sized segment is acknowledged at once */
+#define ACK_SEGS 2
+
+/* The MSS assumed for another end, which didn't send the option */
+#define ACK_DEFAULT_MSS 536
+
+/* Flags for the ACK-policy */
+#define ACK_F_PSH 0x01
+
+/* What to do after receiving a segment, and why an ACK was sent */
+#define ACK_NONE      0
+#define ACK_LATER     1
+#define ACK_NOW       2
+#define ACK_PIGGYBACK 3
+
+/*
+ * The policy deciding when received segments are acknowledged.
+ *
+ * @delay: The time in milliseconds an ACK may be delayed, 0 to send an
+ *         ACK for every segment right away
+ * @segs: Acknowledge at the latest after this many full-sized segments
+ * @mss: The largest full-sized segment (our advertised MSS)
+ * @flags: ACK_F_PSH to acknowledge segments with the PSH-flag at once
+ */
+struct ack_conf {
+	int delay;
+	int segs;
+	int mss;
+	int flags;
+};
+
+/*
+ * The ACK-state of a single connection.
+ *
+ * @rcv_nxt: The next sequence-number expected from the other end
+ * @mss: The size of a full-sized segment, from the MSS of the other end
+ * @full: The number of full-sized segments not yet acknowledged
+ * @deadline: The time the delayed ACK is due in microseconds, 0 if none
+ * @segs_recv: The number of segments carrying data or FIN received
+ * @acks_sent: The number of ACKs sent, including piggybacked ones
+ * @acks_piggybacked: The number of ACKs sent along with our data
+ * @acks_delayed: The number of ACKs sent, because the delay expired
+ */
+struct ack_state {
+	uint32_t rcv_nxt;
+	int mss;
+	int full;
+	uint64_t deadline;
+
+	unsigned long segs_recv;
+	unsigned long acks_sent;
+	unsigned long acks_piggybacked;
+	unsigned long acks_delayed;
+};
+
+
+/*
+ * Initialize the ACK-state of a connection.
+ *
+ * @st: The state to initialize
+ * @rcv_nxt: The first sequence-number expected from the other end
+ */
+void ack_init(struct ack_state *st, uint32_t rcv_nxt);
+
+
+/*
+ * Take the MSS the other end sent with its SYN or SYN-ACK, which decides
+ * what counts as a full-sized segment. The other end never sends more
+ * than we advertised, so that is the upper bound.
+ *
+ * @st: The ACK-state of the connection
+ * @cf: The ACK-policy
+ * @mss: The MSS of the other end or 0 if it didn't send the option
+ */
+void ack_set_mss(struct ack_state *st, struct ack_conf *cf, int mss);
+
+
+/*
+ * Account a received segment and decide, whether it has to be
+ * acknowledged. Pure ACKs are never acknowledged. Segments which don't
+ * start at the expected sequence-number, reveal a gap and are
+ * acknowledged at once, so the other end can retransmit quickly. The
+ * same goes for a FIN.
+ *
+ * @st: The ACK-state of the connection
+ * @cf: The ACK-policy
+ * @seq: The sequence-number of the segment
+ * @pldlen: The length of the payload
+ * @flags: The TCP-flags of the segment (TCP_F_*)
+ * @now: The current time in microseconds
+ *
+ * Returns: ACK_NOW, ACK_LATER if a delayed ACK is pending or ACK_NONE
+ */
+int ack_on_segment(struct ack_state *st, struct ack_conf *cf, uint32_t seq,
+		int pldlen, int flags, uint64_t now);
+
+
+/*
+ * Get the time left until the delayed ACK is due.
+ *
+ * @st: The ACK-state of the connection
+ * @now: The current time in microseconds
+ *
+ * Returns: The time left in milliseconds or -1 if no ACK is pending
+ */
+int ack_timeout(struct ack_state *st, uint64_t now);
+
+
+/*
+ * Account an ACK sent for the connection, which clears the pending ACK.
+ *
+ * @st: The ACK-state of the connection
+ * @reason: ACK_NOW if the ACK was sent right away, ACK_LATER if the delay
+ *          expired or ACK_PIGGYBACK if the ACK was sent along with our data
+ */
+void ack_sent(struct ack_state *st, int reason);
+
+#endif /* _ACK_H */
@@ -8,7 +8,6 @@
 #include <arpa/inet.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
-#include <linux/tcp.h>
 #include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
@@ -17,6 +16,9 @@
 #include <net/if.h>
 
 
+int dump_datagrams = 0;
+
+
 void hexDump(void *buf, int len)
 {
 	int i;
@@ -80,7 +82,11 @@ void dump_packet(char *buf, int len)
 
 	/* Unwrap both headers */
 	ip_hdr_len = strip_ip_hdr(&ip_hdr, buf, len);
-	strip_tcp_hdr(&tcp_hdr, (buf + ip_hdr_len), (len - ip_hdr_len));
+	if(ip_hdr_len == 0 ||
+			strip_tcp_hdr(&tcp_hdr, (buf + ip_hdr_len), (len - ip_hdr_len)) == 0) {
+		printf("[*] Truncated datagram of %d bytes\n", len);
+		return;
+	}
 
 	/* Get the IP-addresses */
 	srcaddr = ip_hdr.saddr;
@@ -127,3 +133,26 @@ void dump_packet(char *buf, int len)
 
 	printf("\n");
 }
+
+
+/* The virtual clock read instead of the monotonic clock, if set */
+static uint64_t *virtual_clock;
+
+
+uint64_t get_timestamp(void)
+{
+	struct timespec ts;
+
+	if(virtual_clock != NULL) {
+		return *virtual_clock;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+void use_virtual_clock(uint64_t *clock)
+{
+	virtual_clock = clock;
+}
@@ -5,6 +5,12 @@
 #define DUMP_LEN 16
 #endif
 
+#include <stdint.h>
+
+/* Print every datagram sent and received, along with its payload. Off */
+/* by default, as the output holds up every thread handling datagrams. */
+extern int dump_datagrams;
+
 /*
  * Dump a chunk of data into the terminal. Each character is display
  * as a hex-number and as a readable ASCII-character. Invalid characters
@@ -25,4 +31,22 @@ void hexDump(void *buf, int len);
  */
 void dump_packet(char *buf, int len);
 
+
+/*
+ * Get the current time of the monotonic clock. The value is not related to
+ * the wall-clock-time and should only be used to measure time-spans.
+ *
+ * Returns: The current time in microseconds
+ */
+uint64_t get_timestamp(void);
+
+
+/*
+ * Let get_timestamp() read a virtual clock instead of the monotonic
+ * clock, so time only passes when the owner of the clock advances it.
+ *
+ * @clock: The virtual time in microseconds or NULL to use the real clock
+ */
+void use_virtual_clock(uint64_t *clock);
+
 #endif /* _BASIC_UTILS_H */
@@ -0,0 +1,310 @@
+#include "batch.h"
+
+#include "packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/*
+ * Read a 16-bit number in network-byte-order from an unaligned address.
+ */
+static uint16_t get16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+
+/*
+ * Read a 32-bit number in network-byte-order from an unaligned address.
+ */
+static uint32_t get32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | p[3];
+}
+
+
+/*
+ * Decode the TCP-options of a segment. Unknown options are skipped and
+ * parsing stops at the first malformed option, just like the kernel does.
+ *
+ * @b: The batch to write the options to
+ * @i: The index of the datagram in the batch
+ * @opt: The start of the options
+ * @len: The length of the options in bytes
+ */
+static void parse_opts(struct pkt_batch *b, int i, const unsigned char *opt,
+		int len)
+{
+	int pos = 0, optlen, k;
+
+	while(pos < len) {
+		if(opt[pos] == TCPOPT_EOL) {
+			break;
+		}
+
+		if(opt[pos] == TCPOPT_NOP) {
+			pos++;
+			continue;
+		}
+
+		/* Every other option has a length-field */
+		if(pos + 2 > len || (optlen = opt[pos + 1]) < 2 || pos + optlen > len) {
+			break;
+		}
+
+		switch(opt[pos]) {
+			case TCPOPT_MAXSEG:
+				if(optlen == TCPOLEN_MAXSEG) {
+					b->opts[i] |= TCPOPT_F_MSS;
+					b->mss[i] = get16(opt + pos + 2);
+				}
+				break;
+
+			case TCPOPT_WINDOW:
+				if(optlen == TCPOLEN_WINDOW) {
+					b->opts[i] |= TCPOPT_F_WSCALE;
+					/* RFC 7323 limits the shift to 14 */
+					b->wscale[i] = (opt[pos + 2] > 14) ? 14 : opt[pos + 2];
+				}
+				break;
+
+			case TCPOPT_SACK_PERMITTED:
+				if(optlen == TCPOLEN_SACK_PERMITTED) {
+					b->opts[i] |= TCPOPT_F_SACKOK;
+				}
+				break;
+
+			case TCPOPT_SACK:
+				if((optlen - 2) % 8 == 0) {
+					b->opts[i] |= TCPOPT_F_SACK;
+					for(k = 0; k < (optlen - 2) / 8 && k < BATCH_SACK_MAX; k++) {
+						b->sack_left[i][k] = get32(opt + pos + 2 + k * 8);
+						b->sack_right[i][k] = get32(opt + pos + 6 + k * 8);
+					}
+					b->nsack[i] = k;
+				}
+				break;
+
+			case TCPOPT_FASTOPEN:
+				/* Either a request (no cookie) or a cookie of valid length */
+				k = optlen - 2;
+				if(k == 0 || (k >= TFO_COOKIE_MIN && k <= TFO_COOKIE_MAX && k % 2 == 0)) {
+					b->opts[i] |= TCPOPT_F_FASTOPEN;
+					b->fo_len[i] = k;
+					memcpy(b->fo_cookie[i], opt + pos + 2, k);
+				}
+				break;
+
+			case TCPOPT_TIMESTAMP:
+				if(optlen == TCPOLEN_TIMESTAMP) {
+					b->opts[i] |= TCPOPT_F_TS;
+					b->tsval[i] = get32(opt + pos + 2);
+					b->tsecr[i] = get32(opt + pos + 6);
+				}
+				break;
+		}
+
+		pos += optlen;
+	}
+}
+
+
+/*
+ * Validate a single datagram and extract its header-fields.
+ *
+ * @b: The batch to write the results to
+ * @i: The index of the datagram in the batch
+ * @p: The datagram
+ * @len: The length of the datagram in bytes
+ * @csum: The checksums already checked (CSUM_F_*)
+ *
+ * Returns: The status of the datagram (BATCH_*)
+ */
+static int parse_one(struct pkt_batch *b, int i, unsigned char *p, int len,
+		int csum)
+{
+	int ip_hdr_len, tot_len, tcp_hdr_len, seglen;
+	unsigned char *seg;
+
+	/* Check the IP-header */
+	if(len < (int)sizeof(struct iphdr)) {
+		return BATCH_ETRUNC;
+	}
+
+	ip_hdr_len = (p[0] & 0x0f) * 4;
+	if((p[0] >> 4) != 4 || ip_hdr_len < (int)sizeof(struct iphdr)) {
+		return BATCH_EPROTO;
+	}
+
+	/* Link-layer padding may follow the datagram, so use its own length */
+	tot_len = get16(p + 2);
+	if(ip_hdr_len > len || tot_len < ip_hdr_len || tot_len > len) {
+		return BATCH_ETRUNC;
+	}
+
+	/* Only unfragmented TCP-segments */
+	if(p[9] != IPPROTO_TCP || (get16(p + 6) & 0x3fff) != 0) {
+		return BATCH_EPROTO;
+	}
+
+	memcpy(&b->saddr[i], p + 12, 4);
+	memcpy(&b->daddr[i], p + 16, 4);
+
+	/* Check the TCP-header */
+	seg = p + ip_hdr_len;
+	seglen = tot_len - ip_hdr_len;
+	if(seglen < (int)sizeof(struct tcphdr)) {
+		return BATCH_ETRUNC;
+	}
+
+	tcp_hdr_len = (seg[12] >> 4) * 4;
+	if(tcp_hdr_len < (int)sizeof(struct tcphdr) || tcp_hdr_len > seglen) {
+		return BATCH_ETRUNC;
+	}
+
+	memcpy(&b->sport[i], seg, 2);
+	memcpy(&b->dport[i], seg + 2, 2);
+
+	/* Both headers fit, so only the checksums are left to check */
+	if((csum & (CSUM_F_IP | CSUM_F_TCP)) != (CSUM_F_IP | CSUM_F_TCP)) {
+		switch(verify_raw_packet((char *)p, len, csum)) {
+			case(CSUM_VALID):
+				b->m_verified |= (uint64_t)1 << i;
+				break;
+
+			case(CSUM_PARTIAL):
+				break;
+
+			default:
+				return BATCH_ECSUM;
+		}
+	}
+
+	b->seq[i] = get32(seg + 4);
+	b->ack[i] = get32(seg + 8);
+	b->flags[i] = seg[13] & 0x3f;
+	b->window[i] = get16(seg + 14);
+	b->pldoff[i] = ip_hdr_len + tcp_hdr_len;
+	b->pldlen[i] = seglen - tcp_hdr_len;
+
+	parse_opts(b, i, seg + sizeof(struct tcphdr),
+			tcp_hdr_len - sizeof(struct tcphdr));
+
+	return BATCH_OK;
+}
+
+
+/*
+ * Build the bitmasks classifying the batch. With SSE2 16 datagrams are
+ * classified at once, without a single branch per datagram.
+ *
+ * @b: The parsed batch
+ */
+static void classify(struct pkt_batch *b)
+{
+	uint64_t used;
+	int i;
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128();
+	__m128i f_syn = _mm_set1_epi8(TCP_F_SYN);
+	__m128i f_ack = _mm_set1_epi8(TCP_F_ACK);
+	__m128i f_psh = _mm_set1_epi8(TCP_F_PSH);
+	__m128i f_fin = _mm_set1_epi8(TCP_F_FIN);
+	__m128i f_rst = _mm_set1_epi8(TCP_F_RST);
+	__m128i fl, st, lo, hi;
+	uint64_t m;
+#endif
+
+	b->m_valid = b->m_syn = b->m_ack = b->m_psh = 0;
+	b->m_fin = b->m_rst = b->m_data = 0;
+
+#ifdef __SSE2__
+	for(i = 0; i < BATCH_MAX; i += 16) {
+		fl = _mm_loadu_si128((const __m128i *)(b->flags + i));
+		st = _mm_loadu_si128((const __m128i *)(b->status + i));
+
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(st, zero));
+		b->m_valid |= m << i;
+
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(fl, f_syn), f_syn));
+		b->m_syn |= m << i;
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(fl, f_ack), f_ack));
+		b->m_ack |= m << i;
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(fl, f_psh), f_psh));
+		b->m_psh |= m << i;
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(fl, f_fin), f_fin));
+		b->m_fin |= m << i;
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(fl, f_rst), f_rst));
+		b->m_rst |= m << i;
+
+		/* Narrow the 16-bit lengths to bytes, to get one bit per datagram */
+		lo = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(b->pldlen + i)), zero);
+		hi = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(b->pldlen + i + 8)), zero);
+		m = _mm_movemask_epi8(_mm_packs_epi16(lo, hi)) ^ 0xffff;
+		b->m_data |= m << i;
+	}
+#else
+	for(i = 0; i < BATCH_MAX; i++) {
+		b->m_valid |= (uint64_t)(b->status[i] == BATCH_OK) << i;
+		b->m_syn |= (uint64_t)((b->flags[i] & TCP_F_SYN) != 0) << i;
+		b->m_ack |= (uint64_t)((b->flags[i] & TCP_F_ACK) != 0) << i;
+		b->m_psh |= (uint64_t)((b->flags[i] & TCP_F_PSH) != 0) << i;
+		b->m_fin |= (uint64_t)((b->flags[i] & TCP_F_FIN) != 0) << i;
+		b->m_rst |= (uint64_t)((b->flags[i] & TCP_F_RST) != 0) << i;
+		b->m_data |= (uint64_t)(b->pldlen[i] != 0) << i;
+	}
+#endif
+
+	/* Invalid datagrams and unused slots don't belong to any class */
+	used = (b->n >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << b->n) - 1);
+	b->m_valid &= used;
+	b->m_syn &= b->m_valid;
+	b->m_ack &= b->m_valid;
+	b->m_psh &= b->m_valid;
+	b->m_fin &= b->m_valid;
+	b->m_rst &= b->m_valid;
+	b->m_data &= b->m_valid;
+	b->m_verified &= b->m_valid;
+}
+
+
+int parse_batch(struct pkt_batch *b, char **pck, int *len, int *csum, int n)
+{
+	int i, valid = 0;
+
+	if(n > BATCH_MAX) {
+		n = BATCH_MAX;
+	}
+	b->n = n;
+
+	/* Reset the fields which are not always written */
+	memset(b->status, 0, sizeof(b->status));
+	memset(b->flags, 0, sizeof(b->flags));
+	memset(b->pldlen, 0, sizeof(b->pldlen));
+	memset(b->opts, 0, sizeof(b->opts));
+	memset(b->nsack, 0, sizeof(b->nsack));
+	b->m_verified = 0;
+
+	for(i = 0; i < n; i++) {
+		/* Fetch the headers of the following datagrams in the meantime */
+		if(i + 2 < n) {
+			__builtin_prefetch(pck[i + 2]);
+		}
+		b->status[i] = parse_one(b, i, (unsigned char *)pck[i], len[i],
+				csum ? csum[i] : (CSUM_F_IP | CSUM_F_TCP));
+		valid += (b->status[i] == BATCH_OK);
+	}
+
+	classify(b);
+	return valid;
+}
@@ -0,0 +1,125 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stdint.h>
+
+#include "tfo.h"
+
+/* The maximum number of datagrams parsed at once */
+#define BATCH_MAX 64
+
+/* The maximum number of SACK-blocks in a single segment */
+#define BATCH_SACK_MAX 4
+
+/* The status of a parsed datagram */
+#define BATCH_OK        0
+#define BATCH_ETRUNC    1
+#define BATCH_EPROTO    2
+#define BATCH_ECSUM     3
+
+/* The TCP-flags as they appear in the header */
+#define TCP_F_FIN 0x01
+#define TCP_F_SYN 0x02
+#define TCP_F_RST 0x04
+#define TCP_F_PSH 0x08
+#define TCP_F_ACK 0x10
+#define TCP_F_URG 0x20
+
+/* The options found in a segment */
+#define TCPOPT_F_MSS     0x01
+#define TCPOPT_F_WSCALE  0x02
+#define TCPOPT_F_SACKOK  0x04
+#define TCPOPT_F_SACK    0x08
+#define TCPOPT_F_TS      0x10
+#define TCPOPT_F_FASTOPEN 0x20
+
+/*
+ * The result of parsing a batch of received datagrams. Every field is
+ * stored in a separate array indexed by the position of the datagram in
+ * the batch, so a loop over a single field only touches the cache-lines
+ * it actually needs. Addresses and ports are kept in network-byte-order,
+ * all other numbers are converted to host-byte-order.
+ *
+ * @n: The number of datagrams in the batch
+ * @status: The result of the validation (BATCH_*)
+ * @saddr, @daddr, @sport, @dport: The 4-tuple of the connection
+ * @flags: The TCP-flags (TCP_F_*)
+ * @seq: The sequence-number
+ * @ack: The acknowledgement-number
+ * @window: The (unscaled) window
+ * @pldoff: The offset of the payload from the start of the datagram
+ * @pldlen: The length of the payload
+ * @opts: The options found in the segment (TCPOPT_F_*)
+ * @mss: The maximum segment size
+ * @wscale: The window-scale
+ * @tsval, @tsecr: The timestamp-value and -echo-reply
+ * @nsack: The number of SACK-blocks
+ * @sack_left, @sack_right: The edges of the SACK-blocks
+ * @fo_len: The length of the Fast-Open-cookie, 0 for a cookie-request
+ * @fo_cookie: The Fast-Open-cookie
+ *
+ * The following bitmasks classify the batch, bit i stands for datagram i:
+ *
+ * @m_valid: The datagram passed all checks
+ * @m_verified: The checksums were verified in software
+ * @m_syn, @m_ack, @m_psh, @m_fin, @m_rst: The flag is set
+ * @m_data: The segment carries payload
+ */
+struct pkt_batch {
+	int n;
+	uint8_t status[BATCH_MAX];
+
+	uint32_t saddr[BATCH_MAX];
+	uint32_t daddr[BATCH_MAX];
+	uint16_t sport[BATCH_MAX];
+	uint16_t dport[BATCH_MAX];
+
+	uint8_t flags[BATCH_MAX];
+	uint32_t seq[BATCH_MAX];
+	uint32_t ack[BATCH_MAX];
+	uint16_t window[BATCH_MAX];
+	uint16_t pldoff[BATCH_MAX];
+	uint16_t pldlen[BATCH_MAX];
+
+	uint8_t opts[BATCH_MAX];
+	uint16_t mss[BATCH_MAX];
+	uint8_t wscale[BATCH_MAX];
+	uint32_t tsval[BATCH_MAX];
+	uint32_t tsecr[BATCH_MAX];
+	uint8_t nsack[BATCH_MAX];
+	uint32_t sack_left[BATCH_MAX][BATCH_SACK_MAX];
+	uint32_t sack_right[BATCH_MAX][BATCH_SACK_MAX];
+	uint8_t fo_len[BATCH_MAX];
+	uint8_t fo_cookie[BATCH_MAX][TFO_COOKIE_MAX];
+
+	uint64_t m_valid;
+	uint64_t m_verified;
+	uint64_t m_syn;
+	uint64_t m_ack;
+	uint64_t m_psh;
+	uint64_t m_fin;
+	uint64_t m_rst;
+	uint64_t m_data;
+};
+
+
+/*
+ * Parse a batch of received datagrams. Both headers of every datagram are
+ * checked against the length of the buffer and the checksums not yet
+ * checked by the I/O-engine are verified using verify_raw_packet(),
+ * before the header-fields and the TCP-options are extracted. The
+ * datagrams themselves are not copied or modified. Afterwards the batch
+ * is classified by its flags, see struct pkt_batch.
+ *
+ * @b: The batch to write the results to
+ * @pck: The received datagrams, starting with the IP-header
+ * @len: The length of each datagram in bytes
+ * @csum: The checksums of each datagram already checked (CSUM_F_*), or
+ *        NULL if all of them were
+ * @n: The number of datagrams (at most BATCH_MAX)
+ *
+ * Returns: The number of valid datagrams
+ */
+int parse_batch(struct pkt_batch *b, char **pck, int *len, int *csum, int n);
+
+#endif /* _BATCH_H */
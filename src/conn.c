@@ -0,0 +1,837 @@
+#include "conn.h"
+
+#include "basic_utils.h"
+#include "batch.h"
+#include "isn.h"
+#include "packet.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+
+
+/*
+ * Check if a sequence-number comes before another one, considering the
+ * wrap-around.
+ */
+static int seq_before(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) < 0;
+}
+
+
+/*
+ * Keep the earlier of two points in time, where 0 means none.
+ */
+static void conn_due(uint64_t *due, uint64_t t)
+{
+	if(t != 0 && (*due == 0 || t < *due)) {
+		*due = t;
+	}
+}
+
+
+/*
+ * Build a datagram in the memory of the I/O-engine and send it right away.
+ *
+ * @c: The connection
+ * @type: The type of packet (e.g. ACK_PACKET)
+ * @seq: The sequence-number
+ * @data: The payload or NULL
+ * @len: The length of the payload
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int conn_xmit(struct conn *c, int type, uint32_t seq, char *data,
+		int len)
+{
+	char databuf[8 + CONN_TX_LEN];
+	int databuflen;
+	char *pck;
+	int pcklen;
+
+	if(!(pck = rawio_alloc(c->io))) {
+		return -1;
+	}
+
+	/* A RST doesn't advertise a window, so it must not move it */
+	gather_packet_data(databuf, &databuflen, seq, c->ack.rcv_nxt, data, len);
+	create_raw_datagram(pck, &pcklen, type, &c->src, &c->dst, databuf,
+			databuflen, (type == RST_PACKET) ? NULL : &c->rwin);
+	if(dump_datagrams) {
+		dump_packet(pck, pcklen);
+	}
+
+	c->pkts_out++;
+	c->bytes_out += pcklen;
+	if(rawio_send(c->io, pck, pcklen) < 0 || rawio_flush(c->io) < 0) {
+		perror("ERROR:");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Send the SYN, with the pending data if we know a Fast-Open-cookie.
+ */
+static int conn_syn(struct conn *c, uint64_t now)
+{
+	char databuf[8];
+	int databuflen = 0;
+	char *pck;
+	int pcklen;
+	uint32_t isn;
+
+	if(!(pck = rawio_alloc(c->io))) {
+		return -1;
+	}
+
+	/* A SYN sent again keeps the sequence-number, so the SYN-ACK of */
+	/* an earlier one still finishes the handshake */
+	if(c->retries > 0) {
+		gather_packet_data(databuf, &databuflen, c->isn, 0, NULL, 0);
+	}
+	create_raw_datagram(pck, &pcklen, SYN_PACKET, &c->src, &c->dst,
+			(c->retries > 0) ? databuf : NULL, databuflen, &c->rwin);
+	if(c->cf->tfo) {
+		add_fastopen(pck, &pcklen, c->cookie, c->cookielen, c->txbuf, c->synlen);
+	}
+
+	memcpy(&isn, pck + sizeof(struct iphdr) + 4, sizeof(isn));
+	c->isn = ntohl(isn);
+	c->snd_una = c->isn;
+	c->snd_nxt = c->isn + 1;
+	c->stamp = now;
+	if(dump_datagrams) {
+		dump_packet(pck, pcklen);
+	}
+
+	c->pkts_out++;
+	c->bytes_out += pcklen;
+	if(rawio_send(c->io, pck, pcklen) < 0 || rawio_flush(c->io) < 0) {
+		perror("ERROR:");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Get the time the SYN is sent again in microseconds. Something on the way
+ * might drop SYNs with data, so those are given up on early.
+ */
+static uint64_t conn_syn_due(struct conn *c)
+{
+	if(c->synlen > 0) {
+		return c->stamp + (uint64_t)TFO_SYN_TIMEOUT * 1000;
+	}
+
+	return c->stamp + ((uint64_t)CONN_SYN_TIMEOUT << c->retries) * 1000;
+}
+
+
+/*
+ * Get the time the next keep-alive-probe is due in microseconds.
+ */
+static uint64_t conn_ka_due(struct conn *c)
+{
+	return c->last_rx + ((uint64_t)c->cf->keepalive +
+			(uint64_t)c->probes * c->cf->kaintvl) * 1000;
+}
+
+
+/*
+ * Get the retransmission-timeout of data in microseconds, backed off
+ * for every retry.
+ */
+static uint64_t conn_rto(struct conn *c)
+{
+	uint64_t rto = (uint64_t)c->rwin.rtt * 3;
+
+	if(rto < (uint64_t)CONN_RTO_MIN * 1000) {
+		rto = (uint64_t)CONN_RTO_MIN * 1000;
+	}
+
+	rto <<= c->rto_retries;
+	if(rto > (uint64_t)CONN_RTO_MAX * 1000) {
+		rto = (uint64_t)CONN_RTO_MAX * 1000;
+	}
+
+	return rto;
+}
+
+
+/*
+ * Close the connection, without us having asked for it.
+ */
+static void conn_drop(struct conn *c, uint64_t now)
+{
+	c->state = CONN_CLOSED;
+	c->broken = 1;
+	c->timewait = 0;
+	if(!c->rxdone) {
+		c->rxstamp = now;
+	}
+	c->rxdone = 1;
+	c->stamp = now;
+}
+
+
+/*
+ * Send the data of the buffer not sent yet, carrying the ACK as well.
+ * Only as much as the send-window allows is sent, the rest waits for the
+ * window to open. While it is closed, the retransmission-timer probes it.
+ *
+ * @c: The established connection
+ * @owed: An ACK is pending, which is piggybacked on the data
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int conn_push(struct conn *c, int owed)
+{
+	uint32_t off = c->snd_nxt - c->txseq;
+	uint32_t flight = c->snd_nxt - c->snd_una;
+	uint32_t len;
+
+	if(off >= (uint32_t)c->txlen) {
+		return 0;
+	}
+
+	len = c->txlen - off;
+	if(flight >= c->swin.wnd) {
+		len = 0;
+	}
+	else if(len > c->swin.wnd - flight) {
+		len = c->swin.wnd - flight;
+	}
+
+	if(len == 0) {
+		if(c->rto_due == 0) {
+			c->rto_due = get_timestamp() + conn_rto(c);
+		}
+		return 0;
+	}
+
+	if(conn_xmit(c, PSH_PACKET, c->snd_nxt, c->txbuf + off, len) < 0) {
+		return -1;
+	}
+
+	if(owed) {
+		ack_sent(&c->ack, ACK_PIGGYBACK);
+	}
+
+	/* The data stays in the buffer, until the other end has it */
+	c->snd_nxt += len;
+	c->rto_retries = 0;
+	c->rto_due = get_timestamp() + conn_rto(c);
+	return 0;
+}
+
+
+/*
+ * Send the data not yet acknowledged again. With nothing in flight, the
+ * rest of the buffer waits for a closed window, so the window is probed
+ * instead: The last sequence-number already acknowledged makes the other
+ * end answer with its current window.
+ *
+ * @c: The established connection
+ * @now: The current time in microseconds
+ */
+static void conn_retransmit(struct conn *c, uint64_t now)
+{
+	uint32_t off = c->snd_una - c->txseq;
+	uint32_t len = c->snd_nxt - c->snd_una;
+
+	if(len == 0 && (uint32_t)c->txlen > off) {
+		conn_xmit(c, ACK_PACKET, c->snd_nxt - 1, NULL, 0);
+		c->rto_due = now + conn_rto(c);
+		return;
+	}
+
+	/* Only data of the buffer is ever unacknowledged */
+	if(len == 0 || off > (uint32_t)c->txlen || len > c->txlen - off) {
+		c->rto_due = 0;
+		return;
+	}
+
+	if(conn_xmit(c, PSH_PACKET, c->snd_una, c->txbuf + off, len) == 0 &&
+			c->ack.deadline != 0) {
+		ack_sent(&c->ack, ACK_PIGGYBACK);
+	}
+	c->retrans++;
+	c->rto_due = now + conn_rto(c);
+}
+
+
+/*
+ * Take a RST into account. Only a RST right at the next sequence-number
+ * resets the connection. One elsewhere in the window is answered with a
+ * challenge-ACK, which a real RST is repeated for at the right place,
+ * so a blind attacker has to guess the exact number (RFC 5961 3.2). A
+ * RST answering our SYN has to acknowledge it instead.
+ */
+static void conn_rst(struct conn *c, struct pkt_batch *b, int i, uint64_t now)
+{
+	switch(c->state) {
+		case CONN_CLOSED:
+		case CONN_LISTEN:
+			return;
+
+		case CONN_SYN_SENT:
+			if(!(b->m_ack >> i & 1) || (b->ack[i] != c->isn + 1 &&
+					b->ack[i] != c->isn + 1 + c->synlen)) {
+				return;
+			}
+			break;
+
+		default:
+			if(b->seq[i] == c->ack.rcv_nxt) {
+				break;
+			}
+
+			if(!seq_before(b->seq[i], c->ack.rcv_nxt) &&
+					seq_before(b->seq[i], c->rwin.right)) {
+				conn_xmit(c, ACK_PACKET, c->snd_nxt, NULL, 0);
+			}
+			return;
+	}
+
+	printf("Connection reset.\n");
+	conn_drop(c, now);
+}
+
+
+/*
+ * Finish the handshake after receiving the SYN-ACK.
+ */
+static void conn_established(struct conn *c, struct pkt_batch *b, int i,
+		uint64_t now)
+{
+	struct conn_conf *cf = c->cf;
+	int owed = 1;
+
+	/* Only a SYN-ACK for our SYN, with or without the data, will do */
+	if(!((b->m_syn & b->m_ack) >> i & 1) ||
+			(b->ack[i] != c->isn + 1 && b->ack[i] != c->isn + 1 + c->synlen)) {
+		return;
+	}
+
+	/* Agree on the window-scale, if the other end sent one as well */
+	win_established(&c->rwin, &c->swin, b->seq[i] + 1,
+			(b->opts[i] & TCPOPT_F_WSCALE) ? b->wscale[i] : -1,
+			b->window[i], now - c->stamp, now);
+
+	/* A server hands out a new cookie, if we asked for one or ours is */
+	/* invalid. Ignoring both the cookie and the data, means it doesn't */
+	/* use Fast-Open anymore. */
+	if(cf->tfo && b->opts[i] & TCPOPT_F_FASTOPEN && b->fo_len[i] > 0) {
+		tfo_put(cf->tfocache, c->dst.sin_addr.s_addr, b->fo_cookie[i],
+				b->fo_len[i]);
+	}
+	else if(c->cookielen > 0 && b->ack[i] == c->isn + 1) {
+		tfo_del(cf->tfocache, c->dst.sin_addr.s_addr);
+	}
+
+	/* The data acknowledged with the SYN doesn't have to be sent again */
+	if(c->synlen > 0 && b->ack[i] == c->isn + 1 + c->synlen) {
+		printf("Fast-Open: %d bytes sent with the SYN.\n", c->synlen);
+		memmove(c->txbuf, c->txbuf + c->synlen, c->txlen - c->synlen);
+		c->txlen -= c->synlen;
+	}
+	else if(c->synlen > 0) {
+		printf("Fast-Open: data of the SYN ignored, sending it again.\n");
+	}
+	c->synlen = 0;
+	c->txseq = b->ack[i];
+
+	/* The counters of the ACK-state cover all handshakes of the */
+	/* connection, so only the sequence-space starts over */
+	c->ack.rcv_nxt = b->seq[i] + 1;
+	c->ack.full = 0;
+	c->ack.deadline = 0;
+	ack_set_mss(&c->ack, &cf->ack,
+			(b->opts[i] & TCPOPT_F_MSS) ? b->mss[i] : 0);
+
+	c->snd_una = b->ack[i];
+	c->snd_nxt = b->ack[i];
+	c->rto_due = 0;
+	c->state = CONN_ESTABLISHED;
+
+	/* Send the ACK of the handshake. If ACKs may be delayed, it is */
+	/* piggybacked on the pending data instead. */
+	if(cf->ack.delay == 0 || c->txlen == 0) {
+		if(conn_xmit(c, ACK_PACKET, c->snd_nxt, NULL, 0) == 0) {
+			ack_sent(&c->ack, ACK_NOW);
+			owed = 0;
+		}
+	}
+
+	conn_push(c, owed);
+}
+
+
+/*
+ * Answer the SYN of the other end with our SYN-ACK. A SYN arriving again
+ * means the SYN-ACK got lost, so it is only sent again.
+ */
+static void conn_accept(struct conn *c, struct pkt_batch *b, int i,
+		uint64_t now)
+{
+	if(!(b->m_syn >> i & 1) || b->m_ack >> i & 1) {
+		return;
+	}
+
+	if(c->state == CONN_LISTEN) {
+		c->isn = isn_generate(c->src.sin_addr.s_addr, c->dst.sin_addr.s_addr,
+				c->src.sin_port, c->dst.sin_port, now);
+		c->snd_una = c->isn;
+		c->snd_nxt = c->isn + 1;
+		c->txseq = c->snd_nxt;
+		c->rto_due = 0;
+
+		c->ack.rcv_nxt = b->seq[i] + 1;
+		c->ack.full = 0;
+		c->ack.deadline = 0;
+		ack_set_mss(&c->ack, &c->cf->ack,
+				(b->opts[i] & TCPOPT_F_MSS) ? b->mss[i] : 0);
+
+		/* The window is only scaled, if the SYN offered it */
+		win_free(&c->rwin);
+		win_init(&c->rwin, WIN_MAX);
+		win_established(&c->rwin, &c->swin, c->ack.rcv_nxt,
+				(b->opts[i] & TCPOPT_F_WSCALE) ? b->wscale[i] : -1,
+				b->window[i], 0, now);
+
+		c->stamp = now;
+		c->state = CONN_SYN_RCVD;
+	}
+	else {
+		c->retrans++;
+	}
+
+	conn_xmit(c, SYNACK_PACKET, c->isn, NULL, 0);
+}
+
+
+int conn_init(struct conn *c, struct rawio *io, struct conn_conf *cf,
+		struct sockaddr_in *src, struct sockaddr_in *dst)
+{
+	memset(c, 0, sizeof(struct conn));
+	c->io = io;
+	c->cf = cf;
+	c->src = *src;
+	c->dst = *dst;
+	c->state = CONN_CLOSED;
+	c->slot = -1;
+
+	if(!(c->txbuf = malloc(CONN_TX_LEN)) || !(c->rxbuf = malloc(CONN_RX_LEN))) {
+		goto err_free;
+	}
+
+	if(rawio_add_flow(io, src, dst, c) < 0) {
+		goto err_free;
+	}
+
+	return 0;
+
+err_free:
+	free(c->txbuf);
+	free(c->rxbuf);
+	return -1;
+}
+
+
+void conn_free(struct conn *c)
+{
+	rawio_del_flow(c->io, &c->src, &c->dst);
+	win_free(&c->rwin);
+	free(c->txbuf);
+	free(c->rxbuf);
+}
+
+
+int conn_rebind(struct conn *c, uint16_t port)
+{
+	if(c->state != CONN_CLOSED) {
+		return -1;
+	}
+
+	rawio_del_flow(c->io, &c->src, &c->dst);
+	c->src.sin_port = port;
+	return rawio_add_flow(c->io, &c->src, &c->dst, c);
+}
+
+
+int conn_connect(struct conn *c, char *data, int len)
+{
+	struct conn_conf *cf = c->cf;
+
+	if(c->state != CONN_CLOSED) {
+		return -1;
+	}
+
+	c->state = CONN_SYN_SENT;
+	c->broken = 0;
+	c->timewait = 0;
+	c->retries = 0;
+	c->rto_due = 0;
+	c->rto_retries = 0;
+	c->probes = 0;
+	c->txlen = 0;
+	c->rxlen = 0;
+	c->rxdone = 0;
+	if(data != NULL && conn_send(c, data, len) < 0) {
+		return -1;
+	}
+
+	/* Prepare the receive-window offered in the SYN */
+	win_free(&c->rwin);
+	win_init(&c->rwin, WIN_MAX);
+
+	/* With Fast-Open the data goes out with the SYN, if we already */
+	/* know a cookie of the server. Otherwise a cookie is requested. */
+	c->cookielen = 0;
+	c->synlen = 0;
+	if(cf->tfo && (c->cookielen = tfo_get(cf->tfocache, c->dst.sin_addr.s_addr, c->cookie)) > 0) {
+		c->synlen = (c->txlen > TFO_SYN_MSS) ? TFO_SYN_MSS : c->txlen;
+	}
+
+	return conn_syn(c, get_timestamp());
+}
+
+
+int conn_listen(struct conn *c)
+{
+	if(c->state != CONN_CLOSED) {
+		return -1;
+	}
+
+	c->state = CONN_LISTEN;
+	c->broken = 0;
+	c->timewait = 0;
+	c->retries = 0;
+	c->rto_due = 0;
+	c->rto_retries = 0;
+	c->probes = 0;
+	c->cookielen = 0;
+	c->synlen = 0;
+	c->txlen = 0;
+	c->rxlen = 0;
+	c->rxdone = 0;
+	return 0;
+}
+
+
+int conn_send(struct conn *c, char *data, int len)
+{
+	if(len > CONN_TX_LEN) {
+		len = CONN_TX_LEN;
+	}
+
+	/* The data of earlier requests stays in front, until the other end */
+	/* acknowledges it */
+	if(len > CONN_TX_LEN - c->txlen) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	memcpy(c->txbuf + c->txlen, data, len);
+	c->txlen += len;
+	c->rxlen = 0;
+	c->rxdone = 0;
+	c->requests++;
+
+	if(c->state != CONN_ESTABLISHED) {
+		return 0;
+	}
+
+	return conn_push(c, c->ack.deadline != 0);
+}
+
+
+void conn_input(struct conn *c, struct pkt_batch *b, int i, char *pck,
+		int pcklen, uint64_t now)
+{
+	uint32_t nxt, acked;
+	int inorder;
+	int action;
+	int len;
+
+	c->pkts_in++;
+	c->bytes_in += pcklen;
+
+	/* Display packet-info and payload in the terminal, if asked to */
+	if(dump_datagrams) {
+		dump_packet(pck, pcklen);
+		if(b->m_data >> i & 1) {
+			hexDump(pck + b->pldoff[i], b->pldlen[i]);
+			printf("Dumped %d bytes.\n", b->pldlen[i]);
+		}
+	}
+
+	/* Anything from the other end proves it is still alive */
+	c->last_rx = now;
+	c->probes = 0;
+
+	if(b->m_rst >> i & 1) {
+		conn_rst(c, b, i, now);
+		return;
+	}
+
+	if(c->state == CONN_SYN_SENT) {
+		conn_established(c, b, i, now);
+		return;
+	}
+	if(c->state == CONN_LISTEN || (c->state == CONN_SYN_RCVD && b->m_syn >> i & 1)) {
+		conn_accept(c, b, i, now);
+		return;
+	}
+	if(c->state == CONN_CLOSED) {
+		return;
+	}
+
+	/* The handshake of a passive connection ends with the ACK of our */
+	/* SYN, which might already carry the first request */
+	if(c->state == CONN_SYN_RCVD) {
+		if(!(b->m_ack >> i & 1) || b->ack[i] != c->isn + 1) {
+			return;
+		}
+		c->rwin.rtt = now - c->stamp;
+		c->state = CONN_ESTABLISHED;
+	}
+
+	/* New data acknowledged restarts the retransmission-timer */
+	if(b->m_ack >> i & 1 && seq_before(c->snd_una, b->ack[i]) &&
+			!seq_before(c->snd_nxt, b->ack[i])) {
+		c->snd_una = b->ack[i];
+		c->rto_retries = 0;
+		c->rto_due = (c->snd_una == c->snd_nxt) ? 0 : now + conn_rto(c);
+
+		/* The acknowledged data leaves the buffer. Our FIN takes a */
+		/* sequence-number as well, but no place in the buffer. */
+		acked = c->snd_una - c->txseq;
+		if(acked > (uint32_t)c->txlen) {
+			acked = c->txlen;
+		}
+		memmove(c->txbuf, c->txbuf + acked, c->txlen - acked);
+		c->txlen -= acked;
+		c->txseq += acked;
+	}
+
+	/* Collect the response, as long as nothing is missing before it */
+	inorder = (b->seq[i] == c->ack.rcv_nxt);
+	if(b->m_data >> i & 1 && inorder) {
+		len = b->pldlen[i];
+		if(len > CONN_RX_LEN - c->rxlen) {
+			len = CONN_RX_LEN - c->rxlen;
+		}
+		memcpy(c->rxbuf + c->rxlen, pck + b->pldoff[i], len);
+		c->rxlen += len;
+
+		if(b->m_psh >> i & 1) {
+			c->rxdone = 1;
+			c->rxstamp = now;
+		}
+	}
+
+	/* Update the ack-number and both windows */
+	action = ack_on_segment(&c->ack, &c->cf->ack, b->seq[i],
+			b->pldlen[i], b->flags[i], now);
+	snd_win_update(&c->swin, b->window[i]);
+	win_on_data(&c->rwin, c->ack.rcv_nxt, b->pldlen[i], now);
+
+	/* Answer a FIN with our own FIN, which also acknowledges it. If we */
+	/* closed first, only the ACK is missing. A FIN after a gap is only */
+	/* answered with the duplicate ACK below, as data is still missing. */
+	if(b->m_fin >> i & 1 && inorder) {
+		if(c->state == CONN_ESTABLISHED) {
+			if(conn_xmit(c, FIN_PACKET, c->snd_nxt, NULL, 0) == 0) {
+				ack_sent(&c->ack, ACK_NOW);
+			}
+			c->snd_nxt++;
+			conn_drop(c, now);
+		}
+		else {
+			if(conn_xmit(c, ACK_PACKET, c->snd_nxt, NULL, 0) == 0) {
+				ack_sent(&c->ack, ACK_NOW);
+			}
+			c->state = CONN_CLOSED;
+		}
+		c->timewait = 1;
+		return;
+	}
+
+	/* The window might have opened for the rest of the buffer, which */
+	/* then carries the ACK as well */
+	nxt = c->snd_nxt;
+	if(c->state == CONN_ESTABLISHED) {
+		conn_push(c, action == ACK_NOW || c->ack.deadline != 0);
+	}
+
+	if(c->snd_nxt == nxt && action == ACK_NOW &&
+			conn_xmit(c, ACK_PACKET, c->snd_nxt, NULL, 0) == 0) {
+		ack_sent(&c->ack, ACK_NOW);
+	}
+}
+
+
+void conn_timer(struct conn *c, uint64_t now)
+{
+	struct conn_conf *cf = c->cf;
+
+	switch(c->state) {
+		case CONN_SYN_SENT:
+			if(now < conn_syn_due(c)) {
+				break;
+			}
+
+			if(++c->retries > CONN_SYN_RETRIES) {
+				printf("Connection timed out.\n");
+				conn_drop(c, now);
+				break;
+			}
+
+			/* Fall back to a plain SYN and don't use the cookie anymore */
+			if(c->synlen > 0) {
+				printf("No answer to the Fast-Open-SYN, retrying without data.\n");
+				tfo_del(cf->tfocache, c->dst.sin_addr.s_addr);
+				c->cookielen = c->synlen = 0;
+			}
+			c->retrans++;
+			conn_syn(c, now);
+			break;
+
+		case CONN_SYN_RCVD:
+			if(now < conn_syn_due(c)) {
+				break;
+			}
+
+			/* The other end gave up, or our SYN-ACK keeps getting lost */
+			if(++c->retries > CONN_SYN_RETRIES) {
+				conn_drop(c, now);
+				break;
+			}
+			c->retrans++;
+			conn_xmit(c, SYNACK_PACKET, c->isn, NULL, 0);
+			c->stamp = now;
+			break;
+
+		case CONN_ESTABLISHED:
+			if(c->rto_due != 0 && now >= c->rto_due) {
+				if(++c->rto_retries > CONN_RTO_RETRIES) {
+					printf("Connection timed out.\n");
+					conn_reset(c);
+					break;
+				}
+				conn_retransmit(c, now);
+			}
+
+			if(ack_timeout(&c->ack, now) == 0 &&
+					conn_xmit(c, ACK_PACKET, c->snd_nxt, NULL, 0) == 0) {
+				ack_sent(&c->ack, ACK_LATER);
+			}
+
+			if(cf->keepalive == 0 || c->busy || now < conn_ka_due(c)) {
+				break;
+			}
+
+			if(c->probes >= cf->kaprobes) {
+				printf("Keep-alive: no answer, connection broken.\n");
+				conn_reset(c);
+				break;
+			}
+
+			/* A probe repeats the last sequence-number already */
+			/* acknowledged, which the other end has to answer with */
+			/* an ACK (RFC 1122 4.2.3.6) */
+			conn_xmit(c, ACK_PACKET, c->snd_nxt - 1, NULL, 0);
+			c->probes++;
+			break;
+
+		case CONN_FIN_WAIT:
+			/* The other end might still send, so let the 4-tuple rest */
+			if(now >= c->stamp + (uint64_t)CONN_FIN_TIMEOUT * 1000) {
+				c->state = CONN_CLOSED;
+				c->timewait = 1;
+			}
+			break;
+	}
+}
+
+
+int conn_timeout(struct conn *c, uint64_t now)
+{
+	uint64_t due = 0;
+
+	switch(c->state) {
+		case CONN_SYN_SENT:
+		case CONN_SYN_RCVD:
+			due = conn_syn_due(c);
+			break;
+
+		case CONN_ESTABLISHED:
+			conn_due(&due, c->rto_due);
+			conn_due(&due, c->ack.deadline);
+			if(c->cf->keepalive > 0 && !c->busy) {
+				conn_due(&due, conn_ka_due(c));
+			}
+			break;
+
+		case CONN_FIN_WAIT:
+			due = c->stamp + (uint64_t)CONN_FIN_TIMEOUT * 1000;
+			break;
+	}
+
+	if(due == 0) {
+		return -1;
+	}
+
+	if(now >= due) {
+		return 0;
+	}
+
+	/* Round up, so the timer doesn't fire before it is due */
+	return (due - now + 999) / 1000;
+}
+
+
+void conn_close(struct conn *c)
+{
+	if(c->state == CONN_LISTEN) {
+		c->state = CONN_CLOSED;
+		return;
+	}
+
+	if(c->state == CONN_SYN_SENT || c->state == CONN_SYN_RCVD) {
+		conn_reset(c);
+		return;
+	}
+
+	if(c->state != CONN_ESTABLISHED) {
+		return;
+	}
+
+	if(conn_xmit(c, FIN_PACKET, c->snd_nxt, NULL, 0) == 0 && c->ack.deadline != 0) {
+		ack_sent(&c->ack, ACK_PIGGYBACK);
+	}
+	c->snd_nxt++;
+	c->state = CONN_FIN_WAIT;
+	c->stamp = get_timestamp();
+}
+
+
+void conn_reset(struct conn *c)
+{
+	if(c->state == CONN_CLOSED) {
+		return;
+	}
+
+	conn_xmit(c, RST_PACKET, c->snd_nxt, NULL, 0);
+	conn_drop(c, get_timestamp());
+}
@@ -0,0 +1,296 @@
+#ifndef _CONN_H
+#define _CONN_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "ack.h"
+#include "rawio.h"
+#include "tfo.h"
+#include "window.h"
+
+/* The states of a connection */
+#define CONN_CLOSED      0
+#define CONN_SYN_SENT    1
+#define CONN_ESTABLISHED 2
+#define CONN_FIN_WAIT    3
+#define CONN_LISTEN      4
+#define CONN_SYN_RCVD    5
+
+/* How long to wait for the SYN-ACK in milliseconds, doubled every retry */
+#define CONN_SYN_TIMEOUT 1000
+
+/* How often a SYN is sent again, before giving up */
+#define CONN_SYN_RETRIES 3
+
+/* The bounds of the retransmission-timeout of data in milliseconds. It */
+/* starts at three times the round-trip-time and doubles every retry. */
+#define CONN_RTO_MIN 200
+#define CONN_RTO_MAX 60000
+
+/* How often data is sent again, before the connection is given up */
+#define CONN_RTO_RETRIES 8
+
+/* How long to wait for the FIN of the other end in milliseconds */
+#define CONN_FIN_TIMEOUT 1000
+
+/* The time between two keep-alive-probes in milliseconds, and how many */
+/* unanswered probes mean the connection is broken */
+#define CONN_KA_INTVL  1000
+#define CONN_KA_PROBES 3
+
+/* The space for the data of a request and of a response */
+#define CONN_TX_LEN 1024
+#define CONN_RX_LEN 65536
+
+struct stats;
+
+/*
+ * The settings shared by all connections.
+ *
+ * @ack: The ACK-policy
+ * @tfo: Send the data of the first request with the SYN
+ * @tfocache: The Fast-Open-cookies of the servers
+ * @keepalive: The idle time in milliseconds, before a connection is
+ *             probed, 0 to never probe
+ * @kaintvl: The time between two probes in milliseconds
+ * @kaprobes: The number of unanswered probes, before the connection is
+ *            considered broken
+ * @stats: The shared memory to publish the counters in, or NULL
+ */
+struct conn_conf {
+	struct ack_conf ack;
+	int tfo;
+	struct tfo_cache *tfocache;
+	int keepalive;
+	int kaintvl;
+	int kaprobes;
+	struct stats *stats;
+};
+
+/*
+ * A connection driven by the datagrams received with a shared handle of
+ * the I/O-engine. The flow of the connection is added to the handle with
+ * the connection as context, so received datagrams are handed to the
+ * right connection by looking at the context of their burst.
+ *
+ * @io: The handle of the I/O-engine
+ * @cf: The shared settings
+ * @src, @dst: The addresses of both ends
+ * @state: The state of the connection (CONN_*)
+ * @broken: The other end closed or reset the connection, or it timed out
+ * @timewait: The connection ended with FINs, so its 4-tuple rests in
+ *            TIME_WAIT before it may be used again
+ * @isn: Our initial sequence-number
+ * @snd_nxt: The next sequence-number we send
+ * @snd_una: The first sequence-number not yet acknowledged
+ * @ack: The ACK-state
+ * @rwin, @swin: The receive- and the send-window
+ * @stamp: The time the SYN or FIN was sent in microseconds
+ * @retries: The number of times the SYN was sent again
+ * @rto_due: The time the unacknowledged data is sent again in
+ *           microseconds, 0 if all data was acknowledged
+ * @rto_retries: The number of times the data was sent again
+ * @last_rx: The time the last datagram was received in microseconds
+ * @probes: The number of keep-alive-probes sent since then
+ * @cookie, @cookielen: The Fast-Open-cookie sent with the SYN
+ * @synlen: The amount of data sent with the SYN
+ * @txbuf, @txlen: The data not yet acknowledged by the other end. The
+ *                 part from snd_nxt on waits for the handshake to finish
+ *                 or for the send-window to open.
+ * @txseq: The sequence-number of the first byte in the send-buffer
+ * @rxbuf, @rxlen: The data of the current response
+ * @rxdone: The response is complete
+ * @rxstamp: The time the response was completed in microseconds
+ * @busy: The connection is handed out for a request
+ * @reconnects: The reconnects in the background since the connection was
+ *              last established
+ * @requests: The number of requests sent on the connection
+ * @pkts_in, @bytes_in: The datagrams received
+ * @pkts_out, @bytes_out: The datagrams sent
+ * @retrans: The number of SYNs, SYN-ACKs and data-segments sent again
+ * @slot: The record of the connection in the statistics, or -1
+ * @next: The next connection in the list of the owner
+ */
+struct conn {
+	struct rawio *io;
+	struct conn_conf *cf;
+	struct sockaddr_in src;
+	struct sockaddr_in dst;
+
+	int state;
+	int broken;
+	int timewait;
+	uint32_t isn;
+	uint32_t snd_nxt;
+	uint32_t snd_una;
+	struct ack_state ack;
+	struct rcv_win rwin;
+	struct snd_win swin;
+
+	uint64_t stamp;
+	int retries;
+	uint64_t rto_due;
+	int rto_retries;
+	uint64_t last_rx;
+	int probes;
+
+	uint8_t cookie[TFO_COOKIE_MAX];
+	int cookielen;
+	int synlen;
+
+	char *txbuf;
+	int txlen;
+	uint32_t txseq;
+	char *rxbuf;
+	int rxlen;
+	int rxdone;
+	uint64_t rxstamp;
+
+	int busy;
+	int reconnects;
+	unsigned long requests;
+	unsigned long pkts_in;
+	unsigned long bytes_in;
+	unsigned long pkts_out;
+	unsigned long bytes_out;
+	unsigned long retrans;
+	int slot;
+	struct conn *next;
+};
+
+
+/*
+ * Initialize a closed connection and add its flow to the handle.
+ *
+ * @c: The connection to initialize
+ * @io: The handle of the I/O-engine
+ * @cf: The shared settings
+ * @src: The local address and port
+ * @dst: The address and port of the other end
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int conn_init(struct conn *c, struct rawio *io, struct conn_conf *cf,
+		struct sockaddr_in *src, struct sockaddr_in *dst);
+
+
+/*
+ * Remove the flow of a connection from the handle and free its buffers.
+ * The connection is not closed.
+ *
+ * @c: The connection
+ */
+void conn_free(struct conn *c);
+
+
+/*
+ * Move a closed connection to another local port.
+ *
+ * @c: The connection
+ * @port: The new port in network-byte-order
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int conn_rebind(struct conn *c, uint16_t port);
+
+
+/*
+ * Start the handshake by sending the SYN. With Fast-Open and a known
+ * cookie, the data is sent along with the SYN. Data the server doesn't
+ * acknowledge with the SYN-ACK, is sent right after the handshake.
+ *
+ * @c: The closed connection
+ * @data: The data of the first request or NULL
+ * @len: The length of the data
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int conn_connect(struct conn *c, char *data, int len);
+
+
+/*
+ * Wait for the SYN of the other end, instead of sending one. The flow of
+ * the connection already names the other end, so a listener creates the
+ * connection when the SYN arrives. Afterwards, the connection works just
+ * like an active one: A complete request is found in the receive-buffer,
+ * and conn_send() answers it.
+ *
+ * @c: The closed connection
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int conn_listen(struct conn *c);
+
+
+/*
+ * Send a request and forget the previous response. If the handshake is
+ * still going on, the data is sent once it is finished. Data of earlier
+ * requests not yet acknowledged is kept in front of it.
+ *
+ * @c: The connection
+ * @data: The data to send
+ * @len: The length of the data, at most CONN_TX_LEN
+ *
+ * Returns: 0 on success and -1 if an error occurred, with errno set to
+ *          EAGAIN if the earlier data leaves no room for the request
+ */
+int conn_send(struct conn *c, char *data, int len);
+
+
+/*
+ * Handle a datagram received for the connection. The response is
+ * complete with the first data carrying the PSH-flag, or when the other
+ * end closes the connection. A listening connection answers a SYN with
+ * its SYN-ACK instead.
+ *
+ * @c: The connection
+ * @b: The parsed batch the datagram is part of
+ * @i: The index of the datagram in the batch, which has to be valid
+ * @pck: The datagram, starting with the IP-header
+ * @pcklen: The length of the datagram
+ * @now: The current time in microseconds
+ */
+void conn_input(struct conn *c, struct pkt_batch *b, int i, char *pck,
+		int pcklen, uint64_t now);
+
+
+/*
+ * Handle all timers of the connection which are due: the delayed ACK,
+ * SYN-, SYN-ACK- and data-retransmissions, the end of closing and the
+ * keep-alive-probes.
+ *
+ * @c: The connection
+ * @now: The current time in microseconds
+ */
+void conn_timer(struct conn *c, uint64_t now);
+
+
+/*
+ * Get the time left until the next timer of the connection is due.
+ *
+ * @c: The connection
+ * @now: The current time in microseconds
+ *
+ * Returns: The time left in milliseconds or -1 if no timer is running
+ */
+int conn_timeout(struct conn *c, uint64_t now);
+
+
+/*
+ * Close the connection by sending a FIN. A connection which isn't
+ * established is closed right away.
+ *
+ * @c: The connection
+ */
+void conn_close(struct conn *c);
+
+
+/*
+ * Abort the connection by sending a RST.
+ *
+ * @c: The connection
+ */
+void conn_reset(struct conn *c);
+
+#endif /* _CONN_H */
@@ -0,0 +1,430 @@
+#include "flowtab.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* The number of displacements before the table is grown */
+#define FLOWTAB_MAX_KICKS 256
+
+
+/*
+ * Hash a key. The lower bits select the bucket, the upper 16 bits are
+ * used as the tag.
+ */
+static uint64_t flowtab_hash(struct flowtab *ft, struct flow_key *key)
+{
+	uint64_t h = ft->seed;
+
+	h ^= (uint64_t)key->saddr * 0x9e3779b97f4a7c15UL;
+	h ^= (((uint64_t)key->daddr << 32) |
+			((uint32_t)key->sport << 16) | key->dport) * 0xc2b2ae3d27d4eb4fUL;
+
+	/* Mix the bits, so every input-bit affects the bucket and the tag */
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9UL;
+	h ^= h >> 32;
+
+	return h;
+}
+
+
+static uint16_t flowtab_tag(uint64_t h)
+{
+	uint16_t tag = h >> 48;
+
+	/* A tag of 0 marks an empty slot */
+	return tag ? tag : 1;
+}
+
+
+/*
+ * Get the other bucket a key can be stored in. Applying the function twice
+ * returns the original bucket.
+ */
+static uint32_t flowtab_alt(struct flowtab *ft, uint32_t b, uint16_t tag)
+{
+	return (b ^ (tag * 0x5bd1e995U)) & ft->mask;
+}
+
+
+/*
+ * Compare the tags of all slots of a bucket at once.
+ *
+ * Returns: A bitmask with bit i set, if the tag of slot i matches
+ */
+static unsigned flowtab_match(struct flowtab_bucket *b, uint16_t tag)
+{
+#ifdef __SSE2__
+	__m128i tags = _mm_load_si128((const __m128i *)b->tag);
+	__m128i eq = _mm_cmpeq_epi16(tags, _mm_set1_epi16(tag));
+
+	/* Narrow the 16-bit results to bytes, to get one bit per slot */
+	return _mm_movemask_epi8(_mm_packs_epi16(eq, _mm_setzero_si128()));
+#else
+	unsigned m = 0;
+	int i;
+
+	for(i = 0; i < FLOWTAB_SLOTS; i++) {
+		m |= (unsigned)(b->tag[i] == tag) << i;
+	}
+	return m;
+#endif
+}
+
+
+static int flowtab_key_eq(struct flow_key *a, struct flow_key *b)
+{
+	return a->saddr == b->saddr && a->daddr == b->daddr &&
+		a->sport == b->sport && a->dport == b->dport;
+}
+
+
+/*
+ * Search a key in one bucket.
+ *
+ * Returns: The slot of the key or -1 if it isn't stored in the bucket
+ */
+static int flowtab_probe(struct flowtab *ft, uint32_t b, uint16_t tag,
+		struct flow_key *key)
+{
+	struct flowtab_bucket *bkt = &ft->buckets[b];
+	unsigned m = flowtab_match(bkt, tag);
+	int slot;
+
+	while(m) {
+		slot = __builtin_ctz(m);
+		if(flowtab_key_eq(&ft->entries[bkt->idx[slot]].key, key)) {
+			return slot;
+		}
+		m &= m - 1;
+	}
+
+	return -1;
+}
+
+
+/*
+ * Put an entry into a free slot of a bucket.
+ *
+ * Returns: 0 on success and -1 if the bucket is full
+ */
+static int flowtab_put(struct flowtab *ft, uint32_t b, uint16_t tag,
+		uint32_t idx)
+{
+	struct flowtab_bucket *bkt = &ft->buckets[b];
+	unsigned m = flowtab_match(bkt, 0);
+	int slot;
+
+	if(m == 0) {
+		return -1;
+	}
+
+	slot = __builtin_ctz(m);
+	bkt->tag[slot] = tag;
+	bkt->idx[slot] = idx;
+	return 0;
+}
+
+
+/*
+ * Place an entry in one of its two buckets. If both are full, entries are
+ * moved to their other bucket to make room.
+ *
+ * Returns: 0 on success and -1 if no room could be made
+ */
+static int flowtab_place(struct flowtab *ft, uint32_t b, uint16_t tag,
+		uint32_t idx)
+{
+	struct flowtab_bucket *bkt;
+	uint16_t vtag;
+	uint32_t vidx;
+	int kick, slot;
+
+	for(kick = 0; kick < FLOWTAB_MAX_KICKS; kick++) {
+		if(flowtab_put(ft, b, tag, idx) == 0 ||
+				flowtab_put(ft, flowtab_alt(ft, b, tag), tag, idx) == 0) {
+			return 0;
+		}
+
+		/* Evict a victim and move it to its other bucket next */
+		bkt = &ft->buckets[b];
+		slot = (tag + kick) % FLOWTAB_SLOTS;
+		vtag = bkt->tag[slot];
+		vidx = bkt->idx[slot];
+		bkt->tag[slot] = tag;
+		bkt->idx[slot] = idx;
+
+		tag = vtag;
+		idx = vidx;
+		b = flowtab_alt(ft, b, tag);
+	}
+
+	/* The homeless entry is placed again, when the table is rebuilt */
+	return -1;
+}
+
+
+/*
+ * Allocate memory for the buckets and place all used entries in them.
+ *
+ * @ft: The table
+ * @nbuckets: The number of buckets (a power of 2)
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int flowtab_rebuild(struct flowtab *ft, uint32_t nbuckets)
+{
+	struct flowtab_entry *e;
+	uint64_t h;
+	uint32_t i;
+	void *mem;
+
+	while(1) {
+		if(posix_memalign(&mem, 64, nbuckets * sizeof(struct flowtab_bucket))) {
+			return -1;
+		}
+
+		free(ft->buckets);
+		ft->buckets = mem;
+		ft->mask = nbuckets - 1;
+		memset(ft->buckets, 0, nbuckets * sizeof(struct flowtab_bucket));
+
+		for(i = 0; i < ft->cap; i++) {
+			e = &ft->entries[i];
+			if(!e->used) {
+				continue;
+			}
+
+			h = flowtab_hash(ft, &e->key);
+			if(flowtab_place(ft, h & ft->mask, flowtab_tag(h), i) < 0) {
+				break;
+			}
+		}
+
+		if(i == ft->cap) {
+			return 0;
+		}
+
+		/* Still too crowded, try again with twice the buckets */
+		nbuckets *= 2;
+	}
+}
+
+
+/*
+ * Double the number of entries.
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int flowtab_grow_entries(struct flowtab *ft)
+{
+	struct flowtab_entry *entries;
+	uint32_t *freeidx;
+	uint32_t cap = ft->cap * 2, i;
+
+	if(!(entries = realloc(ft->entries, cap * sizeof(struct flowtab_entry)))) {
+		return -1;
+	}
+	ft->entries = entries;
+
+	if(!(freeidx = realloc(ft->free, cap * sizeof(uint32_t)))) {
+		return -1;
+	}
+	ft->free = freeidx;
+
+	memset(ft->entries + ft->cap, 0, ft->cap * sizeof(struct flowtab_entry));
+
+	/* All entries are in use, so the stack only holds the new ones */
+	for(i = 0; i < cap - ft->cap; i++) {
+		ft->free[i] = cap - 1 - i;
+	}
+	ft->cap = cap;
+
+	return 0;
+}
+
+
+int flowtab_init(struct flowtab *ft, uint32_t size)
+{
+	uint32_t nbuckets = 1, i;
+
+	memset(ft, 0, sizeof(struct flowtab));
+
+	if(size < FLOWTAB_SLOTS) {
+		size = FLOWTAB_SLOTS;
+	}
+
+	/* Aim for a load of about 80% */
+	while(nbuckets * FLOWTAB_SLOTS * 4 < size * 5) {
+		nbuckets *= 2;
+	}
+
+	ft->cap = size;
+	ft->entries = calloc(size, sizeof(struct flowtab_entry));
+	ft->free = malloc(size * sizeof(uint32_t));
+	if(!ft->entries || !ft->free) {
+		flowtab_free(ft);
+		return -1;
+	}
+
+	for(i = 0; i < size; i++) {
+		ft->free[i] = size - 1 - i;
+	}
+
+	/* A random seed makes it hard to flood a single bucket on purpose */
+	ft->seed = ((uint64_t)time(NULL) << 32) ^ ((uint64_t)getpid() << 16) ^
+		(uint64_t)(unsigned long)ft;
+
+	if(flowtab_rebuild(ft, nbuckets) < 0) {
+		flowtab_free(ft);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void flowtab_free(struct flowtab *ft)
+{
+	free(ft->buckets);
+	free(ft->entries);
+	free(ft->free);
+	memset(ft, 0, sizeof(struct flowtab));
+}
+
+
+int flowtab_insert(struct flowtab *ft, struct flow_key *key, void *val)
+{
+	struct flowtab_entry *e;
+	uint64_t h = flowtab_hash(ft, key);
+	uint16_t tag = flowtab_tag(h);
+	uint32_t b = h & ft->mask, idx;
+	int slot;
+
+	/* Update the value of an existing key */
+	if((slot = flowtab_probe(ft, b, tag, key)) >= 0) {
+		ft->entries[ft->buckets[b].idx[slot]].val = val;
+		return 0;
+	}
+	b = flowtab_alt(ft, b, tag);
+	if((slot = flowtab_probe(ft, b, tag, key)) >= 0) {
+		ft->entries[ft->buckets[b].idx[slot]].val = val;
+		return 0;
+	}
+
+	if(ft->count == ft->cap && flowtab_grow_entries(ft) < 0) {
+		return -1;
+	}
+
+	idx = ft->free[ft->cap - ft->count - 1];
+	e = &ft->entries[idx];
+	e->key = *key;
+	e->val = val;
+	e->used = 1;
+	ft->count++;
+
+	/* Keep the load below 80% */
+	if(ft->count * 5 > (ft->mask + 1) * FLOWTAB_SLOTS * 4) {
+		return flowtab_rebuild(ft, (ft->mask + 1) * 2);
+	}
+
+	if(flowtab_place(ft, h & ft->mask, tag, idx) < 0) {
+		return flowtab_rebuild(ft, (ft->mask + 1) * 2);
+	}
+
+	return 0;
+}
+
+
+int flowtab_delete(struct flowtab *ft, struct flow_key *key)
+{
+	uint64_t h = flowtab_hash(ft, key);
+	uint16_t tag = flowtab_tag(h);
+	uint32_t b = h & ft->mask, idx;
+	int slot;
+
+	if((slot = flowtab_probe(ft, b, tag, key)) < 0) {
+		b = flowtab_alt(ft, b, tag);
+		if((slot = flowtab_probe(ft, b, tag, key)) < 0) {
+			return -1;
+		}
+	}
+
+	idx = ft->buckets[b].idx[slot];
+	ft->buckets[b].tag[slot] = 0;
+	ft->entries[idx].used = 0;
+	ft->entries[idx].val = NULL;
+
+	ft->count--;
+	ft->free[ft->cap - ft->count - 1] = idx;
+
+	return 0;
+}
+
+
+int flowtab_lookup(struct flowtab *ft, struct flow_key *key, void **val)
+{
+	uint64_t h = flowtab_hash(ft, key);
+	uint16_t tag = flowtab_tag(h);
+	uint32_t b = h & ft->mask;
+	int slot;
+
+	if((slot = flowtab_probe(ft, b, tag, key)) < 0) {
+		b = flowtab_alt(ft, b, tag);
+		if((slot = flowtab_probe(ft, b, tag, key)) < 0) {
+			return 0;
+		}
+	}
+
+	*val = ft->entries[ft->buckets[b].idx[slot]].val;
+	return 1;
+}
+
+
+uint32_t flowtab_lookup_batch(struct flowtab *ft, struct flow_key *keys,
+		int n, void **vals)
+{
+	uint32_t b1[FLOWTAB_BATCH], b2[FLOWTAB_BATCH];
+	uint16_t tag[FLOWTAB_BATCH];
+	uint32_t found = 0;
+	uint64_t h;
+	int i, slot;
+
+	if(n > FLOWTAB_BATCH) {
+		n = FLOWTAB_BATCH;
+	}
+
+	/* Hash all keys and start fetching both of their buckets */
+	for(i = 0; i < n; i++) {
+		h = flowtab_hash(ft, &keys[i]);
+		tag[i] = flowtab_tag(h);
+		b1[i] = h & ft->mask;
+		b2[i] = flowtab_alt(ft, b1[i], tag[i]);
+		__builtin_prefetch(&ft->buckets[b1[i]]);
+		__builtin_prefetch(&ft->buckets[b2[i]]);
+	}
+
+	/* By now the first buckets should have arrived in the cache */
+	for(i = 0; i < n; i++) {
+		vals[i] = NULL;
+
+		if((slot = flowtab_probe(ft, b1[i], tag[i], &keys[i])) >= 0) {
+			vals[i] = ft->entries[ft->buckets[b1[i]].idx[slot]].val;
+			found |= (uint32_t)1 << i;
+		}
+		else if((slot = flowtab_probe(ft, b2[i], tag[i], &keys[i])) >= 0) {
+			vals[i] = ft->entries[ft->buckets[b2[i]].idx[slot]].val;
+			found |= (uint32_t)1 << i;
+		}
+	}
+
+	return found;
+}
+
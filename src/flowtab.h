@@ -0,0 +1,151 @@
+#ifndef _FLOWTAB_H
+#define _FLOWTAB_H
+
+#include <stdint.h>
+
+/* The number of slots in a single bucket */
+#define FLOWTAB_SLOTS 8
+
+/* The maximum number of keys looked up at once */
+#define FLOWTAB_BATCH 32
+
+/*
+ * The 4-tuple identifying a connection. All fields are stored in
+ * network-byte-order, just like they appear in a received datagram, so
+ * the key can be taken directly from the headers.
+ *
+ * @saddr: The IP-address of the remote end
+ * @daddr: The local IP-address
+ * @sport: The port of the remote end
+ * @dport: The local port
+ */
+struct flow_key {
+	uint32_t saddr;
+	uint32_t daddr;
+	uint16_t sport;
+	uint16_t dport;
+};
+
+/*
+ * A bucket of the table, filling exactly one cache-line. A lookup first
+ * compares the 16-bit tags of all slots at once and only touches the
+ * entries of matching slots. A tag of 0 marks an empty slot.
+ *
+ * @tag: Part of the hash of the key in each slot
+ * @idx: The index of the entry in each slot
+ */
+struct flowtab_bucket {
+	uint16_t tag[FLOWTAB_SLOTS];
+	uint32_t idx[FLOWTAB_SLOTS];
+	uint32_t pad[4];
+} __attribute__((aligned(64)));
+
+/*
+ * An entry of the table.
+ *
+ * @key: The 4-tuple
+ * @used: The entry holds a key
+ * @val: The value stored for the key
+ */
+struct flowtab_entry {
+	struct flow_key key;
+	uint32_t used;
+	void *val;
+};
+
+/*
+ * A bucketized cuckoo-hash-table mapping 4-tuples to connections. Every
+ * key can live in one of two buckets, so a lookup touches at most two
+ * cache-lines for the tags. The second bucket is derived from the first
+ * one and the tag, so entries can be moved without rehashing their key.
+ *
+ * @buckets: The buckets
+ * @mask: The number of buckets minus one
+ * @entries: The entries referenced by the buckets
+ * @cap: The number of entries allocated
+ * @count: The number of keys stored
+ * @free: A stack with the indices of all unused entries
+ * @seed: The seed of the hash-function
+ */
+struct flowtab {
+	struct flowtab_bucket *buckets;
+	uint32_t mask;
+	struct flowtab_entry *entries;
+	uint32_t cap;
+	uint32_t count;
+	uint32_t *free;
+	uint64_t seed;
+};
+
+
+/*
+ * Create a new table.
+ *
+ * @ft: The table to initialize
+ * @size: The number of keys expected, the table grows when necessary
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int flowtab_init(struct flowtab *ft, uint32_t size);
+
+
+/*
+ * Release all memory used by the table.
+ *
+ * @ft: The table
+ */
+void flowtab_free(struct flowtab *ft);
+
+
+/*
+ * Insert a key into the table, or update the value if the key is already
+ * stored.
+ *
+ * @ft: The table
+ * @key: The key
+ * @val: The value to store
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int flowtab_insert(struct flowtab *ft, struct flow_key *key, void *val);
+
+
+/*
+ * Remove a key from the table.
+ *
+ * @ft: The table
+ * @key: The key
+ *
+ * Returns: 0 on success and -1 if the key wasn't found
+ */
+int flowtab_delete(struct flowtab *ft, struct flow_key *key);
+
+
+/*
+ * Look up a single key.
+ *
+ * @ft: The table
+ * @key: The key
+ * @val: An address to write the value to
+ *
+ * Returns: 1 if the key was found and 0 if not
+ */
+int flowtab_lookup(struct flowtab *ft, struct flow_key *key, void **val);
+
+
+/*
+ * Look up several keys at once. The buckets of all keys are prefetched
+ * before the first one is probed, so the memory-latency of the lookups
+ * overlaps instead of adding up.
+ *
+ * @ft: The table
+ * @keys: The keys
+ * @n: The number of keys (at most FLOWTAB_BATCH)
+ * @vals: An array to write the values to, NULL for missing keys
+ *
+ * Returns: A bitmask with bit i set, if key i was found
+ */
+uint32_t flowtab_lookup_batch(struct flowtab *ft, struct flow_key *keys,
+		int n, void **vals);
+
+#endif /* _FLOWTAB_H */
@@ -0,0 +1,140 @@
+#include "hist.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* The width of the longest bar in characters */
+#define HIST_BAR 40
+
+
+/*
+ * Get the bucket of a value. Values below HIST_SUB get a bucket each,
+ * above that the highest bit selects the group and the HIST_SUB_BITS
+ * bits following it the bucket within the group.
+ */
+static int hist_bucket(uint32_t val)
+{
+	int msb = 0;
+
+	if(val < HIST_SUB) {
+		return val;
+	}
+
+	while(val >> (msb + 1)) {
+		msb++;
+	}
+
+	return (msb - HIST_SUB_BITS + 1) * HIST_SUB +
+		((val >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+
+/*
+ * Get the largest value falling into a bucket.
+ */
+static uint32_t hist_upper(int bucket)
+{
+	int group = bucket / HIST_SUB;
+	int shift;
+
+	if(group == 0) {
+		return bucket;
+	}
+
+	shift = group - 1;
+	return (((uint64_t)(HIST_SUB + bucket % HIST_SUB) + 1) << shift) - 1;
+}
+
+
+void hist_init(struct hist *h)
+{
+	memset(h, 0, sizeof(struct hist));
+	h->min = UINT32_MAX;
+}
+
+
+void hist_add(struct hist *h, uint32_t val)
+{
+	h->buckets[hist_bucket(val)]++;
+	h->count++;
+	h->sum += val;
+
+	if(val < h->min) h->min = val;
+	if(val > h->max) h->max = val;
+}
+
+
+uint32_t hist_percentile(struct hist *h, double pct)
+{
+	unsigned long rank, seen = 0;
+	uint32_t upper;
+	int i;
+
+	if(h->count == 0) {
+		return 0;
+	}
+
+	/* The rank of the value, counting from 1 */
+	rank = (unsigned long)(pct / 100.0 * h->count + 0.5);
+	if(rank < 1) rank = 1;
+	if(rank > h->count) rank = h->count;
+
+	for(i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if(seen >= rank) {
+			upper = hist_upper(i);
+			return (upper > h->max) ? h->max : upper;
+		}
+	}
+
+	return h->max;
+}
+
+
+void hist_print(struct hist *h, const char *name)
+{
+	unsigned long rows[33], top = 0;
+	int i, j, lo, hi;
+
+	printf("Latency (%s): %lu samples\n", name, h->count);
+	if(h->count == 0) {
+		return;
+	}
+
+	printf("  min %u, avg %lu, max %u usec\n", h->min,
+			(unsigned long)(h->sum / h->count), h->max);
+	printf("  p50 %u, p90 %u, p99 %u, p99.9 %u usec\n",
+			hist_percentile(h, 50.0), hist_percentile(h, 90.0),
+			hist_percentile(h, 99.0), hist_percentile(h, 99.9));
+
+	/* Sum the buckets up per power of two, row 0 only holds 0 */
+	memset(rows, 0, sizeof(rows));
+	for(i = 0; i < HIST_BUCKETS; i++) {
+		j = 0;
+		while(j < 32 && hist_upper(i) >> j) {
+			j++;
+		}
+		rows[j] += h->buckets[i];
+	}
+
+	lo = 32;
+	hi = 0;
+	for(j = 0; j <= 32; j++) {
+		if(rows[j] == 0) {
+			continue;
+		}
+		if(j < lo) lo = j;
+		if(j > hi) hi = j;
+		if(rows[j] > top) top = rows[j];
+	}
+
+	for(j = lo; j <= hi; j++) {
+		printf("  %10lu .. %-10lu %8lu |",
+				(j == 0) ? 0UL : 1UL << (j - 1),
+				(j == 0) ? 0UL : (1UL << j) - 1, rows[j]);
+		for(i = 0; i < (int)(rows[j] * HIST_BAR / top); i++) {
+			putchar('#');
+		}
+		putchar('\n');
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef _HIST_H
+#define _HIST_H
+
+#include <stdint.h>
+
+/* Every power of two is split into 2^HIST_SUB_BITS buckets */
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+
+/* The number of buckets needed to cover all 32-bit values */
+#define HIST_BUCKETS  ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/*
+ * A histogram of latencies in microseconds. The buckets grow with the
+ * values, so every bucket has the same relative width of 1/16 and the
+ * percentiles are off by at most about 6%, no matter if the latencies are
+ * a few microseconds or several seconds.
+ *
+ * @buckets: The number of values in every bucket
+ * @count: The number of values
+ * @sum: The sum of all values
+ * @min, @max: The smallest and the largest value
+ */
+struct hist {
+	unsigned long buckets[HIST_BUCKETS];
+	unsigned long count;
+	uint64_t sum;
+	uint32_t min;
+	uint32_t max;
+};
+
+
+/*
+ * Initialize an empty histogram.
+ *
+ * @h: The histogram to initialize
+ */
+void hist_init(struct hist *h);
+
+
+/*
+ * Add a value to the histogram.
+ *
+ * @h: The histogram
+ * @val: The value in microseconds
+ */
+void hist_add(struct hist *h, uint32_t val);
+
+
+/*
+ * Get a percentile of the values in the histogram.
+ *
+ * @h: The histogram
+ * @pct: The percentile between 0 and 100
+ *
+ * Returns: The upper bound of the bucket holding the percentile, but at
+ *          most the largest value, or 0 if the histogram is empty
+ */
+uint32_t hist_percentile(struct hist *h, double pct);
+
+
+/*
+ * Print the percentiles of the histogram and a row with a bar for every
+ * power of two, so two runs can be compared side by side.
+ *
+ * @h: The histogram
+ * @name: The name printed in front of the histogram
+ */
+void hist_print(struct hist *h, const char *name);
+
+#endif /* _HIST_H */
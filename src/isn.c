@@ -0,0 +1,83 @@
+#include "isn.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* The secret key, 0 until it was chosen */
+static uint64_t isn_key[2];
+
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3) \
+	do { \
+		v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+		v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+	} while(0)
+
+
+/*
+ * Choose the secret key from the random-pool of the kernel, or from the
+ * time and the process-id if it can't be read.
+ */
+static void isn_init(void)
+{
+	FILE *fp;
+
+	if((fp = fopen("/dev/urandom", "r"))) {
+		if(fread(isn_key, sizeof(isn_key), 1, fp) != 1) {
+			isn_key[0] = isn_key[1] = 0;
+		}
+		fclose(fp);
+	}
+
+	if(isn_key[0] == 0 && isn_key[1] == 0) {
+		isn_key[0] = ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid();
+		isn_key[1] = (uint64_t)clock() * 0x9e3779b97f4a7c15UL;
+	}
+}
+
+
+uint64_t isn_hash(uint32_t saddr, uint32_t daddr, uint16_t sport,
+		uint16_t dport)
+{
+	uint64_t v0, v1, v2, v3, m[2];
+	int i;
+
+	if(isn_key[0] == 0 && isn_key[1] == 0) {
+		isn_init();
+	}
+
+	v0 = isn_key[0] ^ 0x736f6d6570736575UL;
+	v1 = isn_key[1] ^ 0x646f72616e646f6dUL;
+	v2 = isn_key[0] ^ 0x6c7967656e657261UL;
+	v3 = isn_key[1] ^ 0x7465646279746573UL;
+
+	/* The 12 bytes of the 4-tuple, the last word carries the length */
+	m[0] = ((uint64_t)daddr << 32) | saddr;
+	m[1] = ((uint64_t)12 << 56) | ((uint32_t)dport << 16) | sport;
+
+	for(i = 0; i < 2; i++) {
+		v3 ^= m[i];
+		SIPROUND(v0, v1, v2, v3);
+		SIPROUND(v0, v1, v2, v3);
+		v0 ^= m[i];
+	}
+
+	v2 ^= 0xff;
+	for(i = 0; i < 4; i++) {
+		SIPROUND(v0, v1, v2, v3);
+	}
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+uint32_t isn_generate(uint32_t saddr, uint32_t daddr, uint16_t sport,
+		uint16_t dport, uint64_t now)
+{
+	return (uint32_t)(now / 4) + (uint32_t)isn_hash(saddr, daddr, sport, dport);
+}
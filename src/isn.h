@@ -0,0 +1,36 @@
+#ifndef _ISN_H
+#define _ISN_H
+
+#include <stdint.h>
+
+/*
+ * Hash the 4-tuple of a connection with a secret key (SipHash-2-4). The
+ * key is chosen randomly on the first call, so the results can't be
+ * predicted from outside the process.
+ *
+ * @saddr, @daddr: The addresses in network-byte-order
+ * @sport, @dport: The ports in network-byte-order
+ *
+ * Returns: The hash
+ */
+uint64_t isn_hash(uint32_t saddr, uint32_t daddr, uint16_t sport,
+		uint16_t dport);
+
+
+/*
+ * Generate the initial sequence-number of a connection (RFC 6528). A
+ * clock ticking every 4 microseconds is added to the keyed hash of the
+ * 4-tuple. So the numbers can't be guessed by an attacker, but still grow
+ * for a reused 4-tuple, which lets the other end accept its SYN even when
+ * the old connection is still in TIME_WAIT.
+ *
+ * @saddr, @daddr: The addresses in network-byte-order
+ * @sport, @dport: The ports in network-byte-order
+ * @now: The current time in microseconds
+ *
+ * Returns: The sequence-number in host-byte-order
+ */
+uint32_t isn_generate(uint32_t saddr, uint32_t daddr, uint16_t sport,
+		uint16_t dport, uint64_t now);
+
+#endif /* _ISN_H */
@@ -0,0 +1,120 @@
+#include "listener.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Create a connection for a SYN to our address, and hand it the SYN.
+ */
+static void listener_accept(struct listener *l, struct rawio_burst *rb, int i,
+		uint64_t now)
+{
+	struct pkt_batch *b = &rb->b;
+	struct sockaddr_in dst;
+	struct conn *c;
+
+	/* Anything else of an unknown connection is ignored */
+	if(!(b->m_syn >> i & 1) || b->m_ack >> i & 1 ||
+			b->daddr[i] != l->io->src.sin_addr.s_addr ||
+			b->dport[i] != l->io->src.sin_port) {
+		return;
+	}
+
+	memset(&dst, 0, sizeof(dst));
+	dst.sin_family = AF_INET;
+	dst.sin_addr.s_addr = b->saddr[i];
+	dst.sin_port = b->sport[i];
+
+	if(!(c = malloc(sizeof(struct conn)))) {
+		perror("ERROR:");
+		return;
+	}
+
+	if(conn_init(c, l->io, &l->cf, &l->io->src, &dst) < 0) {
+		perror("ERROR:");
+		free(c);
+		return;
+	}
+
+	c->next = l->conns;
+	l->conns = c;
+	l->accepted++;
+
+	conn_listen(c);
+	conn_input(c, b, i, rb->pck[i], rb->len[i], now);
+}
+
+
+void listener_init(struct listener *l, struct rawio *io, struct conn_conf *cf)
+{
+	memset(l, 0, sizeof(struct listener));
+	l->io = io;
+	l->cf = *cf;
+	l->cf.tfo = 0;
+	l->cf.keepalive = 0;
+}
+
+
+void listener_free(struct listener *l)
+{
+	struct conn *c;
+
+	while((c = l->conns)) {
+		l->conns = c->next;
+		conn_free(c);
+		free(c);
+	}
+}
+
+
+int listener_poll(struct listener *l, uint64_t now)
+{
+	struct rawio_burst rb;
+	struct conn *c, **pos;
+	int timeout = -1;
+	int t, i;
+
+	while(rawio_recv_burst(l->io, &rb, 0) > 0) {
+		for(i = 0; i < rb.n; i++) {
+			if(!(rb.b.m_valid >> i & 1)) {
+				continue;
+			}
+
+			if(rb.ctx[i] != NULL) {
+				conn_input(rb.ctx[i], &rb.b, i, rb.pck[i], rb.len[i], now);
+			}
+			else {
+				listener_accept(l, &rb, i, now);
+			}
+		}
+		rawio_release_burst(l->io, &rb);
+	}
+
+	for(pos = &l->conns; (c = *pos) != NULL; ) {
+		conn_timer(c, now);
+
+		/* Answer a complete request with the request itself. Without */
+		/* room behind the last answer, it is tried again later. */
+		if(c->state == CONN_ESTABLISHED && c->rxdone &&
+				conn_send(c, c->rxbuf, c->rxlen) == 0) {
+			l->served++;
+		}
+
+		if(c->state == CONN_CLOSED) {
+			*pos = c->next;
+			conn_free(c);
+			free(c);
+			continue;
+		}
+
+		t = conn_timeout(c, now);
+		if(t >= 0 && (timeout < 0 || t < timeout)) {
+			timeout = t;
+		}
+		pos = &c->next;
+	}
+
+	return timeout;
+}
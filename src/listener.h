@@ -0,0 +1,62 @@
+#ifndef _LISTENER_H
+#define _LISTENER_H
+
+#include <stdint.h>
+
+#include "conn.h"
+#include "rawio.h"
+
+/*
+ * The passive side of the connections, answering every request with the
+ * request itself. A connection is created for every SYN to the local
+ * address of the handle, which has to be opened with RAWIO_F_LISTEN so
+ * the SYNs of unknown connections are passed on. Closed connections are
+ * freed again.
+ *
+ * @io: The handle of the I/O-engine
+ * @cf: The settings of the connections
+ * @conns: The connections
+ * @accepted: The number of connections created
+ * @served: The number of requests answered
+ */
+struct listener {
+	struct rawio *io;
+	struct conn_conf cf;
+	struct conn *conns;
+	unsigned long accepted;
+	unsigned long served;
+};
+
+
+/*
+ * Initialize a listener without connections. Keep-alive-probes and
+ * Fast-Open are not used on the passive side.
+ *
+ * @l: The listener to initialize
+ * @io: The listening handle of the I/O-engine
+ * @cf: The settings of the connections, copied
+ */
+void listener_init(struct listener *l, struct rawio *io, struct conn_conf *cf);
+
+
+/*
+ * Free all connections, without closing them.
+ *
+ * @l: The listener
+ */
+void listener_free(struct listener *l);
+
+
+/*
+ * Handle the datagrams which arrived by now and the timers which are due,
+ * and answer the complete requests. Nothing is waited for.
+ *
+ * @l: The listener
+ * @now: The current time in microseconds
+ *
+ * Returns: The time until the next timer in milliseconds or -1 if no
+ *          timer is running
+ */
+int listener_poll(struct listener *l, uint64_t now);
+
+#endif /* _LISTENER_H */
@@ -9,13 +9,45 @@
  * Drop the rule:
  * $ sudo iptables -F
  * 
- * usage: sudo ./rawsock <Src-IP> <Src-Port> <Dst-IP> <Dst-Port>
+ * usage: sudo ./rawsock [options] <Src-IP> <Src-Port> <Dst-IP> <Dst-Port>
  * example: sudo ./rawsock 192.168.2.109 4243 192.168.2.100 4242
  *
- * Replace Src-Port with the following code to generate random ports for testing: 
- * $(perl -e 'print int(rand(4444) + 1111)')
+ * Options:
+ *   -e <engine>  The I/O-engine to use: sock (default), uring, xdp or packet
+ *   -s           Let a kernel-thread poll the submission-queue (uring only)
+ *   -i <ifname>  The interface to attach the socket to (xdp and packet)
+ *   -q <queue>   The queue of the interface (xdp only, default 0)
+ *   -z           Force zero-copy-mode (xdp only)
+ *   -d <ms>      Delay ACKs up to <ms> milliseconds, 0 to ACK every segment
+ *                right away (default 40)
+ *   -n <segs>    ACK at the latest after <segs> full-sized segments
+ *                (default 2)
+ *   -p           ACK segments with the PSH-flag right away
+ *   -t           Use TCP-Fast-Open, to send the data with the SYN
+ *   -c <file>    Keep the Fast-Open-cookies in this file (implies -t)
+ *   -r <count>   Send <count> requests over the pooled connections
+ *                (default 1)
+ *   -P <size>    Keep up to <size> connections open at once (default 1)
+ *   -k <ms>      Probe connections idle for <ms> milliseconds (default 0,
+ *                never probe)
+ *   -w <ms>      Wait <ms> milliseconds between the requests
+ *   -l <lo>-<hi> Pick the local ports from this range
+ *                (default 32768-60999)
+ *   -L <cpu>     Low-latency-mode: Pin to <cpu>, busy-poll and spin instead
+ *                of blocking, -1 to not pin (with -T only the I/O-thread)
+ *   -T <threads> Run the connections in <threads> protocol-threads, apart
+ *                from the I/O-thread and the application
+ *   -V <link>    Talk to an echo-server in the process over a virtual link,
+ *                e.g. lat=500,bw=100000000,loss=1,reorder=1,seed=7 (latency
+ *                in us, bandwidth in bit/s, loss and reordering in percent)
+ *   -S           Publish live counters in /dev/shm/rawsock.<pid>, to be
+ *                read with ./bin/rawstat <pid>
+ *   -v           Print every datagram sent and received, with its payload
+ *
+ * Use 0 as Src-Port to let the tool pick a free port from the range.
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,19 +61,42 @@
 #include <sys/ioctl.h>
 #include <net/if.h>
 
+#include "ack.h"
 #include "basic_utils.h"
+#include "conn.h"
+#include "hist.h"
+#include "listener.h"
 #include "packet.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "port.h"
+#include "rawio.h"
+#include "stats.h"
+#include "tfo.h"
+#include "vlink.h"
 
-/* Recevive data and write to buffer */
-int receive_packet(int sockfd, char *buf, size_t len, struct sockaddr_in *dst);
+
+/*
+ * Let the echo-server at the other end of the virtual link do its work,
+ * while the client waits.
+ */
+static int serve_peer(void *arg, uint64_t now)
+{
+	return listener_poll(arg, now);
+}
 
 
 int main(int argc, char **argv) 
 {
-	int sockfd;
-	int sent;
-	int one  = 1;
-	short sSendPacket = 0;
+	int opt;
+	int timeout;
+	int i;
+
+	/*
+	 * The I/O-engine used to send and receive the datagrams.
+	 */
+	struct rawio io;
+	struct rawio_conf ioconf;
 
 	/*
 	 * The IP-addresses of both maschines in the connections.
@@ -49,53 +104,223 @@ int main(int argc, char **argv)
 	struct sockaddr_in srcaddr;
 	struct sockaddr_in dstaddr;
 
-	/* 
-	 * The buffer containing the raw datagram, both when it is received and
-	 * send.
+	/*
+	 * The payload contained in the packet.
 	 */
-	char *pckbuf = NULL;
-	int pckbuflen;
+	char *pld = NULL;
+	int pldlen;
 
 	/*
-	 * The buffer filled with the information to create the packet.
-	 * The buffer will be filled like that: Seq + Ack [ + Payload ]
-	 * So by default without the payload, it is 8 bytes long.
+	 * The connections, which stay open between the requests, and the
+	 * settings they share.
 	 */
-	char *databuf = NULL;
-	int databuflen = 0;
+	struct conn_pool pool;
+	struct conn_conf connconf;
+	struct conn *conn;
+	int poolsize = 1;
+	int portlo = PORT_LO;
+	int porthi = PORT_HI;
 
 	/*
-	 * Both numbers used to identify the send packets.
+	 * The requests waiting for their response and the time they were
+	 * sent. The next request is sent once the pause is over.
 	 */
-	uint32_t seqnum;
-	uint32_t acknum;
+	struct conn *inflight[POOL_MAX];
+	uint64_t started[POOL_MAX];
+	int ninflight = 0;
+	int requests = 1;
+	int sent = 0;
+	int done = 0;
+	int pause = 0;
+	uint64_t now;
+	uint64_t next = 0;
 
 	/*
-	 * The payload contained in the packet.
+	 * The time from handing a request to the pool until its response
+	 * was complete.
 	 */
-	char *pld = NULL;
-	int pldlen;
+	static struct hist latency;
 
 	/*
-	 * Buffers used when taking apart the received datagrams.
+	 * The threads the connections run in, if any, and the requests
+	 * passed to them.
 	 */
-	struct iphdr ip_hdr;
-	struct tcphdr tcp_hdr;
+	static struct pipeline pline;
+	struct pipe_req *reqs = NULL;
+	struct pipe_req **reqfree = NULL;
+	struct pipe_req *got[RING_BURST];
+	int threads = 0;
+	int nreqs = 0;
+	int nfree = 0;
+	int n;
 
+	/*
+	 * The pools of the connections, one per protocol-thread.
+	 */
+	struct conn_pool *pools[PIPE_MAX_THREADS];
+	int npools = 0;
+
+	/*
+	 * The virtual link and the echo-server at its other end, if the
+	 * tool doesn't talk to the network.
+	 */
+	static struct vlink link;
+	static struct listener server;
+	struct vlink_conf linkconf;
+	struct rawio peerio;
+	struct rawio_conf peerconf;
+	int virt = 0;
+	clock_t cpu = 0;
+
+	/*
+	 * The counters published for monitoring, if requested.
+	 */
+	static struct stats stats;
+	int publish = 0;
+	uint64_t published = 0;
+
+	/*
+	 * The Fast-Open-cookies of the servers.
+	 */
+	const char *tfofile = NULL;
+	static struct tfo_cache tfocache;
+
+	/*
+	 * The totals over all connections, shown when closing.
+	 */
+	unsigned long segs = 0, acks = 0, delayed = 0, piggybacked = 0;
+	unsigned long nconns = 0, nrequests = 0;
+	unsigned long allocated = 0, reused = 0, timewait = 0;
+	uint32_t space = 0;
+
+
+	/* Parse the options */
+	memset(&ioconf, 0, sizeof(ioconf));
+	ioconf.cpu = -1;
+	memset(&connconf, 0, sizeof(connconf));
+	connconf.ack.delay = ACK_DELAY;
+	connconf.ack.segs = ACK_SEGS;
+	connconf.ack.mss = ADVMSS;
+	connconf.ack.flags = 0;
+	connconf.tfocache = &tfocache;
+	connconf.kaintvl = CONN_KA_INTVL;
+	connconf.kaprobes = CONN_KA_PROBES;
+	while ((opt = getopt(argc, argv, "e:si:q:zd:n:ptc:r:P:k:w:l:L:T:V:Sv")) != -1) {
+		switch (opt) {
+			case 'e':
+				ioconf.engine = optarg;
+				break;
+
+			case 's':
+				ioconf.flags |= RAWIO_F_SQPOLL;
+				break;
+
+			case 'i':
+				ioconf.ifname = optarg;
+				break;
+
+			case 'q':
+				ioconf.queue = atoi(optarg);
+				break;
+
+			case 'z':
+				ioconf.flags |= RAWIO_F_ZEROCOPY;
+				break;
+
+			case 'd':
+				connconf.ack.delay = atoi(optarg);
+				break;
+
+			case 'n':
+				connconf.ack.segs = atoi(optarg);
+				break;
+
+			case 'p':
+				connconf.ack.flags |= ACK_F_PSH;
+				break;
+
+			case 't':
+				connconf.tfo = 1;
+				break;
+
+			case 'c':
+				connconf.tfo = 1;
+				tfofile = optarg;
+				break;
+
+			case 'r':
+				requests = atoi(optarg);
+				break;
+
+			case 'P':
+				poolsize = atoi(optarg);
+				break;
+
+			case 'k':
+				connconf.keepalive = atoi(optarg);
+				break;
+
+			case 'w':
+				pause = atoi(optarg);
+				break;
+
+			case 'l':
+				if (sscanf(optarg, "%d-%d", &portlo, &porthi) != 2 ||
+						portlo < 1 || porthi > 65535 || portlo > porthi)
+					goto err_usage;
+				break;
+
+			case 'L':
+				ioconf.flags |= RAWIO_F_LOWLAT;
+				ioconf.cpu = atoi(optarg);
+				break;
+
+			case 'T':
+				threads = atoi(optarg);
+				break;
+
+			case 'V':
+				if (vlink_parse(&linkconf, optarg) < 0)
+					goto err_usage;
+				virt = 1;
+				break;
+
+			case 'S':
+				publish = 1;
+				break;
+
+			case 'v':
+				dump_datagrams = 1;
+				break;
+
+			default:
+				goto err_usage;
+		}
+	}
 
 	/* Check if all necessary parameters have been set by the user */
-	if (argc < 5) {
-		printf("usage: %s <src-ip> <src-port> <dest-ip> <dest-port>\n", argv[0]);
-		exit (1);
+	if (argc - optind < 4 || poolsize < 1 || poolsize > POOL_MAX ||
+			threads < 0 || threads > PIPE_MAX_THREADS) {
+		goto err_usage;
 	}
 
-	/* Reserve memory for the datagram */
-	if(!(pckbuf = calloc(DATAGRAM_LEN, sizeof(char))))
-		goto err_free;
+	/* The cookies are shared by all connections, so only a single */
+	/* protocol-thread may use them */
+	if (threads > 1 && connconf.tfo) {
+		printf("Fast-Open needs a single protocol-thread.\n");
+		goto err_usage;
+	}
 
-	/* Initialize the data-buffer */
-	if(!(databuf = malloc(520)))
-		goto err_free;
+	/* The virtual clock only moves on while the only thread waits */
+	if (virt && (threads > 0 || ioconf.flags & RAWIO_F_LOWLAT)) {
+		printf("The virtual link works without threads and spinning.\n");
+		goto err_usage;
+	}
+	/* With threads, only the I/O-thread spins, so it pins itself and */
+	/* the other threads may run on any CPU */
+	if (threads > 0)
+		ioconf.flags |= RAWIO_F_NOPIN;
+	argv += optind - 1;
 
 	/* Set the payload intended to be send using the connection */
 	if(!(pld = malloc(512)))
@@ -113,16 +338,6 @@ int main(int argc, char **argv)
 
 	printf("SETUP:\n");
 
-	/* Create a raw socket for communication and store socket-handler */
-	printf("Create raw socket...");
-	sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
-	if (sockfd < 0) {
-		printf("failed.\n");
-		perror("ERROR:");
-		goto err_free;
-	}
-	printf("done.\n");
-
 	/* Configure the destination-IP-address */
 	printf("Configure destination-ip...");
 	dstaddr.sin_family = AF_INET;
@@ -145,116 +360,233 @@ int main(int argc, char **argv)
 	}
 	printf("done.\n");
 
-	/* Tell the kernel that headers are included in the packet */
-	printf("Configure socket...");
-	if (setsockopt(sockfd, IPPROTO_IP, IP_HDRINCL, &one, sizeof(one)) < 0) {
-		printf("failed.\n");
+	/* Load the cookies of earlier runs */
+	tfo_init(&tfocache);
+	if(tfofile != NULL && tfo_load(&tfocache, tfofile) < 0) {
 		perror("ERROR:");
 		goto err_free;
 	}
-	printf("done.\n");
 
-	printf("\n");
-	printf("COMMUNICATION:\n");
+	/* Create the shared memory for the counters, the connections get */
+	/* their records once they are opened */
+	if (publish) {
+		printf("Create statistics...");
+		if (stats_create(&stats) < 0) {
+			printf("failed.\n");
+			perror("ERROR:");
+			goto err_free;
+		}
+		connconf.stats = &stats;
+		printf("done (/dev/shm%s).\n", stats.name);
+	}
 
-	/* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-= */
-	/* THE TCP-HANDSHAKE                                             */
-
-	/* Step 1: Send the SYN-packet */
-	memset(pckbuf, 0, DATAGRAM_LEN);
-	create_raw_datagram(pckbuf, &pckbuflen, SYN_PACKET, &srcaddr, &dstaddr, NULL, 0);
-	dump_packet(pckbuf, pckbuflen);
-	if((sent = sendto(sockfd, pckbuf, pckbuflen, 0, (struct sockaddr*)&dstaddr, 
-					sizeof(struct sockaddr))) < 0) {
-		printf("failed.\n");
-		perror("ERROR:");
-		goto err_free;
+	/* Put an echo-server at the other end of the virtual link. From */
+	/* now on, time only passes on the clock of the link. */
+	if (virt) {
+		printf("Setup virtual link...");
+		vlink_init(&link, &linkconf);
+		use_virtual_clock(&link.now);
+
+		memset(&peerconf, 0, sizeof(peerconf));
+		peerconf.engine = "vlink";
+		peerconf.flags = RAWIO_F_LISTEN;
+		peerconf.cpu = -1;
+		peerconf.priv = &link.ends[1];
+		if (rawio_open(&peerio, &peerconf, &dstaddr, &srcaddr) < 0) {
+			printf("failed.\n");
+			goto err_free;
+		}
+		listener_init(&server, &peerio, &connconf);
+		vlink_serve(&link, serve_peer, &server);
+
+		ioconf.engine = "vlink";
+		ioconf.priv = &link.ends[0];
+		printf("done.\n");
 	}
 
-	/* Step 2: Wait for the SYN-ACK-packet */
-	pckbuflen = receive_packet(sockfd, pckbuf, DATAGRAM_LEN, &srcaddr);
-	dump_packet(pckbuf, pckbuflen);
-	if (pckbuflen <= 0) {
+	/* Open the I/O-engine, which also creates the raw socket */
+	printf("Open I/O-engine...");
+	if (rawio_open(&io, &ioconf, &srcaddr, &dstaddr) < 0) {
 		printf("failed.\n");
-		perror("ERROR:");
-		goto err_free;
+		goto err_peer;
 	}
+	printf("done (%s).\n", io.ops->name);
+
+	if (threads > 0) {
+		/* Every protocol-thread gets its own pool, and only the */
+		/* I/O-thread uses the handle of the I/O-engine */
+		printf("Start %d protocol-threads...", threads);
+		if (pipeline_start(&pline, &io, &connconf, &srcaddr, threads, poolsize,
+					portlo, porthi) < 0) {
+			printf("failed.\n");
+			perror("ERROR:");
+			goto err_close;
+		}
+		printf("done.\n");
 
-	/* Update seq-number and ack-number */
-	update_seq_and_ack(pckbuf, &seqnum, &acknum);
-
-	/* Step 3: Send the ACK-packet, with updated numbers */
-	memset(pckbuf, 0, DATAGRAM_LEN);
-	gather_packet_data(databuf, &databuflen, seqnum, acknum, NULL, 0);
-	create_raw_datagram(pckbuf, &pckbuflen, ACK_PACKET, &srcaddr, &dstaddr, databuf, databuflen);
-	dump_packet(pckbuf, pckbuflen);
-	if ((sent = sendto(sockfd, pckbuf, pckbuflen, 0, (struct sockaddr*)&dstaddr, 
-					sizeof(struct sockaddr))) < 0) {
-		printf("failed.\n");
-		perror("ERROR:");
-		goto err_free;
+		for (i = 0; i < threads; i++)
+			pools[npools++] = &pline.chans[i].pool;
+	}
+	else {
+		/* All connections share the handle of the I/O-engine */
+		if (pool_init(&pool, &io, &connconf, &srcaddr, poolsize, portlo, porthi) < 0) {
+			perror("ERROR:");
+			goto err_close;
+		}
+		pools[npools++] = &pool;
 	}
-	free(databuf);
+
+	hist_init(&latency);
+	cpu = clock();
+
+	printf("\n");
+	printf("COMMUNICATION:\n");
 
 	/* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-= */
-	/* SEND DATA USING TCP-SOCKET                                    */
-
-	/* Send data using the established connection */
-	gather_packet_data(databuf, &databuflen, seqnum, acknum, pld, pldlen);
-	create_raw_datagram(pckbuf, &pckbuflen, PSH_PACKET, &srcaddr, &dstaddr, databuf, databuflen);	
-	dump_packet(pckbuf, pckbuflen);
-	if ((sent = sendto(sockfd, pckbuf, pckbuflen, 0, (struct sockaddr*)&dstaddr, 
-					sizeof(struct sockaddr))) < 0) {
-		printf("send failed\n");
-		perror("ERROR:");
-		goto err_free;
+	/* SEND THE REQUESTS USING THE PIPELINE                          */
+
+	if (threads > 0) {
+		/* Only as many requests are on their way as the connections */
+		/* can carry, each with its own buffer for the response */
+		nreqs = (threads * poolsize < requests) ? threads * poolsize : requests;
+		if (!(reqs = calloc(nreqs, sizeof(struct pipe_req))) ||
+				!(reqfree = calloc(nreqs, sizeof(struct pipe_req *)))) {
+			perror("ERROR:");
+			goto err_pool;
+		}
+
+		for (i = 0; i < nreqs; i++) {
+			if (!(reqs[i].resp = malloc(CONN_RX_LEN))) {
+				perror("ERROR:");
+				goto err_pool;
+			}
+			reqfree[nfree++] = &reqs[i];
+		}
 	}
 
+	while (threads > 0 && done < requests) {
+		now = get_timestamp();
+
+		/* Submit the requests, the protocol-threads take turns */
+		while (sent < requests && nfree > 0 && now >= next) {
+			reqfree[nfree - 1]->dst = dstaddr;
+			reqfree[nfree - 1]->data = pld;
+			reqfree[nfree - 1]->len = pldlen;
+			reqfree[nfree - 1]->started = now;
+			if (pipeline_submit(&pline, reqfree[nfree - 1]) < 0)
+				break;
+			nfree--;
+			sent++;
+			next = now + (uint64_t)pause * 1000;
+		}
 
-	/* Wait for the response from the server */
-	while ((pckbuflen = receive_packet(sockfd, pckbuf, DATAGRAM_LEN, &srcaddr)) > 0) {
-		/* Display packet-info in the terminal */
-		dump_packet(pckbuf, pckbuflen);
+		/* Wait for the responses, but not past the next request */
+		timeout = POOL_TIMEOUT;
+		if (sent < requests && nfree > 0 && next > now &&
+				(next - now) / 1000 < (uint64_t)timeout) {
+			timeout = (next - now + 999) / 1000;
+		}
+		if ((n = pipeline_collect(&pline, got, RING_BURST, timeout)) < 0) {
+			perror("ERROR:");
+			goto err_pool;
+		}
 
-		/* Deconstruct the packet and extract payload */
-		strip_raw_packet(pckbuf, pckbuflen, &ip_hdr, &tcp_hdr, pld, &pldlen);
+		/* Printing the responses only holds up the application, the */
+		/* datagrams are received in the meantime */
+		for (i = 0; i < n; i++) {
+			if (got[i]->resplen > 0) {
+				printf("Request %d: %d bytes received on port %d.\n", done + 1,
+						got[i]->resplen, got[i]->port);
+				if (got[i]->finished >= got[i]->started)
+					hist_add(&latency, got[i]->finished - got[i]->started);
+			}
+			else {
+				printf("Request %d: no response on port %d.\n", done + 1,
+						got[i]->port);
+			}
 
-		/* Dump payload in the terminal, if there is any */
-		if(pldlen > 0) {
-			hexDump(pld, pldlen);
-			printf("Dumped %d bytes.\n", pldlen);
+			reqfree[nfree++] = got[i];
+			done++;
 		}
+	}
+
+	/* Let the protocol-threads close their connections */
+	if (threads > 0)
+		pipeline_stop(&pline);
 
-		/* Update ack-number and seq-numbers */
-		update_seq_and_ack(pckbuf, &seqnum, &acknum);
+	/* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-= */
+	/* SEND THE REQUESTS USING THE POOL                              */
+
+	while (threads == 0 && done < requests) {
+		now = get_timestamp();
+
+		/* Hand out the requests to idle connections. Only if all of */
+		/* them are busy, the pool opens another one. */
+		while (sent < requests && now >= next) {
+			if (!(conn = pool_request(&pool, &dstaddr, pld, pldlen))) {
+				if (errno == EAGAIN)
+					break;
+				printf("send failed\n");
+				perror("ERROR:");
+				goto err_pool;
+			}
+			inflight[ninflight] = conn;
+			started[ninflight++] = now;
+			sent++;
+			next = now + (uint64_t)pause * 1000;
+		}
 
-		sSendPacket = 0;
-		if(tcp_hdr.fin == 1) {
-			sSendPacket = FIN_PACKET;
+		/* Wait for the responses, but not past the next request */
+		timeout = POOL_TIMEOUT;
+		if (sent < requests && ninflight < poolsize && next > now &&
+				(next - now) / 1000 < (uint64_t)timeout) {
+			timeout = (next - now + 999) / 1000;
 		}
-		else if(tcp_hdr.psh == 1 || (tcp_hdr.ack == 1 && databuflen > 0)) {
-			sSendPacket = ACK_PACKET;
+		if (pool_poll(&pool, timeout) < 0) {
+			perror("ERROR:");
+			goto err_pool;
 		}
-		if(sSendPacket != 0) {
-			/* Create the response-packet */
-			gather_packet_data(databuf, &databuflen, seqnum, acknum, NULL, 0);
-			create_raw_datagram(pckbuf, &pckbuflen, sSendPacket, &srcaddr, &dstaddr, databuf, 8);
-			dump_packet(pckbuf, pckbuflen);
-			free(databuf);
-
-			if ((sent = sendto(sockfd, pckbuf, pckbuflen, 0, (struct sockaddr*)&dstaddr, 
-							sizeof(struct sockaddr))) < 0) {
-				printf("send failed\n");
-			} 
+
+		/* Give the connections with a response back to the pool */
+		now = get_timestamp();
+		if (publish && now - published >= (uint64_t)STATS_INTERVAL * 1000) {
+			stats_put_proc(&stats, &io.stats, 0, 0, 0, now);
+			published = now;
+		}
+		for (i = 0; i < ninflight; ) {
+			conn = inflight[i];
+			if (!conn->rxdone && now - started[i] < (uint64_t)POOL_TIMEOUT * 1000) {
+				i++;
+				continue;
+			}
+
+			if (conn->rxlen > 0) {
+				printf("Request %d: %d bytes received on port %d.\n", done + 1,
+						conn->rxlen, ntohs(conn->src.sin_port));
+				if (conn->rxdone && conn->rxstamp >= started[i])
+					hist_add(&latency, conn->rxstamp - started[i]);
+			}
 			else {
-				sSendPacket = 0;
-				if(tcp_hdr.fin == 1) {
-					break;
-				}
+				printf("Request %d: no response on port %d.\n", done + 1,
+						ntohs(conn->src.sin_port));
 			}
+
+			/* The rest of an unfinished response could still arrive */
+			/* and would be taken for the response of the next request */
+			if (!conn->rxdone)
+				conn_reset(conn);
+
+			pool_release(&pool, conn);
+			inflight[i] = inflight[--ninflight];
+			started[i] = started[ninflight];
+			done++;
 		}
 	}
 
+	/* Close all connections of the pool */
+	if (threads == 0)
+		pool_close(&pool);
+
 	printf("\n");
 
 	/* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-= */
@@ -262,52 +594,127 @@ int main(int argc, char **argv)
 
 	printf("CLEAN-UP:\n");
 
-	/* Close the socket */
+	/* Show how the checksums of the received datagrams were handled */
+	printf("Checksums: %lu verified, %lu trusted, %lu bad\n",
+			io.stats.csum_verified, io.stats.csum_trusted, io.stats.csum_bad);
+
+	for (i = 0; i < npools; i++) {
+		for (conn = pools[i]->conns; conn != NULL; conn = conn->next) {
+			nconns++;
+			nrequests += conn->requests;
+			segs += conn->ack.segs_recv;
+			acks += conn->ack.acks_sent;
+			delayed += conn->ack.acks_delayed;
+			piggybacked += conn->ack.acks_piggybacked;
+			if (conn->rwin.space > space) {
+				space = conn->rwin.space;
+			}
+		}
+
+		allocated += pools[i]->ports.allocated;
+		reused += pools[i]->ports.reused;
+		timewait += pools[i]->ports.timewait;
+	}
+
+	/* Show how many requests shared the connections */
+	printf("Pool: %lu requests over %lu connections\n", nrequests, nconns);
+
+	/* Show how the local ports were handed out */
+	printf("Ports: %lu allocated, %lu reused early, %lu in TIME_WAIT\n",
+			allocated, reused, timewait);
+
+	/* Show how many datagrams the protocol-threads couldn't keep up with */
+	if (threads > 0)
+		printf("Pipeline: %lu datagrams dropped\n", pline.drops);
+
+	/* Show how many ACKs were needed for the received segments */
+	printf("ACKs: %lu sent for %lu segments (%lu delayed, %lu piggybacked)\n",
+			acks, segs, delayed, piggybacked);
+
+	/* Show the largest receive-window a connection grew to */
+	printf("Window: %u bytes\n", space);
+
+	/* Show what happened on the virtual link, and how much faster */
+	/* than real time the run was */
+	if (virt) {
+		printf("Link: %lu datagrams sent, %lu lost, %lu reordered\n",
+				link.sent, link.lost, link.reordered);
+		printf("Server: %lu connections accepted, %lu requests answered\n",
+				server.accepted, server.served);
+		printf("Time: %.3f s virtual, %.3f s CPU\n",
+				(double)(link.now - VLINK_EPOCH) / 1000000,
+				(double)(clock() - cpu) / CLOCKS_PER_SEC);
+	}
+
+	/* Show how long the responses took, to compare both modes */
+	hist_print(&latency, (io.flags & RAWIO_F_LOWLAT) ? "low-latency" : "blocking");
+	if (threads > 0)
+		pipeline_free(&pline);
+	else
+		pool_free(&pool);
+
+	/* Keep the cookies for the next run */
+	if(tfofile != NULL && tfocache.dirty && tfo_save(&tfocache, tfofile) < 0) {
+		perror("ERROR:");
+	}
+
+	/* Close the I/O-engine and the socket */
 	printf("Close socket...");
-	close(sockfd);
+	rawio_close(&io);
 	printf("done.\n");
 
+	if (virt) {
+		listener_free(&server);
+		rawio_close(&peerio);
+		vlink_free(&link);
+	}
+	stats_close(&stats);
+
 	/* Free memory */
-	if(pckbuf) free(pckbuf);
-	if(databuf) free(databuf);
 	if(pld) free(pld);
+	for (i = 0; i < nreqs; i++)
+		free(reqs[i].resp);
+	free(reqs);
+	free(reqfree);
 
 	return 0;
 
-err_free:
-	/* Free buffers */
-	if(pckbuf) free(pckbuf);
-	if(databuf) free(databuf);
-	if(pld) free(pld);
+err_usage:
+	printf("usage: %s [-e <engine>] [-s] [-i <ifname>] [-q <queue>] [-z] "
+			"[-d <ms>] [-n <segs>] [-p] [-t] [-c <file>] [-r <count>] "
+			"[-P <size>] [-k <ms>] [-w <ms>] [-l <lo>-<hi>] "
+			"[-L <cpu>] [-T <threads>] [-V <link>] [-S] [-v] "
+			"<src-ip> <src-port> <dest-ip> <dest-port>\n", argv[0]);
+	exit (1);
+
+err_pool:
+	if (threads > 0) {
+		pipeline_stop(&pline);
+		pipeline_free(&pline);
+	}
+	else {
+		pool_free(&pool);
+	}
 
-	return -1;
-}
+err_close:
+	rawio_close(&io);
 
-/*
- * Recieve a short packet using a given socket and write the data to a buffer.
- *
- * @sockfd: The sockets to receive packets with
- * @buf: A buffer to write to
- * @len: The length of the buffer
- *
- * Returns: The amount of bytes received
- */
-int receive_packet(int sockfd, char *buf, size_t len, struct sockaddr_in *dst) 
-{
-	unsigned short dst_port;
-	int recvlen;
+err_peer:
+	if (virt) {
+		listener_free(&server);
+		rawio_close(&peerio);
+		vlink_free(&link);
+	}
 
-	/* Clear the memory used to store the datagram */
-	memset(buf, 0, len);
+err_free:
+	stats_close(&stats);
 
-	do {
-		recvlen = recvfrom(sockfd, buf, len, 0, NULL, NULL);
-		if (recvlen <= 0) {
-			break;
-		}
-		memcpy(&dst_port, buf + 22, sizeof(dst_port));
-	} while (dst_port != dst->sin_port);
+	/* Free buffers */
+	if(pld) free(pld);
+	for (i = 0; reqs != NULL && i < nreqs; i++)
+		free(reqs[i].resp);
+	free(reqs);
+	free(reqfree);
 
-	/* Return the amount of recieved bytes */
-	return recvlen;
+	return -1;
 }
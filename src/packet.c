@@ -11,57 +11,189 @@
 #include <unistd.h>
 #include <linux/if_ether.h>
 
-
-uint16_t in_cksum(char *buf, uint32_t sz)
+#include "basic_utils.h"
+#include "isn.h"
+#include "tfo.h"
+
+
+/*
+ * Add a buffer to a running ones-complement sum. The buffer has to start
+ * at an even offset of the checksummed data. The data is summed up in
+ * 32-bit words, with the carries collecting in the upper half of the sum,
+ * so the loop doesn't have to fold after every addition.
+ *
+ * @sum: The sum so far
+ * @buf: The buffer to add
+ * @sz: The size of the buffer in bytes
+ *
+ * Returns: The new (unfolded) sum
+ */
+static uint64_t cksum_add(uint64_t sum, char *buf, uint32_t sz)
 {
-	uint32_t sum = 0, i;
+	uint32_t w[8];
+	uint16_t h = 0;
+
+	/* Accumulate checksum, 32 bytes per iteration */
+	while(sz >= sizeof(w)) {
+		memcpy(w, buf, sizeof(w));
+		sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+		sum += (uint64_t)w[4] + w[5] + w[6] + w[7];
+		buf += sizeof(w);
+		sz -= sizeof(w);
+	}
 
-	/* Accumulate checksum */
-	for(i = 0; i < (sz - 1); i += 2) {
-		sum += *(unsigned short*)&buf[i];
+	while(sz >= 4) {
+		memcpy(w, buf, 4);
+		sum += w[0];
+		buf += 4;
+		sz -= 4;
 	}
 
-	/* Handle odd-sized case and add left-over byte */
+	if(sz >= 2) {
+		memcpy(&h, buf, 2);
+		sum += h;
+		buf += 2;
+		sz -= 2;
+	}
+
+	/* Handle odd-sized case and add left-over byte, padded with zero */
 	if(sz & 1) {
-		sum += (unsigned char)buf[i];
+		h = 0;
+		memcpy(&h, buf, 1);
+		sum += h;
 	}
 
+	return sum;
+}
+
+
+/*
+ * Fold a running sum to 16 bit, without inverting it.
+ *
+ * @sum: The sum to fold
+ *
+ * Returns: The folded sum
+ */
+static uint16_t cksum_fold_raw(uint64_t sum)
+{
 	/* Fold to get the ones-complement result */
 	while(sum >> 16) {
 		sum = (sum & 0xffff) + (sum >> 16);
 	}
 
+	return sum;
+}
+
+
+/*
+ * Fold a running sum to 16 bit and invert it.
+ *
+ * @sum: The sum to fold
+ *
+ * Returns: The checksum
+ */
+static uint16_t cksum_fold(uint64_t sum)
+{
 	/* Invert to get the negative in ones-complement arithmetic */
-	return ~sum;
+	return ~cksum_fold_raw(sum);
 }
 
 
-uint16_t in_cksum_tcp(struct tcphdr *tcp_hdr, struct sockaddr_in *src, 
-		struct sockaddr_in *dst, int len)
+/*
+ * Sum up the pseudo-header of a TCP-segment.
+ *
+ * @saddr: The source-IP-address in network-byte-order
+ * @daddr: The destination-IP-address in network-byte-order
+ * @seglen: The length of the segment including the TCP-header
+ *
+ * Returns: The (unfolded) sum
+ */
+static uint64_t cksum_pseudo(uint32_t saddr, uint32_t daddr, uint32_t seglen)
 {
-	/* The pseudoheader used to calculate the checksum */
 	struct pseudohdr psh;
-	char *psd;
-	int psd_sz;
 
-	/* Configure the TCP-Pseudo-Header for checksum calculation */
-	psh.source_addr = src->sin_addr.s_addr;
-	psh.dest_addr = dst->sin_addr.s_addr;
+	psh.source_addr = saddr;
+	psh.dest_addr = daddr;
 	psh.placeholder = 0;
 	psh.protocol = IPPROTO_TCP;
-	psh.tcp_length = htons(sizeof(struct tcphdr) + OPT_SIZE + len);
+	psh.tcp_length = htons(seglen);
+
+	return cksum_add(0, (char *)&psh, sizeof(struct pseudohdr));
+}
+
+
+uint16_t in_cksum(char *buf, uint32_t sz)
+{
+	return cksum_fold(cksum_add(0, buf, sz));
+}
+
+
+uint16_t in_cksum_tcp(struct tcphdr *tcp_hdr, struct sockaddr_in *src, 
+		struct sockaddr_in *dst, int len)
+{
+	uint32_t seglen = sizeof(struct tcphdr) + OPT_SIZE + len;
+	uint64_t sum;
 
-	/* Paste everything into the pseudogram */
-	psd_sz = sizeof(struct pseudohdr) + sizeof(struct tcphdr) + OPT_SIZE + len;
-	psd = malloc(psd_sz);
-	/* Copy the pseudo-header into the pseudogram */
-	memcpy(psd, (char *)&psh, sizeof(struct pseudohdr));
-	/* Attach the TCP-header and -content after the pseudo-header */
-	memcpy(psd + sizeof(struct pseudohdr), tcp_hdr, 
-			sizeof(struct tcphdr) + OPT_SIZE + len);
+	/* Sum up the pseudo-header and then the TCP-header and -content, */
+	/* so the segment doesn't have to be copied behind the pseudo-header */
+	sum = cksum_pseudo(src->sin_addr.s_addr, dst->sin_addr.s_addr, seglen);
+	sum = cksum_add(sum, (char *)tcp_hdr, seglen);
 
 	/* Return the checksum of the TCP-header */
-	return in_cksum((char*)psd, psd_sz);
+	return cksum_fold(sum);
+}
+
+
+uint16_t in_cksum_pseudo(char *seg, uint32_t saddr, uint32_t daddr,
+		uint32_t seglen)
+{
+	return cksum_fold(cksum_add(cksum_pseudo(saddr, daddr, seglen), seg, seglen));
+}
+
+
+int verify_raw_packet(char *pck, int pcklen, int checked)
+{
+	struct iphdr *iph = (struct iphdr *)pck;
+	uint16_t tot_len, check;
+	int ip_hdr_len;
+	char *seg;
+
+	/* The headers have to fit into the datagram before reading them */
+	if(pcklen < (int)sizeof(struct iphdr)) {
+		return CSUM_BAD;
+	}
+
+	ip_hdr_len = iph->ihl * 4;
+	tot_len = ntohs(iph->tot_len);
+	if(ip_hdr_len < (int)sizeof(struct iphdr) || tot_len > pcklen ||
+			tot_len < ip_hdr_len + (int)sizeof(struct tcphdr)) {
+		return CSUM_BAD;
+	}
+
+	if(!(checked & CSUM_F_IP) && in_cksum(pck, ip_hdr_len) != 0) {
+		return CSUM_BAD;
+	}
+
+	if(checked & CSUM_F_TCP) {
+		return CSUM_VALID;
+	}
+
+	seg = pck + ip_hdr_len;
+	if(in_cksum_pseudo(seg, iph->saddr, iph->daddr, tot_len - ip_hdr_len) == 0) {
+		return CSUM_VALID;
+	}
+
+	/* Segments sent by the local kernel might not be finished yet, as */
+	/* the checksum would be completed by the NIC. These only carry the */
+	/* plain sum of the pseudo-header. Anybody on the wire could put that */
+	/* sum there as well, so it only counts for local datagrams. */
+	memcpy(&check, seg + 16, sizeof(check));
+	if(checked & CSUM_F_LOCAL && check == cksum_fold_raw(cksum_pseudo(
+					iph->saddr, iph->daddr, tot_len - ip_hdr_len))) {
+		return CSUM_PARTIAL;
+	}
+
+	return CSUM_BAD;
 }
 
 
@@ -117,7 +249,7 @@ void setup_tcp_hdr(struct tcphdr *tcp_hdr, int iSrcPort, int iDestPort)
 	/* Configure the TCP-header */
 	tcp_hdr->source = iSrcPort;
 	tcp_hdr->dest = iDestPort;
-	tcp_hdr->seq = htonl(rand() % 0xffffffff);
+	tcp_hdr->seq = htonl(0);
 	tcp_hdr->ack_seq = htonl(0);
 	tcp_hdr->doff = 10;
 	/* Set the TCP-Header-Flags */
@@ -136,11 +268,18 @@ void setup_tcp_hdr(struct tcphdr *tcp_hdr, int iSrcPort, int iDestPort)
 
 uint32_t strip_tcp_hdr(struct tcphdr *tcp_hdr, char *buf, int len)
 {
-	if(len){/* Prevent warning for not using len*/}
+	/* The header has to fit into the buffer, options included */
+	if(len < (int)sizeof(struct tcphdr)) {
+		return 0;
+	}
 
 	/* Convert the first part of the buffer into a TCP-header */
 	memcpy(tcp_hdr, buf, sizeof(struct tcphdr));
 
+	if(tcp_hdr->doff * 4 < (int)sizeof(struct tcphdr) || tcp_hdr->doff * 4 > len) {
+		return 0;
+	}
+
 	/* Return the length of the TCP-header */
 	return tcp_hdr->doff * 4;
 }
@@ -154,7 +293,9 @@ uint32_t setup_ip_hdr(struct iphdr *ip_hdr, struct sockaddr_in *src,
 	ip_hdr->ihl = 0x5;
 	ip_hdr->tos = 0;
 	ip_hdr->tot_len = sizeof(struct iphdr) + OPT_SIZE + sizeof(struct tcphdr) + len;
-	printf("Length of IP-Hdr: %d\n", ip_hdr->tot_len);
+	if(dump_datagrams) {
+		printf("Length of IP-Hdr: %d\n", ip_hdr->tot_len);
+	}
 	ip_hdr->id = htonl(rand() % 65535);
 	ip_hdr->frag_off = 0;
 	ip_hdr->ttl = 0xff;
@@ -171,11 +312,18 @@ uint32_t setup_ip_hdr(struct iphdr *ip_hdr, struct sockaddr_in *src,
 
 uint32_t strip_ip_hdr(struct iphdr *ip_hdr, char *buf, int len)
 {
-	if(len){/* Prevent warning for not using len */}
+	/* The header has to fit into the buffer, options included */
+	if(len < (int)sizeof(struct iphdr)) {
+		return 0;
+	}
 
 	/* Parse the buffer into the IP-header-struct */
 	memcpy(ip_hdr, buf, sizeof(struct iphdr));
 
+	if(ip_hdr->ihl * 4 < (int)sizeof(struct iphdr) || ip_hdr->ihl * 4 > len) {
+		return 0;
+	}
+
 	/* Return the length of the IP-header in bytes */
 	return ip_hdr->ihl * 4;
 }
@@ -183,18 +331,20 @@ uint32_t strip_ip_hdr(struct iphdr *ip_hdr, char *buf, int len)
 
 void create_raw_datagram(char *pck, int *pcklen, int type,
 		struct sockaddr_in *src, struct sockaddr_in *dst, 
-		char *databuf, int len)
+		char *databuf, int len, struct rcv_win *win)
 {
 	uint32_t seq, ack;
-	int poff, pldlen = 0;
+	uint32_t tot_len;
+	int pldlen = 0;
 	int16_t mss;
+	char *pld, *opt;
 
-	/* Reserve empty space for storing the datagram. (memory already filled with zeros) */
-	char *pld, *dgrm = calloc(DATAGRAM_LEN, sizeof(char));
+	/* The datagram is built in place, so the buffer can be the packet- */
+	/* memory of the I/O-engine. Clear the headers and options first. */
+	struct iphdr* iph = (struct iphdr *)(pck);
+	struct tcphdr* tcph = (struct tcphdr *)(pck + sizeof(struct iphdr));
 
-	/* Required structs for the IP- and TCP-header */
-	struct iphdr* iph = (struct iphdr *)(dgrm);
-	struct tcphdr* tcph = (struct tcphdr *)(dgrm + sizeof(struct iphdr));
+	memset(pck, 0, sizeof(struct iphdr) + sizeof(struct tcphdr) + OPT_SIZE);
 
 	/* If the passes data-buffer contains more than the seq- and ack-numbers */
 	if(len > 8) {
@@ -204,7 +354,7 @@ void create_raw_datagram(char *pck, int *pcklen, int type,
 	}
 
 	/* Configure the IP-header */
-	setup_ip_hdr(iph, src, dst, pldlen);
+	tot_len = setup_ip_hdr(iph, src, dst, pldlen);
 
 	/* Configure the TCP-header */
 	setup_tcp_hdr(tcph, src->sin_port, dst->sin_port);
@@ -231,7 +381,7 @@ void create_raw_datagram(char *pck, int *pcklen, int type,
 			tcph->ack = 1;
 
 			/* Set pld according to the preset message */
-			pld = dgrm + sizeof(struct iphdr) + sizeof(struct tcphdr) + OPT_SIZE;
+			pld = pck + sizeof(struct iphdr) + sizeof(struct tcphdr) + OPT_SIZE;
 			memcpy(pld, databuf + 8, len - 8);
 
 			/* Set seq- and ack-numbers */
@@ -242,23 +392,57 @@ void create_raw_datagram(char *pck, int *pcklen, int type,
 			break;
 
 		case(RST_PACKET):
+			/* Set the datagram-flags */
+			tcph->rst = 1;
+
+			/* Without the ACK-flag, only the seq-number counts */
+			memcpy(&seq, databuf, 4);
+			tcph->seq = htonl(seq);
 			break;
 
+		case(SYNACK_PACKET):
+			/* Answer a SYN, with the sequence-number picked by the caller */
+			tcph->ack = 1;
+			memcpy(&seq, databuf, 4);
+			memcpy(&ack, databuf + 4, 4);
+			tcph->seq = htonl(seq);
+			tcph->ack_seq = htonl(ack);
+			/* fall through */
+
 		case(SYN_PACKET):
 			/* Set datagram-flags */
 			tcph->syn = 1;
 
-			poff = sizeof(struct ethhdr);
-
-			/* TCP options are only set in the SYN packet */
-			/* Set the Maximum Segment Size(MMS) */
-			dgrm[poff + 40] = 0x02;
-			dgrm[poff + 41] = 0x04;
-			mss = htons(48);
-			memcpy(dgrm + poff + 42, &mss, sizeof(int16_t));
+			/* Pick the initial sequence-number, unless the SYN is sent */
+			/* again with the one picked before */
+			if(type == SYN_PACKET && databuf != NULL) {
+				memcpy(&seq, databuf, 4);
+				tcph->seq = htonl(seq);
+			}
+			else if(type == SYN_PACKET) {
+				tcph->seq = htonl(isn_generate(src->sin_addr.s_addr,
+							dst->sin_addr.s_addr, src->sin_port, dst->sin_port,
+							get_timestamp()));
+			}
+
+			/* TCP options are only set in the SYN packet, right */
+			/* behind the TCP-header. Set the Maximum Segment Size(MMS) */
+			opt = (char *)tcph + sizeof(struct tcphdr);
+			opt[0] = TCPOPT_MAXSEG;
+			opt[1] = TCPOLEN_MAXSEG;
+			mss = htons(ADVMSS);
+			memcpy(opt + 2, &mss, sizeof(int16_t));
 			/* Enable SACK */
-			dgrm[poff + 44] = 0x04;
-			dgrm[poff + 45] = 0x02;
+			opt[4] = TCPOPT_SACK_PERMITTED;
+			opt[5] = TCPOLEN_SACK_PERMITTED;
+			/* Offer to scale the window (RFC 7323), but only agree to */
+			/* it, if the other end offered it as well */
+			if(win != NULL && (type == SYN_PACKET || win->scaled)) {
+				opt[6] = TCPOPT_NOP;
+				opt[7] = TCPOPT_WINDOW;
+				opt[8] = TCPOLEN_WINDOW;
+				opt[9] = win->wscale;
+			}
 			break;
 
 		case(FIN_PACKET):
@@ -274,16 +458,20 @@ void create_raw_datagram(char *pck, int *pcklen, int type,
 			break;
 	}
 
-	/* Calculate the checksum for both the IP- and TCP-header */
-	tcph->check = in_cksum_tcp(tcph, src, dst, pldlen);
-	iph->check = in_cksum((char*)dgrm, iph->tot_len);
+	/* Advertise the current receive-window */
+	if(win != NULL) {
+		tcph->window = htons(win_field(win, ntohl(tcph->ack_seq), tcph->syn));
+	}
 
-	/* Convert the length of IP-header to big endian. */
-	/* iph->tot_len = htons(iph->tot_len); */
+	/* Calculate the checksum for both the IP- and TCP-header. Without a */
+	/* raw socket, nobody fixes up the IP-header for us, so the length */
+	/* has to be in network-byte-order. */
+	tcph->check = in_cksum_tcp(tcph, src, dst, pldlen);
+	iph->tot_len = htons(tot_len);
+	iph->check = in_cksum((char*)iph, iph->ihl * 4);
 
-	/* Return the created datagram */
-	memcpy(pck, dgrm, DATAGRAM_LEN);
-	*pcklen = iph->tot_len;
+	/* Return the length of the created datagram */
+	*pcklen = tot_len;
 }
 
 
@@ -295,13 +483,16 @@ void strip_raw_packet(char *pck, int pcklen,
 
 	/* Remove the IP-header, and write it to the header-struct */
 	ip_hdr_len = strip_ip_hdr(ip_hdr, (pck), (pcklen));
+	if(pld != NULL) {
+		*pldlen = 0;
+	}
 
-	if(tcp_hdr != NULL) {
+	if(tcp_hdr != NULL && ip_hdr_len > 0) {
 		/* Remove the TCP-header, and write it to the header-struct */
 		tcp_hdr_len = strip_tcp_hdr(tcp_hdr, (pck + ip_hdr_len), 
 				(pcklen - ip_hdr_len));
 
-		if(pld != NULL) {
+		if(pld != NULL && tcp_hdr_len > 0) {
 			/* Get the length of the pld contained in the datagram */
 			*pldlen = (pcklen - ip_hdr_len - tcp_hdr_len);
 
@@ -310,3 +501,51 @@ void strip_raw_packet(char *pck, int pcklen,
 		}
 	}	
 }
+
+
+void add_fastopen(char *pck, int *pcklen, const uint8_t *cookie,
+		int cookielen, char *data, int datalen)
+{
+	struct iphdr *iph = (struct iphdr *)pck;
+	struct tcphdr *tcph = (struct tcphdr *)(pck + sizeof(struct iphdr));
+	char *opt = (char *)tcph + sizeof(struct tcphdr);
+	int optlen, tot_len;
+
+	/* The option follows MSS, SACK-permitted and the window-scale. Pad */
+	/* the room of a missing window-scale, as the zeros would end the */
+	/* options. */
+	if(opt[6] == TCPOPT_EOL) {
+		memset(opt + 6, TCPOPT_NOP, 4);
+	}
+
+	opt[10] = TCPOPT_FASTOPEN;
+	opt[11] = 2 + cookielen;
+	if(cookielen > 0) {
+		memcpy(opt + 12, cookie, cookielen);
+	}
+
+	/* The options have to fill whole 32-bit words */
+	optlen = (12 + cookielen + 3) & ~3;
+	memset(opt + 12 + cookielen, TCPOPT_EOL, optlen - 12 - cookielen);
+	tcph->doff = (sizeof(struct tcphdr) + optlen) / 4;
+
+	/* Put the data right behind the options */
+	tot_len = sizeof(struct iphdr) + sizeof(struct tcphdr) + optlen;
+	if(datalen > DATAGRAM_LEN - tot_len) {
+		datalen = DATAGRAM_LEN - tot_len;
+	}
+	if(datalen > 0) {
+		memcpy(pck + tot_len, data, datalen);
+		tot_len += datalen;
+	}
+
+	/* Update the lengths and both checksums */
+	iph->tot_len = htons(tot_len);
+	iph->check = 0;
+	iph->check = in_cksum((char *)iph, iph->ihl * 4);
+	tcph->check = 0;
+	tcph->check = in_cksum_pseudo((char *)tcph, iph->saddr, iph->daddr,
+			tot_len - iph->ihl * 4);
+
+	*pcklen = tot_len;
+}
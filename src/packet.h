@@ -4,12 +4,27 @@
 #define DATAGRAM_LEN 4096
 #define OPT_SIZE 20
 
+/* The maximum segment size advertised in the SYN */
+#define ADVMSS 1460
+
 #define URG_PACKET 0
 #define ACK_PACKET 1
 #define PSH_PACKET 2
 #define RST_PACKET 3
 #define SYN_PACKET 4
 #define FIN_PACKET 5
+#define SYNACK_PACKET 6
+
+/* The checksums of a received datagram already checked by someone else, */
+/* and whether it is known to never have left the machine */
+#define CSUM_F_IP    0x01
+#define CSUM_F_TCP   0x02
+#define CSUM_F_LOCAL 0x04
+
+/* The result of verify_raw_packet() */
+#define CSUM_BAD     -1
+#define CSUM_VALID    0
+#define CSUM_PARTIAL  1
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,7 +32,6 @@
 #include <arpa/inet.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
-#include <linux/tcp.h>
 #include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
@@ -25,6 +39,8 @@
 #include <sys/ioctl.h>
 #include <net/if.h>
 
+#include "window.h"
+
 /*
  * Pseudo header needed for TCP-header-checksum-calculation.
  * See: http://www.tcpipguide.com/free/t_TCPChecksumCalculationandtheTCPPseudoHeader-2.htm
@@ -67,6 +83,40 @@ uint16_t in_cksum_tcp(struct tcphdr *tcp_hdr, struct sockaddr_in *src,
 		struct sockaddr_in *dst, int len);
 
 
+/*
+ * Calculate the checksum of a TCP-segment of any length, including the
+ * pseudo-header. Unlike in_cksum_tcp() this doesn't assume the options
+ * of our own datagrams, so it can be used on received segments. For a
+ * segment with a correct checksum the result is 0.
+ *
+ * @seg: A pointer to the TCP-header followed by the data
+ * @saddr: The source-IP-address in network-byte-order
+ * @daddr: The destination-IP-address in network-byte-order
+ * @seglen: The length of the segment including the TCP-header
+ *
+ * Returns: The calculated checksum
+ */
+uint16_t in_cksum_pseudo(char *seg, uint32_t saddr, uint32_t daddr,
+		uint32_t seglen);
+
+
+/*
+ * Verify the checksums of a received datagram, before any of its fields
+ * are trusted. Checksums already checked by the NIC or the kernel are
+ * skipped, so the software only pays for what nobody else did.
+ *
+ * @pck: The datagram starting with the IP-header
+ * @pcklen: The length of the datagram in bytes
+ * @checked: The checksums already known to be correct (CSUM_F_*), and
+ *           CSUM_F_LOCAL if the datagram was sent by the local kernel
+ *
+ * Returns: CSUM_VALID if the datagram is correct, CSUM_PARTIAL if it is
+ *          local and still lacks its TCP-checksum, or CSUM_BAD if a
+ *          checksum is wrong or the datagram is truncated
+ */
+int verify_raw_packet(char *pck, int pcklen, int checked);
+
+
 /*
  * Extract both the sequence-number and the acknowledgement-number from 
  * the received datagram. The function also converts the numbers to
@@ -111,7 +161,8 @@ void gather_packet_data(char *databuf, int *datalen, int seqnum,
  * fills up the header with the default settings. To actually configure the
  * header right, you have to set flags afterwards, depending on the purpose of
  * the datagram. For example: To create a SYN-packet, you would have to activate 
- * the syn-flag.
+ * the syn-flag. The sequence-number is left at 0, a SYN gets its initial
+ * sequence-number from isn_generate().
  *
  * @tcp_hdr: A pointer to the TCP-header-structure
  * @srcport: The source-port
@@ -132,7 +183,8 @@ void setup_tcp_hdr(struct tcphdr *tcp_hdr, int iSrcPort, int iDestPort);
  * @buf: The buffer to extract the header from
  * @len: The length of the datagram-buffer
  *
- * Returns: The length of the TCP-header in bytes
+ * Returns: The length of the TCP-header in bytes, or 0 if the header
+ *          doesn't fit into the buffer
  */
 uint32_t strip_tcp_hdr(struct tcphdr *tcp_hdr, char *buf, int len);
 
@@ -164,7 +216,8 @@ uint32_t setup_ip_hdr(struct iphdr *ip_hdr, struct sockaddr_in *src,
  * @buf: A buffer containing the receieved datagram
  * @len: The length of the buffer
  *
- * Returns: The length of the entire package in bytes
+ * Returns: The length of the IP-header in bytes, or 0 if the header
+ *          doesn't fit into the buffer
  */
 uint32_t strip_ip_hdr(struct iphdr *ip_hdr, char *buf, int len);
 
@@ -174,18 +227,39 @@ uint32_t strip_ip_hdr(struct iphdr *ip_hdr, char *buf, int len);
  * buffer has to containg at least the seq- and ack-numbers of the 
  * datagram. To pass the pld, just attach it to the end of the 
  * data-buffer and adjust the size-parameter to the new buffer-size.
+ * The datagram is built in place, so the memory can be a buffer handed
+ * out by the I/O-engine. A SYN picks a new initial sequence-number,
+ * unless a buffer with the one to use is passed.
  *
- * @pck: A pointer to memory to store packet
+ * @pck: A pointer to memory to store packet (at least DATAGRAM_LEN bytes)
  * @pcklen: Length of the datagram in bytes
  * @type: The type of packet
  * @src: The source-IP-address
  * @dst: The destination-IP-address
  * @databuf: A buffer containing data to create datagram
  * @len: The length of the buffer
+ * @win: The receive-window to advertise or NULL for the default window
  */
 void create_raw_datagram(char *pck, int *pcklen, int type,
 		struct sockaddr_in *src, struct sockaddr_in *dst, 
-		char* databuf, int len);
+		char* databuf, int len, struct rcv_win *win);
+
+/*
+ * Turn a SYN created by create_raw_datagram() into a TCP-Fast-Open-SYN
+ * (RFC 7413). The Fast-Open-option is added behind the other options and
+ * the data is placed behind it, so it reaches the server with the SYN.
+ * Without a cookie, the option only requests one and the server would
+ * ignore any data.
+ *
+ * @pck: The SYN
+ * @pcklen: The length of the SYN, updated to the new length
+ * @cookie: The cookie of the server or NULL to request one
+ * @cookielen: The length of the cookie in bytes
+ * @data: The data to send in the SYN
+ * @datalen: The length of the data in bytes
+ */
+void add_fastopen(char *pck, int *pcklen, const uint8_t *cookie,
+		int cookielen, char *data, int datalen);
 
 /*
  * 
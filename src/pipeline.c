@@ -0,0 +1,547 @@
+#include "pipeline.h"
+
+#include "basic_utils.h"
+#include "isn.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+
+
+/*
+ * Pass a message of a protocol-thread on to the I/O-engine.
+ */
+static void pipe_io_tx(struct pipeline *pl, struct pipe_msg *msg)
+{
+	struct rawio *io = pl->io;
+	char *pck;
+
+	switch(msg->type) {
+		case(PIPE_DATA):
+			/* The engine might need the datagram in its own memory */
+			if(!(pck = rawio_alloc(io))) {
+				break;
+			}
+			memcpy(pck, PIPE_DATA_OF(msg), msg->len);
+			if(rawio_send(io, pck, msg->len) < 0) {
+				perror("ERROR:");
+			}
+			break;
+
+		case(PIPE_ADD_FLOW):
+			/* Received datagrams of the flow go to the thread */
+			if(rawio_add_flow(io, &msg->src, &msg->dst, msg->chan) < 0) {
+				perror("ERROR:");
+			}
+			break;
+
+		case(PIPE_DEL_FLOW):
+			rawio_del_flow(io, &msg->src, &msg->dst);
+			break;
+	}
+}
+
+
+/*
+ * Hand a received datagram to the protocol-thread of its flow. Without
+ * an empty buffer, the datagram is dropped, as waiting for the thread
+ * would only hold up the datagrams of all other threads as well.
+ */
+static void pipe_io_rx(struct pipeline *pl, struct pipe_chan *ch, char *pck,
+		int len)
+{
+	struct pipe_msg *msg;
+
+	if(ch == NULL) {
+		return;
+	}
+
+	if(pl->nfree == 0) {
+		pl->nfree = ring_dequeue_burst(&pl->rxfree, pl->freeq, RING_BURST);
+		if(pl->nfree == 0) {
+			pl->drops++;
+			return;
+		}
+	}
+
+	msg = pl->freeq[--pl->nfree];
+	msg->type = PIPE_DATA;
+	msg->len = (len > RAWIO_RX_LEN) ? RAWIO_RX_LEN : len;
+	msg->chan = ch;
+
+	/* The I/O-engine already checked the checksums */
+	msg->csum = CSUM_F_IP | CSUM_F_TCP;
+	memcpy(PIPE_DATA_OF(msg), pck, msg->len);
+
+	if(ring_enqueue(&ch->rx, msg) < 0) {
+		pl->freeq[pl->nfree++] = msg;
+		pl->drops++;
+	}
+}
+
+
+/*
+ * Publish the counters of the process, along with how many datagrams
+ * wait in the rings between the threads.
+ */
+static void pipe_publish(struct pipeline *pl, uint64_t now)
+{
+	uint32_t rxqueue = 0;
+	int i;
+
+	for(i = 0; i < pl->nchans; i++) {
+		rxqueue += ring_count(&pl->chans[i].rx);
+	}
+
+	stats_put_proc(pl->stats, &pl->io->stats, pl->drops, ring_count(&pl->tx),
+			rxqueue, now);
+	pl->published = now;
+}
+
+
+/*
+ * The I/O-thread: Send the datagrams of the protocol-threads and hand
+ * them the received ones, both in batches. If there is nothing to do, it
+ * sleeps until either a datagram arrives or one is queued for sending.
+ * In low-latency-mode it spins instead.
+ */
+static void *pipe_io_thread(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct rawio *io = pl->io;
+	struct ring *rings[1];
+	void *vals[RING_BURST];
+	struct rawio_burst rb;
+	struct pipe_msg *msg;
+	int i, n;
+	uint64_t now;
+
+	/* Wake up now and then to publish the counters, even if idle */
+	int timeout = (pl->stats != NULL) ? STATS_INTERVAL : RAWIO_WAIT;
+
+	/* Only the I/O-thread spins, so it alone gets the CPU of the */
+	/* low-latency-mode */
+	if(rawio_pin(io) < 0) {
+		perror("ERROR:");
+	}
+
+	rings[0] = &pl->tx;
+	while(!__atomic_load_n(&pl->stop, __ATOMIC_ACQUIRE)) {
+		n = ring_dequeue_burst(&pl->tx, vals, RING_BURST);
+		for(i = 0; i < n; i++) {
+			msg = vals[i];
+			pipe_io_tx(pl, msg);
+			ring_enqueue(&msg->chan->txfree, msg);
+		}
+
+		if(n > 0 && rawio_flush(io) < 0) {
+			perror("ERROR:");
+		}
+
+		if(rawio_recv_burst(io, &rb, 0) < 0) {
+			perror("ERROR:");
+			rb.n = 0;
+		}
+		for(i = 0; i < rb.n; i++) {
+			if(rb.b.m_valid >> i & 1) {
+				pipe_io_rx(pl, rb.ctx[i], rb.pck[i], rb.len[i]);
+			}
+		}
+		rawio_release_burst(io, &rb);
+
+		now = get_timestamp();
+		if(pl->stats != NULL && now - pl->published >= (uint64_t)STATS_INTERVAL * 1000) {
+			pipe_publish(pl, now);
+		}
+
+		if(n == 0 && rb.n == 0 && !(io->flags & RAWIO_F_LOWLAT) &&
+				ring_wait(&pl->waiter, rings, 1, io->rxfd, timeout) < 0) {
+			perror("ERROR:");
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Give a request back to the application.
+ */
+static void pipe_finish(struct pipe_chan *ch, struct pipe_req *req)
+{
+	/* The application collects before it submits again, so there is */
+	/* always room, unless several application-threads race */
+	while(ring_enqueue(&ch->pl->done, req) < 0) {
+		sched_yield();
+	}
+}
+
+
+/*
+ * Take the new requests, and send the waiting ones on the connections.
+ */
+static void pipe_send_reqs(struct pipe_chan *ch)
+{
+	void *vals[RING_BURST];
+	struct pipe_req *req;
+	struct conn *conn;
+	int i, n;
+
+	n = ring_dequeue_burst(&ch->reqs, vals, RING_BURST);
+	for(i = 0; i < n; i++) {
+		req = vals[i];
+		req->next = NULL;
+		if(ch->backlog_tail) ch->backlog_tail->next = req;
+		else ch->backlog = req;
+		ch->backlog_tail = req;
+	}
+
+	while((req = ch->backlog) != NULL && ch->ninflight < POOL_MAX) {
+		conn = pool_request(&ch->pool, &req->dst, req->data, req->len);
+		if(conn == NULL && errno == EAGAIN) {
+			break;
+		}
+
+		if(!(ch->backlog = req->next)) {
+			ch->backlog_tail = NULL;
+		}
+
+		/* The request failed, so it gets no response */
+		if(conn == NULL) {
+			perror("ERROR:");
+			req->resplen = 0;
+			req->port = 0;
+			req->finished = get_timestamp();
+			pipe_finish(ch, req);
+			continue;
+		}
+
+		ch->inflight[ch->ninflight] = conn;
+		ch->reqmap[ch->ninflight] = req;
+		ch->started[ch->ninflight++] = get_timestamp();
+	}
+}
+
+
+/*
+ * Hand the requests with a response, or which timed out, back to the
+ * application, and give their connections back to the pool.
+ */
+static void pipe_recv_resps(struct pipe_chan *ch)
+{
+	struct pipe_req *req;
+	struct conn *conn;
+	uint64_t now = get_timestamp();
+	int i;
+
+	for(i = 0; i < ch->ninflight; ) {
+		conn = ch->inflight[i];
+		if(!conn->rxdone && now - ch->started[i] < (uint64_t)POOL_TIMEOUT * 1000) {
+			i++;
+			continue;
+		}
+
+		req = ch->reqmap[i];
+		req->port = ntohs(conn->src.sin_port);
+		req->resplen = conn->rxlen;
+		req->finished = conn->rxdone ? conn->rxstamp : now;
+		memcpy(req->resp, conn->rxbuf, conn->rxlen);
+
+		/* The rest of an unfinished response could still arrive and */
+		/* would be taken for the response of the next request */
+		if(!conn->rxdone) {
+			conn_reset(conn);
+		}
+		pool_release(&ch->pool, conn);
+
+		ch->ninflight--;
+		ch->inflight[i] = ch->inflight[ch->ninflight];
+		ch->reqmap[i] = ch->reqmap[ch->ninflight];
+		ch->started[i] = ch->started[ch->ninflight];
+
+		pipe_finish(ch, req);
+	}
+}
+
+
+/*
+ * A protocol-thread: Run the connections of its pool. It sleeps in the
+ * pipe-engine until a datagram arrives, a timer is due or the
+ * application submits a request.
+ */
+static void *pipe_proto_thread(void *arg)
+{
+	struct pipe_chan *ch = arg;
+	struct pipeline *pl = ch->pl;
+
+	while(1) {
+		pipe_send_reqs(ch);
+
+		if(__atomic_load_n(&ch->stop, __ATOMIC_ACQUIRE) &&
+				ch->backlog == NULL && ch->ninflight == 0) {
+			break;
+		}
+
+		if(pool_poll(&ch->pool, POOL_TIMEOUT) < 0) {
+			__atomic_store_n(&pl->error, errno, __ATOMIC_RELEASE);
+			ring_wake(&pl->appwaiter);
+			return NULL;
+		}
+
+		pipe_recv_resps(ch);
+	}
+
+	pool_close(&ch->pool);
+	return NULL;
+}
+
+
+/*
+ * Map the buffers of messages, placed like the memory of the I/O-engine.
+ */
+static char *pipe_mem_alloc(struct pipeline *pl, size_t len)
+{
+	void *mem;
+
+	mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(mem == MAP_FAILED) {
+		return NULL;
+	}
+
+	rawio_mem_bind(pl->io, mem, len);
+	return mem;
+}
+
+
+/*
+ * Setup a protocol-thread with its rings, its handle of the pipe-engine
+ * and its pool.
+ */
+static int pipe_chan_init(struct pipeline *pl, struct pipe_chan *ch,
+		struct conn_conf *cf, struct sockaddr_in *src, int size,
+		uint16_t lo, uint16_t hi, int idx)
+{
+	struct rawio_conf conf;
+	struct pipe_msg *msg;
+	int i;
+
+	ch->pl = pl;
+	if(ring_waiter_init(&ch->waiter) < 0 ||
+			ring_init(&ch->rx, PIPE_RX_MSGS, 0, &ch->waiter) < 0 ||
+			ring_init(&ch->txfree, PIPE_TX_MSGS, 0, NULL) < 0 ||
+			ring_init(&ch->reqs, PIPE_REQS, 1, &ch->waiter) < 0) {
+		return -1;
+	}
+
+	for(i = 0; i < PIPE_TX_MSGS; i++) {
+		msg = (struct pipe_msg *)(pl->txmem +
+				((size_t)idx * PIPE_TX_MSGS + i) * PIPE_TX_STRIDE);
+		msg->chan = ch;
+		ring_enqueue(&ch->txfree, msg);
+	}
+
+	memset(&conf, 0, sizeof(conf));
+	conf.engine = rawio_pipe_ops.name;
+	conf.cpu = -1;
+	conf.priv = ch;
+	if(rawio_open(&ch->io, &conf, src, &pl->io->dst) < 0) {
+		return -1;
+	}
+
+	ch->cf = *cf;
+	return pool_init(&ch->pool, &ch->io, &ch->cf, src, size, lo, hi);
+}
+
+
+/*
+ * Free a protocol-thread, which might only be partly set up.
+ */
+static void pipe_chan_free(struct pipe_chan *ch)
+{
+	if(ch->pool.io != NULL) {
+		pool_free(&ch->pool);
+	}
+	if(ch->io.ops != NULL) {
+		rawio_close(&ch->io);
+	}
+
+	ring_free(&ch->reqs);
+	ring_free(&ch->txfree);
+	ring_free(&ch->rx);
+	ring_waiter_free(&ch->waiter);
+}
+
+
+int pipeline_start(struct pipeline *pl, struct rawio *io, struct conn_conf *cf,
+		struct sockaddr_in *src, int threads, int size, uint16_t lo,
+		uint16_t hi)
+{
+	struct sockaddr_in chsrc;
+	uint32_t share;
+	int i;
+
+	memset(pl, 0, sizeof(struct pipeline));
+	pl->io = io;
+	pl->stats = cf->stats;
+	pl->waiter.fd = -1;
+	pl->appwaiter.fd = -1;
+	for(i = 0; i < PIPE_MAX_THREADS; i++) {
+		pl->chans[i].waiter.fd = -1;
+	}
+
+	share = (hi - lo + 1) / (threads > 0 ? threads : 1);
+	if(threads < 1 || threads > PIPE_MAX_THREADS || share == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Choose the key of the sequence-numbers before the threads race */
+	/* to do so */
+	isn_hash(0, 0, 0, 0);
+
+	if(ring_waiter_init(&pl->waiter) < 0 ||
+			ring_waiter_init(&pl->appwaiter) < 0 ||
+			ring_init(&pl->tx, threads * PIPE_TX_MSGS, 1, &pl->waiter) < 0 ||
+			ring_init(&pl->rxfree, PIPE_RX_MSGS, 1, NULL) < 0 ||
+			ring_init(&pl->done, 2 * PIPE_REQS, 1, &pl->appwaiter) < 0) {
+		goto err_free;
+	}
+
+	/* Only the pages actually used are ever touched */
+	pl->txmemsz = (size_t)threads * PIPE_TX_MSGS * PIPE_TX_STRIDE;
+	if(!(pl->rxmem = pipe_mem_alloc(pl, (size_t)PIPE_RX_MSGS * PIPE_RX_STRIDE)) ||
+			!(pl->txmem = pipe_mem_alloc(pl, pl->txmemsz))) {
+		goto err_free;
+	}
+
+	for(i = 0; i < PIPE_RX_MSGS; i++) {
+		ring_enqueue(&pl->rxfree, pl->rxmem + (size_t)i * PIPE_RX_STRIDE);
+	}
+
+	/* Only the first thread tries the port of the user */
+	chsrc = *src;
+	for(i = 0; i < threads; i++) {
+		pl->nchans++;
+		if(pipe_chan_init(pl, &pl->chans[i], cf, &chsrc, size, lo + i * share,
+				(i == threads - 1) ? hi : lo + (i + 1) * share - 1, i) < 0) {
+			goto err_free;
+		}
+		chsrc.sin_port = 0;
+	}
+
+	if(pthread_create(&pl->thread, NULL, pipe_io_thread, pl) != 0) {
+		goto err_free;
+	}
+
+	for(i = 0; i < threads; i++) {
+		if(pthread_create(&pl->chans[i].thread, NULL, pipe_proto_thread,
+				&pl->chans[i]) != 0) {
+			pl->nchans = i;
+			pipeline_stop(pl);
+			pl->nchans = threads;
+			goto err_free;
+		}
+	}
+
+	return 0;
+
+err_free:
+	pipeline_free(pl);
+	return -1;
+}
+
+
+int pipeline_submit(struct pipeline *pl, struct pipe_req *req)
+{
+	struct pipe_chan *ch = &pl->chans[pl->next];
+
+	if(__atomic_load_n(&pl->outstanding, __ATOMIC_RELAXED) >= PIPE_REQS ||
+			ring_enqueue(&ch->reqs, req) < 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	__atomic_add_fetch(&pl->outstanding, 1, __ATOMIC_RELAXED);
+	pl->next = (pl->next + 1) % pl->nchans;
+	return 0;
+}
+
+
+int pipeline_collect(struct pipeline *pl, struct pipe_req **reqs, int n,
+		int timeout)
+{
+	struct ring *rings[1];
+	void *vals[RING_BURST];
+	int got, i;
+
+	if(n > RING_BURST) {
+		n = RING_BURST;
+	}
+
+	rings[0] = &pl->done;
+	if((got = ring_dequeue_burst(&pl->done, vals, n)) == 0) {
+		if(__atomic_load_n(&pl->error, __ATOMIC_ACQUIRE)) {
+			errno = pl->error;
+			return -1;
+		}
+
+		if(ring_wait(&pl->appwaiter, rings, 1, -1, timeout) < 0) {
+			return -1;
+		}
+		got = ring_dequeue_burst(&pl->done, vals, n);
+	}
+
+	for(i = 0; i < got; i++) {
+		reqs[i] = vals[i];
+	}
+
+	__atomic_sub_fetch(&pl->outstanding, got, __ATOMIC_RELAXED);
+	return got;
+}
+
+
+void pipeline_stop(struct pipeline *pl)
+{
+	struct pipe_chan *ch;
+	int i;
+
+	/* The protocol-threads still need the I/O-thread to close */
+	for(i = 0; i < pl->nchans; i++) {
+		ch = &pl->chans[i];
+		__atomic_store_n(&ch->stop, 1, __ATOMIC_RELEASE);
+		ring_wake(&ch->waiter);
+		pthread_join(ch->thread, NULL);
+	}
+
+	__atomic_store_n(&pl->stop, 1, __ATOMIC_RELEASE);
+	ring_wake(&pl->waiter);
+	pthread_join(pl->thread, NULL);
+}
+
+
+void pipeline_free(struct pipeline *pl)
+{
+	int i;
+
+	for(i = 0; i < pl->nchans; i++) {
+		pipe_chan_free(&pl->chans[i]);
+	}
+	pl->nchans = 0;
+
+	if(pl->rxmem) munmap(pl->rxmem, (size_t)PIPE_RX_MSGS * PIPE_RX_STRIDE);
+	if(pl->txmem) munmap(pl->txmem, pl->txmemsz);
+	pl->rxmem = NULL;
+	pl->txmem = NULL;
+
+	ring_free(&pl->done);
+	ring_free(&pl->rxfree);
+	ring_free(&pl->tx);
+	ring_waiter_free(&pl->appwaiter);
+	ring_waiter_free(&pl->waiter);
+}
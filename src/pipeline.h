@@ -0,0 +1,258 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "conn.h"
+#include "packet.h"
+#include "pool.h"
+#include "rawio.h"
+#include "ring.h"
+
+/* The maximum number of protocol-threads */
+#define PIPE_MAX_THREADS 8
+
+/* The number of buffers for received datagrams, shared by all threads */
+#define PIPE_RX_MSGS 256
+
+/* The number of buffers for datagrams to send, per protocol-thread */
+#define PIPE_TX_MSGS 64
+
+/* The number of requests waiting for a protocol-thread */
+#define PIPE_REQS 1024
+
+/* The kinds of messages passed to the I/O-thread */
+#define PIPE_DATA     0
+#define PIPE_ADD_FLOW 1
+#define PIPE_DEL_FLOW 2
+
+struct pipeline;
+
+/*
+ * A datagram, or a change of the flows, passed between the I/O-thread and
+ * a protocol-thread. The data follows the header.
+ *
+ * @type: The kind of the message (PIPE_*)
+ * @len: The length of the datagram
+ * @csum: The checksums already checked (CSUM_F_*)
+ * @chan: The protocol-thread the message belongs to
+ * @src, @dst: The addresses of the flow to add or delete
+ */
+struct pipe_msg {
+	int type;
+	int len;
+	int csum;
+	struct pipe_chan *chan;
+	struct sockaddr_in src;
+	struct sockaddr_in dst;
+};
+
+/* The data of a message starts on the cache-line after its header */
+#define PIPE_HDR_LEN \
+	((sizeof(struct pipe_msg) + RING_CACHELINE - 1) & ~(RING_CACHELINE - 1))
+#define PIPE_DATA_OF(msg) ((char *)(msg) + PIPE_HDR_LEN)
+#define PIPE_MSG_OF(pck)  ((struct pipe_msg *)((char *)(pck) - PIPE_HDR_LEN))
+
+/* The distance between the messages in the buffers */
+#define PIPE_RX_STRIDE (PIPE_HDR_LEN + RAWIO_RX_LEN)
+#define PIPE_TX_STRIDE (PIPE_HDR_LEN + DATAGRAM_LEN)
+
+/*
+ * A request passed from the application to a protocol-thread and back.
+ * The buffers belong to the application.
+ *
+ * @dst: The destination
+ * @data, @len: The request
+ * @resp: A buffer of CONN_RX_LEN bytes for the response
+ * @resplen: The length of the response, 0 if none arrived in time
+ * @port: The local port of the connection used
+ * @started: The time the request was submitted in microseconds
+ * @finished: The time the response was complete in microseconds
+ * @next: The next request waiting for a connection
+ */
+struct pipe_req {
+	struct sockaddr_in dst;
+	char *data;
+	int len;
+	char *resp;
+	int resplen;
+	int port;
+	uint64_t started;
+	uint64_t finished;
+	struct pipe_req *next;
+};
+
+/*
+ * A protocol-thread running the TCP-state-machines of its own pool of
+ * connections. The pool uses a handle of the pipe-engine, which passes
+ * the datagrams through rings to and from the I/O-thread.
+ *
+ * @pl: The pipeline
+ * @waiter: Wakes the thread on received datagrams and new requests
+ * @rx: Received datagrams from the I/O-thread (SPSC)
+ * @txfree: Empty buffers for sending, given back by the I/O-thread (SPSC)
+ * @reqs: New requests from the application (MPSC)
+ * @rxq, @rxn, @rxi: Datagrams taken out of the ring at once
+ * @txq, @txn: Empty buffers taken out of the ring at once
+ * @txcur: The buffer handed out for the next datagram, not sent yet
+ * @io: The handle of the pipe-engine
+ * @cf: The settings of the connections
+ * @pool: The connections
+ * @backlog, @backlog_tail: The requests waiting for a connection
+ * @inflight, @reqmap, @started: The requests sent, and when
+ * @ninflight: The number of requests sent
+ * @stop: The application is done, so close the pool once idle
+ * @thread: The thread
+ */
+struct pipe_chan {
+	struct pipeline *pl;
+	struct ring_waiter waiter;
+	struct ring rx;
+	struct ring txfree;
+	struct ring reqs;
+
+	void *rxq[RING_BURST];
+	int rxn;
+	int rxi;
+	void *txq[RING_BURST];
+	int txn;
+	struct pipe_msg *txcur;
+
+	struct rawio io;
+	struct conn_conf cf;
+	struct conn_pool pool;
+
+	struct pipe_req *backlog;
+	struct pipe_req *backlog_tail;
+	struct conn *inflight[POOL_MAX];
+	struct pipe_req *reqmap[POOL_MAX];
+	uint64_t started[POOL_MAX];
+	int ninflight;
+
+	int stop;
+	pthread_t thread;
+};
+
+/*
+ * A pipelined threading-model. A single I/O-thread drives the I/O-engine,
+ * one or more protocol-threads run the connections, and the application
+ * submits requests and collects the responses. Every thread only ever
+ * takes entries out of rings which no other thread consumes, so none of
+ * them waits for a lock, and a slow application only delays the
+ * responses but never the receiving of datagrams. Datagrams which arrive
+ * while a protocol-thread is too far behind are dropped and counted.
+ *
+ * @io: The handle of the real I/O-engine, only used by the I/O-thread
+ * @waiter: Wakes the I/O-thread on datagrams to send
+ * @tx: Datagrams to send and flow-changes from the protocol-threads (MPSC)
+ * @rxfree: Empty buffers for received datagrams (MPSC)
+ * @done: Requests with their response for the application (MPSC)
+ * @appwaiter: Wakes the application on finished requests
+ * @chans: The protocol-threads
+ * @nchans: The number of protocol-threads
+ * @next: The protocol-thread getting the next request
+ * @freeq, @nfree: Empty buffers taken out of the ring at once
+ * @rxmem, @txmem: The buffers of the messages
+ * @txmemsz: The size of the buffers for sending
+ * @outstanding: The number of requests submitted but not collected
+ * @drops: The number of received datagrams dropped
+ * @error: The error a protocol-thread failed with, or 0
+ * @stats: The shared memory the I/O-thread publishes the counters of the
+ *         process in, or NULL
+ * @published: The time the counters were last published in microseconds
+ * @stop: Stop the I/O-thread
+ * @thread: The I/O-thread
+ */
+struct pipeline {
+	struct rawio *io;
+	struct ring_waiter waiter;
+	struct ring tx;
+	struct ring rxfree;
+	struct ring done;
+	struct ring_waiter appwaiter;
+
+	struct pipe_chan chans[PIPE_MAX_THREADS];
+	int nchans;
+	int next;
+
+	void *freeq[RING_BURST];
+	int nfree;
+	char *rxmem;
+	char *txmem;
+	size_t txmemsz;
+	int outstanding;
+	unsigned long drops;
+	int error;
+	struct stats *stats;
+	uint64_t published;
+
+	int stop;
+	pthread_t thread;
+};
+
+
+/*
+ * Start the I/O-thread and the protocol-threads. Every protocol-thread
+ * gets its own pool with an equal share of the local ports, only the
+ * first one tries the port of the source-address.
+ *
+ * @pl: The pipeline to start
+ * @io: The opened handle of the I/O-engine
+ * @cf: The settings of the connections, copied for every thread
+ * @src: The local address
+ * @threads: The number of protocol-threads
+ * @size: The size of the pools
+ * @lo, @hi: The range of the local ports
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int pipeline_start(struct pipeline *pl, struct rawio *io, struct conn_conf *cf,
+		struct sockaddr_in *src, int threads, int size, uint16_t lo,
+		uint16_t hi);
+
+
+/*
+ * Hand a request to the next protocol-thread.
+ *
+ * @pl: The pipeline
+ * @req: The request, owned by the pipeline until it is collected
+ *
+ * Returns: 0 on success and -1 with errno set to EAGAIN if the thread
+ *          has too many requests waiting
+ */
+int pipeline_submit(struct pipeline *pl, struct pipe_req *req);
+
+
+/*
+ * Collect the finished requests, waiting for them if none are finished.
+ *
+ * @pl: The pipeline
+ * @reqs: An array for the requests
+ * @n: The maximum number of requests to collect (at most RING_BURST)
+ * @timeout: The maximum time to wait in milliseconds, or -1
+ *
+ * Returns: The number of requests collected or -1 if an error occurred
+ */
+int pipeline_collect(struct pipeline *pl, struct pipe_req **reqs, int n,
+		int timeout);
+
+
+/*
+ * Let the protocol-threads close their pools and stop all threads. The
+ * pools can be inspected afterwards until the pipeline is freed.
+ *
+ * @pl: The pipeline
+ */
+void pipeline_stop(struct pipeline *pl);
+
+
+/*
+ * Free the pools, the rings and the buffers of a stopped pipeline.
+ *
+ * @pl: The pipeline
+ */
+void pipeline_free(struct pipeline *pl);
+
+#endif /* _PIPELINE_H */
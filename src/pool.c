@@ -0,0 +1,336 @@
+#include "pool.h"
+
+#include "basic_utils.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+
+/*
+ * Move a closed connection to a new local port. The old port goes back to
+ * the allocator, its 4-tuple might still be in TIME_WAIT at the other end.
+ * If no port is left, the connection keeps the old one.
+ */
+static int pool_rebind(struct conn_pool *p, struct conn *c)
+{
+	struct sockaddr_in src;
+	uint64_t now = get_timestamp();
+
+	src = c->src;
+	src.sin_port = 0;
+	if(port_get(&p->ports, &src, &c->dst, now) < 0) {
+		return -1;
+	}
+
+	port_put(&p->ports, &c->src, &c->dst, c->snd_nxt, c->timewait, now);
+	return conn_rebind(c, src.sin_port);
+}
+
+
+/*
+ * Check if a connection should be reconnected in the background.
+ */
+static int pool_broken(struct conn_pool *p, struct conn *c)
+{
+	return !p->closing && !c->busy && c->state == CONN_CLOSED && c->broken &&
+		c->reconnects < POOL_RECONNECTS;
+}
+
+
+/*
+ * Get the time a broken connection is reconnected in microseconds.
+ */
+static uint64_t pool_reconnect_due(struct conn *c)
+{
+	return c->stamp + ((uint64_t)POOL_RECONNECT << c->reconnects) * 1000;
+}
+
+
+/*
+ * Look up the connections to a destination, and add them if necessary.
+ */
+static struct pool_dest *pool_dest(struct conn_pool *p, struct sockaddr_in *dst)
+{
+	struct flow_key key;
+	struct pool_dest *d;
+	void *val;
+
+	memset(&key, 0, sizeof(key));
+	key.saddr = dst->sin_addr.s_addr;
+	key.sport = dst->sin_port;
+
+	if(flowtab_lookup(&p->dests, &key, &val)) {
+		return val;
+	}
+
+	if(!(d = calloc(1, sizeof(struct pool_dest)))) {
+		return NULL;
+	}
+	d->dst = *dst;
+
+	if(flowtab_insert(&p->dests, &key, d) < 0) {
+		free(d);
+		return NULL;
+	}
+
+	d->next = p->destlist;
+	p->destlist = d;
+	return d;
+}
+
+
+/*
+ * Publish the counters of all connections. Every connection gets its
+ * record the first time, and keeps it for good.
+ */
+static void pool_publish(struct conn_pool *p, struct stats *s, uint64_t now)
+{
+	struct stats_flow f;
+	struct conn *c;
+
+	for(c = p->conns; c != NULL; c = c->next) {
+		if(c->slot < 0 && (c->slot = stats_flow_slot(s)) < 0) {
+			continue;
+		}
+
+		memset(&f, 0, sizeof(f));
+		f.updated = now;
+		f.saddr = c->src.sin_addr.s_addr;
+		f.daddr = c->dst.sin_addr.s_addr;
+		f.sport = c->src.sin_port;
+		f.dport = c->dst.sin_port;
+		f.state = c->state;
+		f.pkts_in = c->pkts_in;
+		f.bytes_in = c->bytes_in;
+		f.pkts_out = c->pkts_out;
+		f.bytes_out = c->bytes_out;
+		f.retrans = c->retrans;
+		f.requests = c->requests;
+		f.acks_sent = c->ack.acks_sent;
+		f.acks_delayed = c->ack.acks_delayed;
+		f.acks_piggybacked = c->ack.acks_piggybacked;
+		f.wnd = c->swin.wnd;
+		f.space = c->rwin.space;
+		f.srtt = c->rwin.rtt;
+		f.txqueue = c->txlen;
+		f.rxqueue = c->rxlen;
+		stats_put_flow(s, c->slot, &f);
+	}
+
+	p->published = now;
+}
+
+
+int pool_init(struct conn_pool *p, struct rawio *io, struct conn_conf *cf,
+		struct sockaddr_in *src, int size, uint16_t lo, uint16_t hi)
+{
+	memset(p, 0, sizeof(struct conn_pool));
+	p->io = io;
+	p->cf = cf;
+	p->src = *src;
+	p->size = (size > POOL_MAX) ? POOL_MAX : size;
+
+	if(port_init(&p->ports, lo, hi) < 0) {
+		return -1;
+	}
+
+	if(flowtab_init(&p->dests, 16) < 0) {
+		port_free(&p->ports);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void pool_free(struct conn_pool *p)
+{
+	struct pool_dest *d;
+	struct conn *c;
+
+	while((c = p->conns)) {
+		p->conns = c->next;
+		conn_free(c);
+		free(c);
+	}
+
+	while((d = p->destlist)) {
+		p->destlist = d->next;
+		free(d);
+	}
+
+	flowtab_free(&p->dests);
+	port_free(&p->ports);
+}
+
+
+struct conn *pool_request(struct conn_pool *p, struct sockaddr_in *dst,
+		char *data, int len)
+{
+	struct pool_dest *d;
+	struct conn *c;
+	struct sockaddr_in src;
+	int i;
+
+	if(!(d = pool_dest(p, dst))) {
+		return NULL;
+	}
+
+	/* An idle connection skips the handshake */
+	for(i = 0; i < d->n; i++) {
+		c = d->conns[i];
+		if(!c->busy && c->state == CONN_ESTABLISHED) {
+			if(conn_send(c, data, len) < 0) {
+				if(errno == EAGAIN) {
+					continue;
+				}
+				return NULL;
+			}
+			c->busy = 1;
+			return c;
+		}
+	}
+
+	/* Otherwise don't wait for a broken connection to be reconnected */
+	for(i = 0; i < d->n; i++) {
+		c = d->conns[i];
+		if(!c->busy && c->state == CONN_CLOSED) {
+			if(pool_rebind(p, c) < 0) {
+				return NULL;
+			}
+			goto connect;
+		}
+	}
+
+	/* Or open another connection */
+	if(d->n >= p->size) {
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	if(!(c = malloc(sizeof(struct conn)))) {
+		return NULL;
+	}
+
+	/* Only the first connection uses the port given by the user */
+	src = p->src;
+	p->src.sin_port = 0;
+	if(port_get(&p->ports, &src, dst, get_timestamp()) < 0) {
+		free(c);
+		return NULL;
+	}
+
+	if(conn_init(c, p->io, p->cf, &src, dst) < 0) {
+		port_put(&p->ports, &src, dst, 0, 0, 0);
+		free(c);
+		return NULL;
+	}
+
+	c->next = p->conns;
+	p->conns = c;
+	d->conns[d->n++] = c;
+
+connect:
+	if(conn_connect(c, data, len) < 0) {
+		return NULL;
+	}
+	c->busy = 1;
+	return c;
+}
+
+
+void pool_release(struct conn_pool *p, struct conn *c)
+{
+	(void)p;
+	c->busy = 0;
+}
+
+
+int pool_poll(struct conn_pool *p, int timeout)
+{
+	struct rawio_burst rb;
+	struct conn *c;
+	uint64_t now;
+	int t, i;
+
+	/* Only wait until the next timer is due */
+	now = get_timestamp();
+	for(c = p->conns; c != NULL; c = c->next) {
+		t = conn_timeout(c, now);
+		if(pool_broken(p, c)) {
+			t = (now >= pool_reconnect_due(c)) ? 0 :
+				(pool_reconnect_due(c) - now + 999) / 1000;
+		}
+		if(t >= 0 && (timeout < 0 || t < timeout)) {
+			timeout = t;
+		}
+	}
+
+	/* Idle connections are published as well */
+	if(p->cf->stats != NULL && (timeout < 0 || timeout > STATS_INTERVAL)) {
+		timeout = STATS_INTERVAL;
+	}
+
+	if(rawio_recv_burst(p->io, &rb, (timeout < 0) ? RAWIO_WAIT : timeout) < 0) {
+		return -1;
+	}
+
+	/* Hand the datagrams to their connections */
+	now = get_timestamp();
+	for(i = 0; i < rb.n; i++) {
+		if(rb.b.m_valid >> i & 1 && rb.ctx[i] != NULL) {
+			conn_input(rb.ctx[i], &rb.b, i, rb.pck[i], rb.len[i], now);
+		}
+	}
+	rawio_release_burst(p->io, &rb);
+
+	for(c = p->conns; c != NULL; c = c->next) {
+		conn_timer(c, now);
+
+		/* Reconnect in the background, so the next request finds an */
+		/* established connection again. A reconnect failing here only */
+		/* concerns this connection, so it is tried again later. */
+		if(c->state == CONN_ESTABLISHED) {
+			c->reconnects = 0;
+		}
+		else if(pool_broken(p, c) && now >= pool_reconnect_due(c)) {
+			printf("Reconnecting to port %d...\n", ntohs(c->dst.sin_port));
+			c->reconnects++;
+			if(pool_rebind(p, c) < 0 || conn_connect(c, NULL, 0) < 0) {
+				perror("ERROR:");
+				c->broken = 1;
+				c->stamp = now;
+			}
+		}
+	}
+
+	if(p->cf->stats != NULL && now - p->published >= (uint64_t)STATS_INTERVAL * 1000) {
+		pool_publish(p, p->cf->stats, now);
+	}
+
+	return 0;
+}
+
+
+void pool_close(struct conn_pool *p)
+{
+	struct conn *c;
+	int open;
+
+	p->closing = 1;
+	for(c = p->conns; c != NULL; c = c->next) {
+		conn_close(c);
+	}
+
+	/* Wait for the other ends to close as well */
+	do {
+		open = 0;
+		for(c = p->conns; c != NULL; c = c->next) {
+			open |= (c->state != CONN_CLOSED);
+		}
+	} while(open && pool_poll(p, -1) == 0);
+}
@@ -0,0 +1,146 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "conn.h"
+#include "flowtab.h"
+#include "port.h"
+#include "rawio.h"
+
+/* The maximum number of connections to a single destination */
+#define POOL_MAX 64
+
+/* How long a broken connection rests before it is reconnected in ms, */
+/* doubled for every reconnect in a row */
+#define POOL_RECONNECT 1000
+
+/* How often a broken connection is reconnected in the background, before */
+/* it is left alone until a request needs it */
+#define POOL_RECONNECTS 5
+
+/* How long to wait for the response to a request in milliseconds */
+#define POOL_TIMEOUT 5000
+
+/*
+ * The connections to a single destination.
+ *
+ * @dst: The address and port of the destination
+ * @conns: The connections
+ * @n: The number of connections
+ * @next: The next destination of the pool
+ */
+struct pool_dest {
+	struct sockaddr_in dst;
+	struct conn *conns[POOL_MAX];
+	int n;
+	struct pool_dest *next;
+};
+
+/*
+ * A pool of connections, which stay established between requests. A
+ * request is sent on an idle connection to the destination, so it skips
+ * the handshake. Only if all of them are busy, another connection is
+ * opened. Idle connections are kept alive with probes, and connections
+ * the other end closed or which broke, are reconnected in the background,
+ * backing off while the destination doesn't answer.
+ * Every connection, and every reconnect, gets its local port from the
+ * allocator. All connections share a single handle of the I/O-engine.
+ *
+ * @io: The handle of the I/O-engine
+ * @cf: The settings of the connections
+ * @src: The local address, and the port to try first or 0
+ * @size: The maximum number of connections to a single destination
+ * @ports: The allocator of the local ports
+ * @dests: The destinations, looked up by address and port
+ * @destlist: All destinations
+ * @conns: All connections
+ * @closing: The pool is being closed, so nothing is reconnected
+ * @published: The time the counters were last published in microseconds
+ */
+struct conn_pool {
+	struct rawio *io;
+	struct conn_conf *cf;
+	struct sockaddr_in src;
+	int size;
+	struct port_alloc ports;
+
+	struct flowtab dests;
+	struct pool_dest *destlist;
+	struct conn *conns;
+	int closing;
+	uint64_t published;
+};
+
+
+/*
+ * Initialize an empty pool.
+ *
+ * @p: The pool to initialize
+ * @io: The handle of the I/O-engine
+ * @cf: The settings of the connections
+ * @src: The local address, and the port of the first connection or 0
+ * @size: The maximum number of connections to a single destination
+ * @lo, @hi: The range of the local ports in host-byte-order
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int pool_init(struct conn_pool *p, struct rawio *io, struct conn_conf *cf,
+		struct sockaddr_in *src, int size, uint16_t lo, uint16_t hi);
+
+
+/*
+ * Free all connections of the pool, without closing them.
+ *
+ * @p: The pool
+ */
+void pool_free(struct conn_pool *p);
+
+
+/*
+ * Send a request to a destination. An idle and established connection is
+ * preferred, otherwise a broken one is reconnected or a new one is
+ * opened. The connection is busy until it is released again.
+ *
+ * @p: The pool
+ * @dst: The destination
+ * @data: The request
+ * @len: The length of the request
+ *
+ * Returns: The connection or NULL if an error occurred, with errno set to
+ *          EAGAIN if all connections to the destination are busy
+ */
+struct conn *pool_request(struct conn_pool *p, struct sockaddr_in *dst,
+		char *data, int len);
+
+
+/*
+ * Hand a connection back to the pool, after the response was received.
+ *
+ * @p: The pool
+ * @c: The connection
+ */
+void pool_release(struct conn_pool *p, struct conn *c);
+
+
+/*
+ * Wait for the next datagram or timer, and handle all that are due.
+ *
+ * @p: The pool
+ * @timeout: The time to wait at most in milliseconds or -1 to wait until
+ *           a datagram arrives or a timer is due
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int pool_poll(struct conn_pool *p, int timeout);
+
+
+/*
+ * Close all connections and wait until the other ends closed them too.
+ *
+ * @p: The pool
+ */
+void pool_close(struct conn_pool *p);
+
+#endif /* _POOL_H */
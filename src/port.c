@@ -0,0 +1,240 @@
+#include "port.h"
+
+#include "isn.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+
+/*
+ * Build the key of a 4-tuple, with the other end as the source just like
+ * the keys of received datagrams.
+ */
+static void port_key(struct flow_key *key, struct sockaddr_in *src,
+		struct sockaddr_in *dst)
+{
+	memset(key, 0, sizeof(struct flow_key));
+	key->saddr = dst->sin_addr.s_addr;
+	key->daddr = src->sin_addr.s_addr;
+	key->sport = dst->sin_port;
+	key->dport = src->sin_port;
+}
+
+
+/*
+ * Look up the ports in use towards a destination.
+ *
+ * @pa: The allocator
+ * @dst: The destination
+ * @add: Add the destination, if it isn't known yet
+ *
+ * Returns: The ports or NULL if the destination is unknown or an error
+ *          occurred
+ */
+static struct port_dest *port_dest(struct port_alloc *pa,
+		struct sockaddr_in *dst, int add)
+{
+	struct flow_key key;
+	struct port_dest *d;
+	void *val;
+
+	memset(&key, 0, sizeof(key));
+	key.saddr = dst->sin_addr.s_addr;
+	key.sport = dst->sin_port;
+
+	if(flowtab_lookup(&pa->dests, &key, &val)) {
+		return val;
+	}
+
+	if(!add || !(d = calloc(1, sizeof(struct port_dest)))) {
+		return NULL;
+	}
+
+	if(flowtab_insert(&pa->dests, &key, d) < 0) {
+		free(d);
+		return NULL;
+	}
+
+	d->next = pa->destlist;
+	pa->destlist = d;
+	return d;
+}
+
+
+/*
+ * Remove a 4-tuple from TIME_WAIT.
+ */
+static void port_tw_del(struct port_alloc *pa, struct port_tw *tw)
+{
+	if(tw->prev) tw->prev->next = tw->next;
+	else pa->tw_head = tw->next;
+
+	if(tw->next) tw->next->prev = tw->prev;
+	else pa->tw_tail = tw->prev;
+
+	flowtab_delete(&pa->tw, &tw->key);
+	free(tw);
+	pa->timewait--;
+}
+
+
+/*
+ * Check if a port is free towards a destination, and take it if so.
+ *
+ * @pa: The allocator
+ * @d: The ports in use towards the destination
+ * @src: The local address with the port to check
+ * @dst: The destination
+ * @now: The current time in microseconds
+ *
+ * Returns: 1 if the port was taken and 0 if not
+ */
+static int port_take(struct port_alloc *pa, struct port_dest *d,
+		struct sockaddr_in *src, struct sockaddr_in *dst, uint64_t now)
+{
+	uint16_t port = ntohs(src->sin_port);
+	struct flow_key key;
+	struct port_tw *tw;
+	void *val;
+	uint32_t isn;
+
+	if(port == 0 || d->used[port / 64] >> (port % 64) & 1) {
+		return 0;
+	}
+
+	/* A SYN, whose sequence-number is behind the old connection, */
+	/* would be taken for an old duplicate by the other end */
+	port_key(&key, src, dst);
+	if(flowtab_lookup(&pa->tw, &key, &val)) {
+		tw = val;
+		isn = isn_generate(src->sin_addr.s_addr, dst->sin_addr.s_addr,
+				src->sin_port, dst->sin_port, now);
+		if(now - tw->stamp < (uint64_t)PORT_TW_REUSE * 1000 ||
+				(int32_t)(isn - tw->snd_nxt) <= 0) {
+			return 0;
+		}
+
+		port_tw_del(pa, tw);
+		pa->reused++;
+	}
+
+	d->used[port / 64] |= (uint64_t)1 << (port % 64);
+	d->nused++;
+	pa->allocated++;
+	return 1;
+}
+
+
+int port_init(struct port_alloc *pa, uint16_t lo, uint16_t hi)
+{
+	memset(pa, 0, sizeof(struct port_alloc));
+	if(lo == 0 || hi < lo) {
+		errno = EINVAL;
+		return -1;
+	}
+	pa->lo = lo;
+	pa->hi = hi;
+
+	if(flowtab_init(&pa->dests, 16) < 0) {
+		return -1;
+	}
+
+	if(flowtab_init(&pa->tw, 1024) < 0) {
+		flowtab_free(&pa->dests);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void port_free(struct port_alloc *pa)
+{
+	struct port_dest *d;
+
+	while(pa->tw_head) {
+		port_tw_del(pa, pa->tw_head);
+	}
+
+	while((d = pa->destlist)) {
+		pa->destlist = d->next;
+		free(d);
+	}
+
+	flowtab_free(&pa->tw);
+	flowtab_free(&pa->dests);
+}
+
+
+int port_get(struct port_alloc *pa, struct sockaddr_in *src,
+		struct sockaddr_in *dst, uint64_t now)
+{
+	struct port_dest *d;
+	uint32_t range, offset, i;
+
+	/* Forget the 4-tuples which rested long enough */
+	while(pa->tw_head && now - pa->tw_head->stamp >= (uint64_t)PORT_TIME_WAIT * 1000) {
+		port_tw_del(pa, pa->tw_head);
+	}
+
+	if(!(d = port_dest(pa, dst, 1))) {
+		return -1;
+	}
+
+	if(src->sin_port != 0 && port_take(pa, d, src, dst, now)) {
+		return 0;
+	}
+
+	/* Every destination walks through the range in its own order */
+	range = pa->hi - pa->lo + 1;
+	offset = (uint32_t)isn_hash(src->sin_addr.s_addr, dst->sin_addr.s_addr,
+			0, dst->sin_port);
+
+	for(i = 0; i < range; i++) {
+		src->sin_port = htons(pa->lo + (offset + pa->next + i) % range);
+		if(port_take(pa, d, src, dst, now)) {
+			pa->next += i + 1;
+			return 0;
+		}
+	}
+
+	src->sin_port = 0;
+	errno = EADDRNOTAVAIL;
+	return -1;
+}
+
+
+void port_put(struct port_alloc *pa, struct sockaddr_in *src,
+		struct sockaddr_in *dst, uint32_t snd_nxt, int timewait,
+		uint64_t now)
+{
+	uint16_t port = ntohs(src->sin_port);
+	struct port_dest *d;
+	struct port_tw *tw;
+
+	if(!(d = port_dest(pa, dst, 0)) || !(d->used[port / 64] >> (port % 64) & 1)) {
+		return;
+	}
+	d->used[port / 64] &= ~((uint64_t)1 << (port % 64));
+	d->nused--;
+
+	if(!timewait || !(tw = calloc(1, sizeof(struct port_tw)))) {
+		return;
+	}
+
+	port_key(&tw->key, src, dst);
+	tw->snd_nxt = snd_nxt;
+	tw->stamp = now;
+	if(flowtab_insert(&pa->tw, &tw->key, tw) < 0) {
+		free(tw);
+		return;
+	}
+
+	tw->prev = pa->tw_tail;
+	if(pa->tw_tail) pa->tw_tail->next = tw;
+	else pa->tw_head = tw;
+	pa->tw_tail = tw;
+	pa->timewait++;
+}
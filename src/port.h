@@ -0,0 +1,138 @@
+#ifndef _PORT_H
+#define _PORT_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "flowtab.h"
+
+/* The default range of local ports, like Linux' ip_local_port_range */
+#define PORT_LO 32768
+#define PORT_HI 60999
+
+/* How long a 4-tuple rests in TIME_WAIT in milliseconds (2 * MSL) */
+#define PORT_TIME_WAIT 60000
+
+/* A 4-tuple in TIME_WAIT is reused at the earliest after this many ms */
+#define PORT_TW_REUSE 1000
+
+/*
+ * The local ports in use towards a single destination. As connections
+ * are told apart by the whole 4-tuple, the same port can be used towards
+ * different destinations at once.
+ *
+ * @used: A bit for every port, set while a connection uses it
+ * @nused: The number of ports in use
+ * @next: The next destination of the allocator
+ */
+struct port_dest {
+	uint64_t used[65536 / 64];
+	unsigned nused;
+	struct port_dest *next;
+};
+
+/*
+ * A 4-tuple resting in TIME_WAIT after its connection was closed. The
+ * entries are kept in the order they were added, which is also the order
+ * they expire in.
+ *
+ * @key: The 4-tuple
+ * @snd_nxt: Our sequence-number after the FIN
+ * @stamp: The time the connection was closed in microseconds
+ * @prev, @next: The neighbours in the list
+ */
+struct port_tw {
+	struct flow_key key;
+	uint32_t snd_nxt;
+	uint64_t stamp;
+	struct port_tw *prev;
+	struct port_tw *next;
+};
+
+/*
+ * Hands out the local ports of new connections (RFC 6056, Algorithm 3).
+ * The search starts at an offset given by the keyed hash of the
+ * destination, so the ports can't be guessed from outside, and moves on
+ * with every allocation. A port is skipped while it is in use towards
+ * the destination, or while its 4-tuple is in TIME_WAIT. A 4-tuple is
+ * reused early, if the initial sequence-number it would get now is
+ * beyond the sequence-space of the old connection, as the other end then
+ * accepts the SYN despite TIME_WAIT (RFC 6191 without timestamps).
+ *
+ * @lo, @hi: The range of ports in host-byte-order
+ * @next: The number of ports handed out so far, moving the search on
+ * @dests: The ports in use per destination, looked up by address and port
+ * @destlist: All destinations
+ * @tw: The 4-tuples in TIME_WAIT
+ * @tw_head, @tw_tail: The oldest and the newest entry in TIME_WAIT
+ * @allocated: The number of ports handed out
+ * @reused: The number of 4-tuples reused early from TIME_WAIT
+ * @timewait: The number of 4-tuples currently in TIME_WAIT
+ */
+struct port_alloc {
+	uint16_t lo;
+	uint16_t hi;
+	uint32_t next;
+
+	struct flowtab dests;
+	struct port_dest *destlist;
+	struct flowtab tw;
+	struct port_tw *tw_head;
+	struct port_tw *tw_tail;
+
+	unsigned long allocated;
+	unsigned long reused;
+	unsigned long timewait;
+};
+
+
+/*
+ * Initialize the allocator for a range of ports.
+ *
+ * @pa: The allocator to initialize
+ * @lo, @hi: The first and the last port of the range in host-byte-order
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int port_init(struct port_alloc *pa, uint16_t lo, uint16_t hi);
+
+
+/*
+ * Free the allocator with all its tables.
+ *
+ * @pa: The allocator
+ */
+void port_free(struct port_alloc *pa);
+
+
+/*
+ * Pick the local port of a new connection. If src already holds a port,
+ * that port is taken if it is available, even outside of the range.
+ *
+ * @pa: The allocator
+ * @src: The local address, the port is written to it
+ * @dst: The destination of the connection
+ * @now: The current time in microseconds
+ *
+ * Returns: 0 on success and -1 with errno set to EADDRNOTAVAIL if all
+ *          ports are taken
+ */
+int port_get(struct port_alloc *pa, struct sockaddr_in *src,
+		struct sockaddr_in *dst, uint64_t now);
+
+
+/*
+ * Give the port of a connection back. A connection closed with FINs
+ * leaves its 4-tuple in TIME_WAIT, an aborted one frees it at once.
+ *
+ * @pa: The allocator
+ * @src, @dst: The addresses of both ends
+ * @snd_nxt: Our next sequence-number of the connection
+ * @timewait: The connection was closed with FINs
+ * @now: The current time in microseconds
+ */
+void port_put(struct port_alloc *pa, struct sockaddr_in *src,
+		struct sockaddr_in *dst, uint32_t snd_nxt, int timewait,
+		uint64_t now);
+
+#endif /* _PORT_H */
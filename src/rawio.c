@@ -0,0 +1,678 @@
+#include "rawio.h"
+
+#include "basic_utils.h"
+#include "packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/* The engines which can be selected by name */
+static const struct rawio_ops *rawio_engines[] = {
+	&rawio_sock_ops,
+	&rawio_uring_ops,
+	&rawio_xdp_ops,
+	&rawio_packet_ops,
+	&rawio_pipe_ops,
+	&rawio_vlink_ops,
+	NULL
+};
+
+
+/* The size of the receive-buffers of a handle, one for each datagram of */
+/* a burst. Only the pages actually written to are ever backed by memory. */
+#define RAWIO_RX_SIZE ((size_t)RAWIO_BURST * RAWIO_RX_LEN)
+
+/* The number of connections the flow-table is sized for initially */
+#define RAWIO_FLOWS 64
+
+/* Busy-polling options of Linux 5.11, missing in older headers */
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+/* The memory-policy of mbind(), without depending on libnuma */
+#define RAWIO_MPOL_PREFERRED 1
+
+/* The highest NUMA-node memory can be placed on */
+#define RAWIO_MAX_NODE 63
+
+
+/*
+ * Get the key of a connection as it appears in received datagrams.
+ *
+ * @src: The local address of the connection
+ * @dst: The remote address of the connection
+ * @key: An address to write the key to
+ */
+static void rawio_flow_key(struct sockaddr_in *src, struct sockaddr_in *dst,
+		struct flow_key *key)
+{
+	key->saddr = dst->sin_addr.s_addr;
+	key->daddr = src->sin_addr.s_addr;
+	key->sport = dst->sin_port;
+	key->dport = src->sin_port;
+}
+
+
+/*
+ * Sort out the datagrams of a parsed burst, which belong to none of our
+ * connections or carry a wrong checksum, and look up the context of the
+ * connections of all others at once.
+ *
+ * @io: The handle of the engine
+ * @rb: The parsed burst
+ */
+static void rawio_accept(struct rawio *io, struct rawio_burst *rb)
+{
+	struct pkt_batch *b = &rb->b;
+	struct flow_key keys[RAWIO_BURST];
+	uint64_t bit;
+	uint32_t found;
+	int i;
+
+	/* Datagrams too short for a key never match a connection */
+	memset(keys, 0, sizeof(keys));
+	for(i = 0; i < rb->n; i++) {
+		if(b->status[i] != BATCH_ECSUM && (b->m_valid >> i & 1) == 0) {
+			continue;
+		}
+		keys[i].saddr = b->saddr[i];
+		keys[i].daddr = b->daddr[i];
+		keys[i].sport = b->sport[i];
+		keys[i].dport = b->dport[i];
+	}
+	found = flowtab_lookup_batch(&io->flows, keys, rb->n, rb->ctx);
+
+	for(i = 0; i < rb->n; i++) {
+		bit = (uint64_t)1 << i;
+
+		if(b->status[i] == BATCH_ECSUM && (found >> i & 1)) {
+			io->stats.csum_bad++;
+			continue;
+		}
+
+		if(!(b->m_valid & bit) ||
+				(!(found >> i & 1) && !(io->flags & RAWIO_F_LISTEN))) {
+			b->m_valid &= ~bit;
+			io->stats.drops++;
+			continue;
+		}
+
+		if(b->m_verified & bit) {
+			io->stats.csum_verified++;
+		}
+		else {
+			io->stats.csum_trusted++;
+		}
+
+		io->stats.pkts_in++;
+		io->stats.bytes_in += rb->len[i];
+	}
+}
+
+
+/*
+ * Read a single number from a file in sysfs.
+ *
+ * @path: The file
+ *
+ * Returns: The number or -1 if the file can't be read
+ */
+static int rawio_read_int(const char *path)
+{
+	FILE *fp;
+	int val;
+
+	if(!(fp = fopen(path, "r"))) {
+		return -1;
+	}
+
+	if(fscanf(fp, "%d", &val) != 1) {
+		val = -1;
+	}
+
+	fclose(fp);
+	return val;
+}
+
+
+/*
+ * Get the NUMA-node of a CPU.
+ *
+ * @cpu: The CPU
+ *
+ * Returns: The node or -1 if it is unknown
+ */
+static int rawio_cpu_node(int cpu)
+{
+	char path[128];
+	int node;
+
+	for(node = 0; node <= RAWIO_MAX_NODE; node++) {
+		sprintf(path, "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+		if(access(path, F_OK) == 0) {
+			return node;
+		}
+	}
+
+	return -1;
+}
+
+
+/*
+ * Prepare the low-latency-mode: Pin the calling thread to the configured
+ * CPU, unless another thread is going to drive the handle, and choose
+ * the NUMA-node for the packet-memory. A CPU on another node than the
+ * interface works, but every datagram then crosses the interconnect, so
+ * the user is told.
+ *
+ * @io: The handle of the engine
+ * @conf: The settings of the engine
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int rawio_lowlat(struct rawio *io, struct rawio_conf *conf)
+{
+	char path[128];
+	cpu_set_t set;
+	int node = -1;
+
+	io->cpu = conf->cpu;
+	if(io->cpu >= 0) {
+		/* A CPU the thread can't be pinned to is refused right away, */
+		/* even if the pinning happens later */
+		if(io->flags & RAWIO_F_NOPIN) {
+			if(sched_getaffinity(0, sizeof(set), &set) < 0 ||
+					io->cpu >= CPU_SETSIZE || !CPU_ISSET(io->cpu, &set)) {
+				errno = EINVAL;
+				perror("ERROR:");
+				return -1;
+			}
+		}
+		else if(rawio_pin(io) < 0) {
+			perror("ERROR:");
+			return -1;
+		}
+		node = rawio_cpu_node(io->cpu);
+	}
+
+	io->numa = node;
+	if(io->ifname[0] != '\0') {
+		sprintf(path, "/sys/class/net/%s/device/numa_node", io->ifname);
+		io->numa = rawio_read_int(path);
+
+		if(io->numa >= 0 && node >= 0 && io->numa != node) {
+			fprintf(stderr, "CPU %d is not on node %d of %s\n", io->cpu,
+					io->numa, io->ifname);
+		}
+	}
+
+	if(io->numa > RAWIO_MAX_NODE) {
+		io->numa = -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Map a buffer for datagrams, placed on the NUMA-node of the handle.
+ *
+ * @io: The handle of the engine
+ * @len: The length of the buffer in bytes
+ *
+ * Returns: The buffer or NULL if an error occurred
+ */
+static char *rawio_buf_alloc(struct rawio *io, size_t len)
+{
+	void *buf;
+
+	buf = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(buf == MAP_FAILED) {
+		return NULL;
+	}
+
+	rawio_mem_bind(io, buf, len);
+	return buf;
+}
+
+
+/*
+ * Calculate the time left until a deadline.
+ *
+ * @deadline: The deadline in microseconds
+ *
+ * Returns: The time left in milliseconds or -1 if the deadline has passed
+ */
+static int rawio_left(uint64_t deadline)
+{
+	uint64_t now = get_timestamp();
+
+	if(now >= deadline) {
+		return -1;
+	}
+	return (deadline - now) / 1000;
+}
+
+
+int rawio_open(struct rawio *io, struct rawio_conf *conf,
+		struct sockaddr_in *src, struct sockaddr_in *dst)
+{
+	const char *name = conf->engine;
+	struct flow_key key;
+	int i;
+
+	memset(io, 0, sizeof(struct rawio));
+	io->sockfd = -1;
+	io->rxfd = -1;
+	io->flags = conf->flags;
+	io->queue = conf->queue;
+	io->numa = -1;
+	io->cpu = -1;
+	io->src = *src;
+	io->dst = *dst;
+
+	if(conf->ifname != NULL) {
+		strncpy(io->ifname, conf->ifname, IF_NAMESIZE - 1);
+	}
+
+	/* Pin the thread first, so memory the kernel allocates for the */
+	/* engine lands on the node of the CPU as well */
+	if(io->flags & RAWIO_F_LOWLAT && rawio_lowlat(io, conf) < 0) {
+		return -1;
+	}
+
+	if(name == NULL) {
+		name = rawio_sock_ops.name;
+	}
+
+	/* Search for the requested engine */
+	for(i = 0; rawio_engines[i] != NULL; i++) {
+		if(strcmp(rawio_engines[i]->name, name) == 0) {
+			io->ops = rawio_engines[i];
+			break;
+		}
+	}
+
+	if(io->ops == NULL) {
+		fprintf(stderr, "Unknown I/O-engine: %s\n", name);
+		return -1;
+	}
+
+	/* Engines without own packet-memory use these buffers instead */
+	if(io->ops->alloc == NULL && !(io->txbuf = rawio_buf_alloc(io, DATAGRAM_LEN))) {
+		return -1;
+	}
+	if(io->ops->recv_zc == NULL && !(io->rxbuf = rawio_buf_alloc(io, RAWIO_RX_SIZE))) {
+		goto err_free;
+	}
+
+	/* Only the table is updated, the engine adds this connection on open */
+	rawio_flow_key(src, dst, &key);
+	if(flowtab_init(&io->flows, RAWIO_FLOWS) < 0 ||
+			flowtab_insert(&io->flows, &key, NULL) < 0) {
+		goto err_free;
+	}
+
+	io->priv = conf->priv;
+	if(io->ops->open(io) < 0) {
+		goto err_free;
+	}
+
+	return 0;
+
+err_free:
+	flowtab_free(&io->flows);
+	if(io->txbuf) munmap(io->txbuf, DATAGRAM_LEN);
+	if(io->rxbuf) munmap(io->rxbuf, RAWIO_RX_SIZE);
+	io->ops = NULL;
+	return -1;
+}
+
+
+int rawio_pin(struct rawio *io)
+{
+	cpu_set_t set;
+
+	if(!(io->flags & RAWIO_F_LOWLAT) || io->cpu < 0) {
+		return 0;
+	}
+
+	/* Only the calling thread is pinned, not the whole process */
+	CPU_ZERO(&set);
+	CPU_SET(io->cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+
+char *rawio_alloc(struct rawio *io)
+{
+	if(io->ops->alloc != NULL) {
+		return io->ops->alloc(io);
+	}
+
+	return io->txbuf;
+}
+
+
+int rawio_send(struct rawio *io, char *pck, int pcklen)
+{
+	io->stats.pkts_out++;
+	io->stats.bytes_out += pcklen;
+	return io->ops->send(io, pck, pcklen);
+}
+
+
+int rawio_flush(struct rawio *io)
+{
+	return io->ops->flush(io);
+}
+
+
+/*
+ * Receive a single datagram, either in the memory of the engine or in the
+ * buffer of the handle for the given position in the burst.
+ *
+ * @io: The handle of the engine
+ * @rb: The burst
+ * @i: The position of the datagram in the burst
+ * @timeout: The time to wait in milliseconds or RAWIO_WAIT
+ *
+ * Returns: The length of the datagram, 0 on timeout or -1 on error
+ */
+static int rawio_recv_one(struct rawio *io, struct rawio_burst *rb, int i,
+		int timeout)
+{
+	io->rxcsum = 0;
+	if(io->ops->recv_zc != NULL) {
+		return io->ops->recv_zc(io, &rb->pck[i], timeout);
+	}
+
+	rb->pck[i] = io->rxbuf + (size_t)i * RAWIO_RX_LEN;
+	return io->ops->recv(io, rb->pck[i], RAWIO_RX_LEN, timeout);
+}
+
+
+int rawio_recv_burst(struct rawio *io, struct rawio_burst *rb, int timeout)
+{
+	int recvlen;
+	int left = timeout;
+	int spin = io->flags & RAWIO_F_LOWLAT;
+	uint64_t deadline = 0;
+
+	rb->n = 0;
+	if(timeout != RAWIO_WAIT) {
+		deadline = get_timestamp() + (uint64_t)timeout * 1000;
+	}
+
+	/* Spin instead of blocking for the first datagram, until the time */
+	/* is up */
+	while((recvlen = rawio_recv_one(io, rb, 0, spin ? 0 : left)) == 0) {
+		if(!spin || (timeout != RAWIO_WAIT && rawio_left(deadline) < 0)) {
+			return 0;
+		}
+	}
+
+	/* Take along what else already arrived. An error only ends the */
+	/* burst, it shows up again with the next one. */
+	while(recvlen > 0) {
+		rb->len[rb->n] = recvlen;
+		rb->csum[rb->n] = io->rxcsum;
+		if(++rb->n == RAWIO_BURST) {
+			break;
+		}
+		recvlen = rawio_recv_one(io, rb, rb->n, 0);
+	}
+
+	if(rb->n == 0) {
+		return -1;
+	}
+
+	parse_batch(&rb->b, rb->pck, rb->len, rb->csum, rb->n);
+	rawio_accept(io, rb);
+	return rb->n;
+}
+
+
+void rawio_release_burst(struct rawio *io, struct rawio_burst *rb)
+{
+	int i;
+
+	/* The buffers of the handle are simply used again */
+	if(io->ops->recv_zc == NULL) {
+		return;
+	}
+
+	for(i = 0; i < rb->n; i++) {
+		io->ops->release(io, rb->pck[i]);
+	}
+	rb->n = 0;
+}
+
+
+int rawio_add_flow(struct rawio *io, struct sockaddr_in *src,
+		struct sockaddr_in *dst, void *ctx)
+{
+	struct flow_key key;
+
+	rawio_flow_key(src, dst, &key);
+	if(flowtab_insert(&io->flows, &key, ctx) < 0) {
+		return -1;
+	}
+
+	if(io->ops->add_flow != NULL && io->ops->add_flow(io, src, dst) < 0) {
+		flowtab_delete(&io->flows, &key);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int rawio_del_flow(struct rawio *io, struct sockaddr_in *src,
+		struct sockaddr_in *dst)
+{
+	struct flow_key key;
+
+	rawio_flow_key(src, dst, &key);
+	if(flowtab_delete(&io->flows, &key) < 0) {
+		return -1;
+	}
+
+	if(io->ops->del_flow != NULL) {
+		return io->ops->del_flow(io, src, dst);
+	}
+
+	return 0;
+}
+
+
+void rawio_close(struct rawio *io)
+{
+	if(io->ops != NULL) {
+		io->ops->close(io);
+	}
+	io->ops = NULL;
+	io->rxfd = -1;
+
+	flowtab_free(&io->flows);
+	if(io->txbuf) munmap(io->txbuf, DATAGRAM_LEN);
+	if(io->rxbuf) munmap(io->rxbuf, RAWIO_RX_SIZE);
+	io->txbuf = NULL;
+	io->rxbuf = NULL;
+}
+
+
+int rawio_busy_poll(struct rawio *io, int fd)
+{
+	int usecs = RAWIO_BUSY_POLL;
+	int budget = RAWIO_BUSY_BUDGET;
+	int one = 1;
+
+	if(!(io->flags & RAWIO_F_LOWLAT)) {
+		return 0;
+	}
+
+	if(setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) < 0) {
+		perror("ERROR:");
+		return -1;
+	}
+
+	/* Older kernels only lack the refinements, so don't insist on them */
+	setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+	setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget));
+	return 0;
+}
+
+
+int rawio_csum_raw(char *pck, int pcklen)
+{
+	if(pcklen >= (int)sizeof(struct iphdr) && (uint8_t)pck[12] == 127) {
+		return CSUM_F_IP | CSUM_F_LOCAL;
+	}
+
+	return CSUM_F_IP;
+}
+
+
+void rawio_mem_bind(struct rawio *io, void *mem, size_t len)
+{
+	unsigned long mask;
+
+	if(io->numa < 0) {
+		return;
+	}
+
+	/* Only prefer the node, so a full node doesn't make the engine fail */
+	mask = 1UL << io->numa;
+	syscall(SYS_mbind, mem, len, RAWIO_MPOL_PREFERRED, &mask,
+			sizeof(mask) * 8 + 1, 0);
+}
+
+
+/* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-= */
+/* DEFAULT ENGINE USING SENDTO() AND RECVFROM()                  */
+
+static int sock_open(struct rawio *io)
+{
+	int one = 1;
+
+	/* Create a raw socket for communication */
+	io->sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
+	if(io->sockfd < 0) {
+		perror("ERROR:");
+		return -1;
+	}
+
+	/* Tell the kernel that headers are included in the packet */
+	if(setsockopt(io->sockfd, IPPROTO_IP, IP_HDRINCL, &one, sizeof(one)) < 0) {
+		perror("ERROR:");
+		close(io->sockfd);
+		io->sockfd = -1;
+		return -1;
+	}
+
+	if(rawio_busy_poll(io, io->sockfd) < 0) {
+		close(io->sockfd);
+		io->sockfd = -1;
+		return -1;
+	}
+
+	io->rxfd = io->sockfd;
+	return 0;
+}
+
+
+static int sock_send(struct rawio *io, char *pck, int pcklen)
+{
+	struct sockaddr_in dst = io->dst;
+
+	/* Route by the IP-header, so connections to other hosts work too */
+	memcpy(&dst.sin_addr.s_addr, pck + 16, sizeof(dst.sin_addr.s_addr));
+	return sendto(io->sockfd, pck, pcklen, 0, (struct sockaddr *)&dst,
+			sizeof(struct sockaddr));
+}
+
+
+static int sock_flush(struct rawio *io)
+{
+	if(io){/* Every datagram is sent immediately */}
+	return 0;
+}
+
+
+static int sock_recv(struct rawio *io, char *buf, int len, int timeout)
+{
+	struct pollfd pfd;
+	int ret;
+
+	/* A spinning caller doesn't need the extra system-call of poll() */
+	if(timeout == 0) {
+		ret = recvfrom(io->sockfd, buf, len, MSG_DONTWAIT, NULL, NULL);
+		if(ret < 0) {
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : ret;
+		}
+		io->rxcsum = rawio_csum_raw(buf, ret);
+		return ret;
+	}
+
+	/* Only block as long as requested */
+	if(timeout != RAWIO_WAIT) {
+		pfd.fd = io->sockfd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		do {
+			ret = poll(&pfd, 1, timeout);
+		} while(ret < 0 && errno == EINTR);
+
+		if(ret <= 0) {
+			return ret;
+		}
+	}
+
+	/* Raw sockets only see datagrams after the IP-header was checked */
+	if((ret = recvfrom(io->sockfd, buf, len, 0, NULL, NULL)) > 0) {
+		io->rxcsum = rawio_csum_raw(buf, ret);
+	}
+	return ret;
+}
+
+
+static void sock_close(struct rawio *io)
+{
+	if(io->sockfd >= 0) {
+		close(io->sockfd);
+	}
+	io->sockfd = -1;
+}
+
+
+const struct rawio_ops rawio_sock_ops = {
+	"sock",
+	sock_open,
+	sock_send,
+	sock_flush,
+	sock_recv,
+	sock_close,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
@@ -0,0 +1,366 @@
+#ifndef _RAWIO_H
+#define _RAWIO_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <net/if.h>
+
+#include "batch.h"
+#include "flowtab.h"
+
+/* Block until a packet arrives */
+#define RAWIO_WAIT -1
+
+/* The size of a received datagram. With a large window, the NIC or the */
+/* kernel coalesces (GRO) segments into datagrams of up to 64KB. */
+#define RAWIO_RX_LEN 65536
+
+/* The maximum number of datagrams received at once */
+#define RAWIO_BURST FLOWTAB_BATCH
+
+/* Engine-flags set by the user */
+#define RAWIO_F_SQPOLL    0x01
+#define RAWIO_F_ZEROCOPY  0x02
+#define RAWIO_F_LOWLAT    0x04
+#define RAWIO_F_LISTEN    0x08
+#define RAWIO_F_NOPIN     0x10
+
+/* In low-latency-mode, how long the kernel busy-polls the device for a */
+/* socket in microseconds, and how many packets it handles per poll */
+#define RAWIO_BUSY_POLL   50
+#define RAWIO_BUSY_BUDGET 64
+
+struct rawio;
+
+/*
+ * The operations an I/O-engine has to provide. The packet layer only ever
+ * hands complete IP-datagrams to the engine and expects complete
+ * IP-datagrams back, so the protocol logic doesn't care which engine is
+ * actually moving the bytes.
+ *
+ * @name: The name used to select the engine
+ * @open: Setup the engine for the addresses stored in the handle
+ * @send: Queue a datagram for sending
+ * @flush: Push all queued datagrams to the kernel
+ * @recv: Receive a single datagram, waiting at most timeout milliseconds,
+ *        and set io->rxcsum to the checksums already checked (CSUM_F_*)
+ * @close: Release all resources used by the engine
+ *
+ * Engines which can hand out their own packet-memory additionally provide
+ * the following operations. They are optional and may be NULL.
+ *
+ * @alloc: Get a buffer in the engine's memory to build a datagram in place
+ * @recv_zc: Receive a datagram without copying it out of the engine's memory
+ * @release: Give a buffer returned by recv_zc() back to the engine
+ * @add_flow: Start receiving the datagrams of another connection
+ * @del_flow: Stop receiving the datagrams of a connection
+ */
+struct rawio_ops {
+	const char *name;
+	int (*open)(struct rawio *io);
+	int (*send)(struct rawio *io, char *pck, int pcklen);
+	int (*flush)(struct rawio *io);
+	int (*recv)(struct rawio *io, char *buf, int len, int timeout);
+	void (*close)(struct rawio *io);
+
+	char *(*alloc)(struct rawio *io);
+	int (*recv_zc)(struct rawio *io, char **pck, int timeout);
+	void (*release)(struct rawio *io, char *pck);
+	int (*add_flow)(struct rawio *io, struct sockaddr_in *src,
+			struct sockaddr_in *dst);
+	int (*del_flow)(struct rawio *io, struct sockaddr_in *src,
+			struct sockaddr_in *dst);
+};
+
+/*
+ * The settings used to open an I/O-engine.
+ *
+ * @engine: The name of the engine or NULL to use the default engine
+ * @flags: Engine-flags (RAWIO_F_*)
+ * @ifname: The network-interface to attach to (xdp only)
+ * @queue: The queue of the interface to attach to (xdp only)
+ * @cpu: The CPU to pin the calling thread to in low-latency-mode, or -1
+ * @priv: Private data handed to the engine (pipe and vlink only)
+ */
+struct rawio_conf {
+	const char *engine;
+	int flags;
+	const char *ifname;
+	int queue;
+	int cpu;
+	void *priv;
+};
+
+/*
+ * Counters of the datagrams passing the handle, and of the checksums of
+ * the received datagrams of our connections.
+ *
+ * @pkts_in, @bytes_in: The datagrams of our connections received
+ * @pkts_out, @bytes_out: The datagrams sent
+ * @drops: The datagrams received, which belong to no connection
+ * @csum_verified: The checksums were verified in software
+ * @csum_trusted: The checksums were already checked by the NIC or kernel,
+ *                or the datagram was sent by the local kernel
+ * @csum_bad: The datagram was dropped because of a wrong checksum
+ */
+struct rawio_stats {
+	unsigned long pkts_in;
+	unsigned long bytes_in;
+	unsigned long pkts_out;
+	unsigned long bytes_out;
+	unsigned long drops;
+	unsigned long csum_verified;
+	unsigned long csum_trusted;
+	unsigned long csum_bad;
+};
+
+/*
+ * A handle for an opened I/O-engine.
+ *
+ * @ops: The operations of the selected engine
+ * @sockfd: The raw socket used by the engine
+ * @rxfd: A descriptor, which becomes readable when datagrams arrive
+ * @flags: Engine-flags (RAWIO_F_*)
+ * @ifname: The network-interface used by the engine
+ * @queue: The queue of the network-interface
+ * @numa: The NUMA-node the packet-memory is placed on, or -1
+ * @cpu: The CPU the thread driving the handle runs on in
+ *       low-latency-mode, or -1
+ * @src: The local address of the connection
+ * @dst: The remote address of the connection
+ * @txbuf: Buffer for building datagrams, if the engine has no own memory
+ * @rxbuf: Buffers for a burst of received datagrams (RAWIO_RX_LEN bytes
+ *         each), if the engine has no own memory
+ * @flows: The connections whose datagrams are received
+ * @rxcsum: The checksums of the last datagram checked by the engine
+ * @stats: Counters of the handle
+ * @priv: Private data of the engine
+ */
+struct rawio {
+	const struct rawio_ops *ops;
+	int sockfd;
+	int rxfd;
+	int flags;
+	char ifname[IF_NAMESIZE];
+	int queue;
+	int numa;
+	int cpu;
+	struct sockaddr_in src;
+	struct sockaddr_in dst;
+	char *txbuf;
+	char *rxbuf;
+	struct flowtab flows;
+	int rxcsum;
+	struct rawio_stats stats;
+	void *priv;
+};
+
+
+/*
+ * A burst of received datagrams, taken apart by parse_batch().
+ *
+ * @n: The number of datagrams
+ * @pck: The datagrams, starting with the IP-header
+ * @len: The length of each datagram in bytes
+ * @csum: The checksums of each datagram checked by the engine (CSUM_F_*)
+ * @ctx: The context of the connection of each datagram
+ * @b: The parsed headers. Only the datagrams of our connections with
+ *     correct checksums are marked in b.m_valid.
+ */
+struct rawio_burst {
+	int n;
+	char *pck[RAWIO_BURST];
+	int len[RAWIO_BURST];
+	int csum[RAWIO_BURST];
+	void *ctx[RAWIO_BURST];
+	struct pkt_batch b;
+};
+
+
+/* The available engines */
+extern const struct rawio_ops rawio_sock_ops;
+extern const struct rawio_ops rawio_uring_ops;
+extern const struct rawio_ops rawio_xdp_ops;
+extern const struct rawio_ops rawio_packet_ops;
+extern const struct rawio_ops rawio_pipe_ops;
+extern const struct rawio_ops rawio_vlink_ops;
+
+
+/*
+ * Select an I/O-engine by name and open it for the given addresses. If no
+ * name is given, the default engine using sendto() and recvfrom() is used.
+ *
+ * In low-latency-mode (RAWIO_F_LOWLAT), the calling thread is pinned to
+ * the configured CPU first, unless RAWIO_F_NOPIN leaves that to the
+ * thread which is going to drive the handle. The packet-memory is placed
+ * on the NUMA-node of the interface, or on the node of that CPU if no
+ * interface is given, and the sockets of the engine busy-poll the device.
+ * Instead of blocking, receiving spins until a datagram arrives, so no
+ * wakeup is ever waited for.
+ *
+ * @io: The handle to initialize
+ * @conf: The settings of the engine
+ * @src: The local address
+ * @dst: The remote address
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int rawio_open(struct rawio *io, struct rawio_conf *conf,
+		struct sockaddr_in *src, struct sockaddr_in *dst);
+
+
+/*
+ * Pin the calling thread to the CPU of the handle. Outside of
+ * low-latency-mode or without a CPU, nothing is done.
+ *
+ * @io: The handle of the engine
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int rawio_pin(struct rawio *io);
+
+
+/*
+ * Get a buffer of DATAGRAM_LEN bytes to build the next datagram in. If the
+ * engine has its own packet-memory, the buffer points right into it and
+ * rawio_send() doesn't have to copy the datagram. The buffer is valid
+ * until it is passed to rawio_send().
+ *
+ * @io: The handle of the engine
+ *
+ * Returns: The buffer or NULL if no buffer is available
+ */
+char *rawio_alloc(struct rawio *io);
+
+
+/*
+ * Send a datagram. Depending on the engine, the datagram might only be
+ * queued and is pushed to the kernel with the next call of rawio_flush()
+ * or rawio_recv_burst(). The engines "sock" and "packet" route the datagram by
+ * the destination in its IP-header, the others only reach the
+ * destination the handle was opened for.
+ *
+ * @io: The handle of the engine
+ * @pck: The datagram to send
+ * @pcklen: The length of the datagram in bytes
+ *
+ * Returns: The amount of bytes sent or queued, or -1 if an error occurred
+ */
+int rawio_send(struct rawio *io, char *pck, int pcklen);
+
+
+/*
+ * Push all queued datagrams to the kernel.
+ *
+ * @io: The handle of the engine
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int rawio_flush(struct rawio *io);
+
+
+/*
+ * Receive a burst of datagrams. Only the first datagram is waited for,
+ * then whatever else already arrived is taken along, up to RAWIO_BURST
+ * datagrams. The whole burst is parsed at once, and the connections of
+ * all datagrams are looked up at once as well. Datagrams belonging to no
+ * connection are dropped, just like datagrams with a wrong checksum.
+ * A listening handle (RAWIO_F_LISTEN) also passes on the datagrams of
+ * unknown connections, with a context of NULL.
+ *
+ * The datagrams stay in the memory of the engine and have to be given
+ * back using rawio_release_burst(), before receiving the next burst.
+ *
+ * @io: The handle of the engine
+ * @rb: The burst to write the datagrams to
+ * @timeout: The time to wait in milliseconds or RAWIO_WAIT
+ *
+ * Returns: The number of datagrams received, valid or not, 0 on timeout
+ *          or -1 on error
+ */
+int rawio_recv_burst(struct rawio *io, struct rawio_burst *rb, int timeout);
+
+
+/*
+ * Give the datagrams of a burst back to the engine.
+ *
+ * @io: The handle of the engine
+ * @rb: The burst
+ */
+void rawio_release_burst(struct rawio *io, struct rawio_burst *rb);
+
+
+/*
+ * Tell the engine to also pass the datagrams of another connection to us.
+ * The connection of the handle itself is added with a NULL-context, when
+ * opening the engine. Adding a connection again only updates the context.
+ *
+ * @io: The handle of the engine
+ * @src: The local address of the connection
+ * @dst: The remote address of the connection
+ * @ctx: The context returned for datagrams of the connection
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int rawio_add_flow(struct rawio *io, struct sockaddr_in *src,
+		struct sockaddr_in *dst, void *ctx);
+
+
+/*
+ * Stop receiving the datagrams of a connection.
+ *
+ * @io: The handle of the engine
+ * @src: The local address of the connection
+ * @dst: The remote address of the connection
+ *
+ * Returns: 0 on success and -1 if the connection wasn't added
+ */
+int rawio_del_flow(struct rawio *io, struct sockaddr_in *src,
+		struct sockaddr_in *dst);
+
+
+/*
+ * Let the kernel busy-poll the device for a socket of the engine, when the
+ * handle is in low-latency-mode. Otherwise nothing is done.
+ *
+ * @io: The handle of the engine
+ * @fd: The socket
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int rawio_busy_poll(struct rawio *io, int fd);
+
+
+/*
+ * Get the checksums already checked for a datagram received on a raw
+ * socket. The kernel checked the IP-header, and a source in 127.0.0.0/8
+ * means the datagram came over the loopback-interface, as the kernel
+ * drops such sources arriving on any other.
+ *
+ * @pck: The datagram starting with the IP-header
+ * @pcklen: The length of the datagram in bytes
+ *
+ * Returns: The checksums checked (CSUM_F_*)
+ */
+int rawio_csum_raw(char *pck, int pcklen);
+
+
+/*
+ * Place fresh packet-memory of the engine on the NUMA-node of the handle.
+ * The memory has to be mapped, but not yet touched.
+ *
+ * @io: The handle of the engine
+ * @mem: The memory, aligned to a page
+ * @len: The length of the memory in bytes
+ */
+void rawio_mem_bind(struct rawio *io, void *mem, size_t len);
+
+
+/*
+ * Close the engine and release all resources.
+ *
+ * @io: The handle of the engine
+ */
+void rawio_close(struct rawio *io);
+
+#endif /* _RAWIO_H */
@@ -0,0 +1,230 @@
+#include "rawio.h"
+
+#include "packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+/*
+ * Private data of the engine.
+ *
+ * @pktfd: The AF_PACKET-socket used for receiving
+ * @ifindex: The interface to receive from or 0 for all interfaces
+ */
+struct pkt {
+	int pktfd;
+	int ifindex;
+};
+
+
+/*
+ * Only pass TCP-segments to the socket. As the socket doesn't see the
+ * link-layer-header, offset 9 is the protocol-field of the IP-header.
+ */
+static struct sock_filter pkt_filter[] = {
+	{ BPF_LD | BPF_B | BPF_ABS, 0, 0, 9 },
+	{ BPF_JMP | BPF_JEQ | BPF_K, 0, 1, IPPROTO_TCP },
+	{ BPF_RET | BPF_K, 0, 0, 0xffff },
+	{ BPF_RET | BPF_K, 0, 0, 0 }
+};
+
+
+static void pkt_close(struct rawio *io)
+{
+	struct pkt *pk = io->priv;
+
+	if(pk != NULL) {
+		if(pk->pktfd >= 0) close(pk->pktfd);
+		free(pk);
+	}
+	io->priv = NULL;
+
+	if(io->sockfd >= 0) {
+		close(io->sockfd);
+	}
+	io->sockfd = -1;
+}
+
+
+static int pkt_open(struct rawio *io)
+{
+	struct pkt *pk;
+	struct sockaddr_ll sll;
+	struct sock_fprog fprog;
+	int one = 1;
+
+	if(!(pk = calloc(1, sizeof(struct pkt)))) {
+		return -1;
+	}
+	io->priv = pk;
+	pk->pktfd = -1;
+
+	if(io->ifname[0] != '\0' && !(pk->ifindex = if_nametoindex(io->ifname))) {
+		goto err_close;
+	}
+
+	/* A raw socket with IPPROTO_RAW can only send, so no copies of the */
+	/* received segments pile up in it */
+	if((io->sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) < 0) {
+		goto err_close;
+	}
+
+	/* Receive the IP-datagrams without the link-layer-header */
+	if((pk->pktfd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP))) < 0) {
+		goto err_close;
+	}
+
+	/* Let the kernel tell us, whether the checksums were already checked */
+	if(setsockopt(pk->pktfd, SOL_PACKET, PACKET_AUXDATA, &one, sizeof(one)) < 0) {
+		goto err_close;
+	}
+
+	if(rawio_busy_poll(io, pk->pktfd) < 0) {
+		goto err_close;
+	}
+
+	fprog.len = sizeof(pkt_filter) / sizeof(pkt_filter[0]);
+	fprog.filter = pkt_filter;
+	if(setsockopt(pk->pktfd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+		goto err_close;
+	}
+
+	if(pk->ifindex != 0) {
+		memset(&sll, 0, sizeof(sll));
+		sll.sll_family = AF_PACKET;
+		sll.sll_protocol = htons(ETH_P_IP);
+		sll.sll_ifindex = pk->ifindex;
+		if(bind(pk->pktfd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+			goto err_close;
+		}
+	}
+
+	io->rxfd = pk->pktfd;
+	return 0;
+
+err_close:
+	perror("ERROR:");
+	pkt_close(io);
+	return -1;
+}
+
+
+static int pkt_send(struct rawio *io, char *pck, int pcklen)
+{
+	struct sockaddr_in dst = io->dst;
+
+	/* Route by the IP-header, so connections to other hosts work too */
+	memcpy(&dst.sin_addr.s_addr, pck + 16, sizeof(dst.sin_addr.s_addr));
+	return sendto(io->sockfd, pck, pcklen, 0, (struct sockaddr *)&dst,
+			sizeof(struct sockaddr));
+}
+
+
+static int pkt_flush(struct rawio *io)
+{
+	if(io){/* Every datagram is sent immediately */}
+	return 0;
+}
+
+
+static int pkt_recv(struct rawio *io, char *buf, int len, int timeout)
+{
+	struct pkt *pk = io->priv;
+	struct sockaddr_ll sll;
+	struct tpacket_auxdata *aux;
+	struct cmsghdr *cmsg;
+	struct pollfd pfd;
+	struct iovec iov;
+	struct msghdr msg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(struct tpacket_auxdata))];
+	} ctrl;
+	int flags = 0;
+	int ret;
+
+	while(1) {
+		/* Only block as long as requested, a spinning caller doesn't */
+		/* need the extra system-call of poll() */
+		if(timeout == 0) {
+			flags = MSG_DONTWAIT;
+		}
+		else if(timeout != RAWIO_WAIT) {
+			pfd.fd = pk->pktfd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+
+			do {
+				ret = poll(&pfd, 1, timeout);
+			} while(ret < 0 && errno == EINTR);
+
+			if(ret <= 0) {
+				return ret;
+			}
+		}
+
+		iov.iov_base = buf;
+		iov.iov_len = len;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &sll;
+		msg.msg_namelen = sizeof(sll);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = ctrl.buf;
+		msg.msg_controllen = sizeof(ctrl.buf);
+
+		if((ret = recvmsg(pk->pktfd, &msg, flags)) < 0) {
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : ret;
+		}
+
+		/* The socket also sees the datagrams we send ourselves */
+		if(sll.sll_pkttype == PACKET_OUTGOING) {
+			continue;
+		}
+
+		/* Nobody checks the IP-header before an AF_PACKET-socket, but */
+		/* the TCP-checksum might have been checked by the NIC already or */
+		/* is left to the NIC, as the segment never left the machine */
+		io->rxcsum = (sll.sll_hatype == ARPHRD_LOOPBACK) ? CSUM_F_LOCAL : 0;
+		for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if(cmsg->cmsg_level != SOL_PACKET || cmsg->cmsg_type != PACKET_AUXDATA) {
+				continue;
+			}
+
+			aux = (struct tpacket_auxdata *)CMSG_DATA(cmsg);
+			if(aux->tp_status & (TP_STATUS_CSUM_VALID | TP_STATUS_CSUMNOTREADY)) {
+				io->rxcsum |= CSUM_F_TCP;
+			}
+		}
+
+		return ret;
+	}
+}
+
+
+const struct rawio_ops rawio_packet_ops = {
+	"packet",
+	pkt_open,
+	pkt_send,
+	pkt_flush,
+	pkt_recv,
+	pkt_close,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
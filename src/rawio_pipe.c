@@ -0,0 +1,210 @@
+#include "rawio.h"
+
+#include "pipeline.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+/* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-= */
+/* ENGINE OF A PROTOCOL-THREAD, PASSING DATAGRAMS THROUGH RINGS  */
+
+/*
+ * Take an empty buffer, returned by the I/O-thread. All buffers of the
+ * thread are only ever waiting in the ring to the I/O-thread, which sends
+ * them without waiting for anything, so they come back soon.
+ */
+static struct pipe_msg *pipe_take(struct pipe_chan *ch)
+{
+	while(ch->txn == 0) {
+		if(!(ch->txn = ring_dequeue_burst(&ch->txfree, ch->txq, RING_BURST))) {
+			sched_yield();
+		}
+	}
+
+	return ch->txq[--ch->txn];
+}
+
+
+/*
+ * Tell the I/O-thread to add or delete a flow. The message goes through
+ * the same ring as the datagrams, so a flow is always added before the
+ * SYN is sent. Once the pipeline is stopped, no buffer comes back anymore
+ * and the flows go away with the handle of the I/O-thread, so the
+ * connections freed then send nothing.
+ */
+static int pipe_flow(struct rawio *io, int type, struct sockaddr_in *src,
+		struct sockaddr_in *dst)
+{
+	struct pipe_chan *ch = io->priv;
+	struct pipe_msg *msg;
+
+	if(__atomic_load_n(&ch->pl->stop, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	msg = pipe_take(ch);
+	msg->type = type;
+	msg->chan = ch;
+	msg->src = *src;
+	msg->dst = *dst;
+	return ring_enqueue(&ch->pl->tx, msg);
+}
+
+
+static int pipe_open(struct rawio *io)
+{
+	/* The engine only works within a pipeline */
+	if(io->priv == NULL) {
+		errno = EINVAL;
+		perror("ERROR:");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static char *pipe_alloc(struct rawio *io)
+{
+	struct pipe_chan *ch = io->priv;
+
+	if(ch->txcur == NULL) {
+		ch->txcur = pipe_take(ch);
+	}
+
+	return PIPE_DATA_OF(ch->txcur);
+}
+
+
+static int pipe_send(struct rawio *io, char *pck, int pcklen)
+{
+	struct pipe_chan *ch = io->priv;
+	struct pipe_msg *msg = PIPE_MSG_OF(pck);
+
+	if(msg != ch->txcur || pcklen > DATAGRAM_LEN) {
+		errno = EINVAL;
+		return -1;
+	}
+	ch->txcur = NULL;
+
+	msg->type = PIPE_DATA;
+	msg->len = pcklen;
+	msg->chan = ch;
+
+	/* The ring holds all buffers of all threads, so it is never full */
+	if(ring_enqueue(&ch->pl->tx, msg) < 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	return pcklen;
+}
+
+
+static int pipe_flush(struct rawio *io)
+{
+	if(io){/* The I/O-thread was already woken up by the ring */}
+	return 0;
+}
+
+
+static int pipe_recv_zc(struct rawio *io, char **pck, int timeout)
+{
+	struct pipe_chan *ch = io->priv;
+	struct pipe_msg *msg;
+	struct ring *rings[2];
+
+	if(ch->rxi == ch->rxn) {
+		ch->rxi = 0;
+		ch->rxn = ring_dequeue_burst(&ch->rx, ch->rxq, RING_BURST);
+
+		/* A new request wakes the thread up as well */
+		if(ch->rxn == 0 && timeout != 0) {
+			rings[0] = &ch->rx;
+			rings[1] = &ch->reqs;
+			if(ring_wait(&ch->waiter, rings, 2, -1, timeout) < 0) {
+				return -1;
+			}
+			ch->rxn = ring_dequeue_burst(&ch->rx, ch->rxq, RING_BURST);
+		}
+
+		if(ch->rxn == 0) {
+			return 0;
+		}
+	}
+
+	msg = ch->rxq[ch->rxi++];
+	io->rxcsum = msg->csum;
+	*pck = PIPE_DATA_OF(msg);
+	return msg->len;
+}
+
+
+static void pipe_release(struct rawio *io, char *pck)
+{
+	struct pipe_chan *ch = io->priv;
+
+	ring_enqueue(&ch->pl->rxfree, PIPE_MSG_OF(pck));
+}
+
+
+static int pipe_recv(struct rawio *io, char *buf, int len, int timeout)
+{
+	char *pck;
+	int ret;
+
+	if((ret = pipe_recv_zc(io, &pck, timeout)) <= 0) {
+		return ret;
+	}
+
+	if(ret > len) {
+		ret = len;
+	}
+	memcpy(buf, pck, ret);
+	pipe_release(io, pck);
+	return ret;
+}
+
+
+static int pipe_add_flow(struct rawio *io, struct sockaddr_in *src,
+		struct sockaddr_in *dst)
+{
+	return pipe_flow(io, PIPE_ADD_FLOW, src, dst);
+}
+
+
+static int pipe_del_flow(struct rawio *io, struct sockaddr_in *src,
+		struct sockaddr_in *dst)
+{
+	return pipe_flow(io, PIPE_DEL_FLOW, src, dst);
+}
+
+
+static void pipe_close(struct rawio *io)
+{
+	struct pipe_chan *ch = io->priv;
+
+	/* The buffers belong to the pipeline */
+	if(ch != NULL && ch->txcur != NULL) {
+		ring_enqueue(&ch->txfree, ch->txcur);
+		ch->txcur = NULL;
+	}
+	io->priv = NULL;
+}
+
+
+const struct rawio_ops rawio_pipe_ops = {
+	"pipe",
+	pipe_open,
+	pipe_send,
+	pipe_flush,
+	pipe_recv,
+	pipe_close,
+	pipe_alloc,
+	pipe_recv_zc,
+	pipe_release,
+	pipe_add_flow,
+	pipe_del_flow
+};
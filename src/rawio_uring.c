@@ -0,0 +1,692 @@
+#include "rawio.h"
+
+#include "basic_utils.h"
+#include "packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+/* The number of entries in the submission-queue */
+#define URING_ENTRIES 64
+
+/* The number of registered buffers used for sending datagrams */
+#define URING_TX_SLOTS 32
+
+/* The number of provided buffers for receiving (has to be a power of 2) */
+#define URING_RX_BUFS 64
+
+/* The buffer-group of the provided buffers */
+#define URING_BGID 0
+
+/* How long to spin on the completion-queue in SQPOLL-mode before blocking */
+#define URING_SPIN_USEC 10000
+
+/* Tags stored in the user-data of the requests */
+#define URING_TAG_TX 0x10000
+#define URING_TAG_RX 0x20000
+
+/*
+ * A datagram which has been received, but not yet been passed to the
+ * caller.
+ *
+ * @bid: The id of the provided buffer containing the datagram
+ * @len: The length of the datagram in bytes
+ */
+struct uring_rxent {
+	unsigned short bid;
+	int len;
+};
+
+/*
+ * The private data of the io_uring-engine.
+ */
+struct uring {
+	int ringfd;
+	int sqpoll;
+	int multishot;
+	int armed;
+	int error;
+
+	/* The submission-queue */
+	void *sq_ptr;
+	size_t sq_sz;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_entries;
+	unsigned *sq_flags;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_sz;
+	unsigned sq_local_tail;
+	unsigned queued;
+
+	/* The completion-queue */
+	void *cq_ptr;
+	size_t cq_sz;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* The registered buffers used for sending */
+	char *txmem;
+	int txfree[URING_TX_SLOTS];
+	int ntxfree;
+
+	/* The provided buffers used for receiving */
+	struct io_uring_buf_ring *br;
+	char *rxmem;
+	unsigned short br_tail;
+	struct uring_rxent rxq[URING_RX_BUFS];
+	unsigned rxq_head;
+	unsigned rxq_tail;
+};
+
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+		unsigned flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+			arg, argsz);
+}
+
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg,
+		unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+/*
+ * Return a provided buffer to the kernel, so it can be used for further
+ * receives.
+ *
+ * @ur: The private data of the engine
+ * @bid: The id of the buffer
+ */
+static void uring_recycle(struct uring *ur, unsigned short bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &ur->br->bufs[ur->br_tail & (URING_RX_BUFS - 1)];
+	buf->addr = (unsigned long)(ur->rxmem + bid * RAWIO_RX_LEN);
+	buf->len = RAWIO_RX_LEN;
+	buf->bid = bid;
+	ur->br_tail++;
+
+	__atomic_store_n(&ur->br->tail, ur->br_tail, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Get the next free entry of the submission-queue. The entry becomes
+ * visible to the kernel with the next call of uring_submit().
+ *
+ * @ur: The private data of the engine
+ *
+ * Returns: The entry or NULL if the queue is full
+ */
+static struct io_uring_sqe *uring_get_sqe(struct uring *ur)
+{
+	struct io_uring_sqe *sqe;
+	unsigned head, idx;
+
+	head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+	if(ur->sq_local_tail - head >= *ur->sq_entries) {
+		return NULL;
+	}
+
+	idx = ur->sq_local_tail & *ur->sq_mask;
+	sqe = &ur->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ur->sq_array[idx] = idx;
+	ur->sq_local_tail++;
+	ur->queued++;
+
+	return sqe;
+}
+
+
+/*
+ * Publish all queued entries of the submission-queue and, if required, wait
+ * for at least one completion. In SQPOLL-mode the kernel-thread picks up
+ * the entries itself, so a system-call is only needed to wake it up.
+ *
+ * @ur: The private data of the engine
+ * @wait: Wait for a completion
+ * @ts: The maximum time to wait or NULL to wait forever
+ *
+ * Returns: 0 on success, 1 on timeout and -1 if an error occurred
+ */
+static int uring_submit(struct uring *ur, int wait, struct __kernel_timespec *ts)
+{
+	struct io_uring_getevents_arg arg;
+	unsigned flags = 0;
+	unsigned to_submit;
+	int ret;
+
+	__atomic_store_n(ur->sq_tail, ur->sq_local_tail, __ATOMIC_RELEASE);
+	to_submit = ur->queued;
+	ur->queued = 0;
+
+	if(ur->sqpoll) {
+		to_submit = 0;
+
+		/* The tail has to be visible before checking the wakeup-flag */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(__atomic_load_n(ur->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+			flags |= IORING_ENTER_SQ_WAKEUP;
+		}
+	}
+
+	if(wait) {
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+
+	/* Nothing to do for the kernel */
+	if(to_submit == 0 && flags == 0) {
+		return 0;
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	if(wait && ts != NULL) {
+		arg.ts = (unsigned long)ts;
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	do {
+		if(flags & IORING_ENTER_EXT_ARG) {
+			ret = sys_io_uring_enter(ur->ringfd, to_submit, wait, flags,
+					&arg, sizeof(arg));
+		}
+		else {
+			ret = sys_io_uring_enter(ur->ringfd, to_submit, wait, flags,
+					NULL, 0);
+		}
+	} while(ret < 0 && errno == EINTR);
+
+	if(ret < 0) {
+		return (errno == ETIME) ? 1 : -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Arm the receive-request. With multishot-support a single request keeps
+ * producing completions until the kernel runs out of provided buffers.
+ *
+ * @io: The handle of the engine
+ * @ur: The private data of the engine
+ *
+ * Returns: 0 on success and -1 if the queue is full
+ */
+static int uring_arm_recv(struct rawio *io, struct uring *ur)
+{
+	struct io_uring_sqe *sqe;
+
+	if(ur->armed) {
+		return 0;
+	}
+
+	if(!(sqe = uring_get_sqe(ur))) {
+		return -1;
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = io->sockfd;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = URING_TAG_RX;
+	if(ur->multishot) {
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+	}
+
+	ur->armed = 1;
+	return 0;
+}
+
+
+/*
+ * Process all entries of the completion-queue. Finished sends release their
+ * slot and received datagrams are moved to the receive-queue.
+ *
+ * @ur: The private data of the engine
+ *
+ * Returns: The number of processed completions
+ */
+static int uring_reap(struct uring *ur)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	int n = 0;
+
+	head = *ur->cq_head;
+	tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+	for(; head != tail; head++, n++) {
+		cqe = &ur->cqes[head & *ur->cq_mask];
+
+		if(cqe->user_data & URING_TAG_TX) {
+			/* The slot can be used for the next datagram */
+			ur->txfree[ur->ntxfree++] = cqe->user_data & 0xffff;
+			if(cqe->res < 0) {
+				ur->error = -cqe->res;
+			}
+			continue;
+		}
+
+		/* Without this flag the request has to be armed again */
+		if(!(cqe->flags & IORING_CQE_F_MORE)) {
+			ur->armed = 0;
+		}
+
+		if(cqe->res < 0) {
+			/* Older kernels don't support multishot-receives */
+			if(cqe->res == -EINVAL && ur->multishot) {
+				ur->multishot = 0;
+			}
+			else if(cqe->res != -ENOBUFS) {
+				ur->error = -cqe->res;
+			}
+			continue;
+		}
+
+		if(cqe->flags & IORING_CQE_F_BUFFER) {
+			struct uring_rxent *ent;
+
+			ent = &ur->rxq[ur->rxq_tail++ & (URING_RX_BUFS - 1)];
+			ent->bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+			ent->len = cqe->res;
+		}
+	}
+
+	__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+
+/*
+ * Map the rings shared with the kernel into memory.
+ *
+ * @ur: The private data of the engine
+ * @p: The parameters returned by io_uring_setup()
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int uring_map(struct uring *ur, struct io_uring_params *p)
+{
+	ur->sq_sz = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	ur->cq_sz = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+
+	/* Both rings can share a single mapping */
+	if(p->features & IORING_FEAT_SINGLE_MMAP) {
+		if(ur->cq_sz > ur->sq_sz) {
+			ur->sq_sz = ur->cq_sz;
+		}
+		ur->cq_sz = ur->sq_sz;
+	}
+
+	ur->sq_ptr = mmap(NULL, ur->sq_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->ringfd, IORING_OFF_SQ_RING);
+	if(ur->sq_ptr == MAP_FAILED) {
+		ur->sq_ptr = NULL;
+		return -1;
+	}
+
+	if(p->features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ptr = ur->sq_ptr;
+	}
+	else {
+		ur->cq_ptr = mmap(NULL, ur->cq_sz, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ur->ringfd, IORING_OFF_CQ_RING);
+		if(ur->cq_ptr == MAP_FAILED) {
+			ur->cq_ptr = NULL;
+			return -1;
+		}
+	}
+
+	ur->sqes_sz = p->sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->ringfd, IORING_OFF_SQES);
+	if(ur->sqes == MAP_FAILED) {
+		ur->sqes = NULL;
+		return -1;
+	}
+
+	ur->sq_head = (unsigned *)((char *)ur->sq_ptr + p->sq_off.head);
+	ur->sq_tail = (unsigned *)((char *)ur->sq_ptr + p->sq_off.tail);
+	ur->sq_mask = (unsigned *)((char *)ur->sq_ptr + p->sq_off.ring_mask);
+	ur->sq_entries = (unsigned *)((char *)ur->sq_ptr + p->sq_off.ring_entries);
+	ur->sq_flags = (unsigned *)((char *)ur->sq_ptr + p->sq_off.flags);
+	ur->sq_array = (unsigned *)((char *)ur->sq_ptr + p->sq_off.array);
+	ur->sq_local_tail = *ur->sq_tail;
+
+	ur->cq_head = (unsigned *)((char *)ur->cq_ptr + p->cq_off.head);
+	ur->cq_tail = (unsigned *)((char *)ur->cq_ptr + p->cq_off.tail);
+	ur->cq_mask = (unsigned *)((char *)ur->cq_ptr + p->cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)((char *)ur->cq_ptr + p->cq_off.cqes);
+
+	return 0;
+}
+
+
+/*
+ * Register the send-buffers and the provided receive-buffers with the
+ * kernel. Registered buffers are pinned once, instead of being mapped for
+ * every single request.
+ *
+ * @io: The handle of the engine
+ * @ur: The private data of the engine
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int uring_register_buffers(struct rawio *io, struct uring *ur)
+{
+	struct io_uring_buf_reg reg;
+	struct iovec iov;
+	int i;
+
+	ur->txmem = mmap(NULL, URING_TX_SLOTS * DATAGRAM_LEN,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ur->rxmem = mmap(NULL, URING_RX_BUFS * RAWIO_RX_LEN,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ur->br = mmap(NULL, URING_RX_BUFS * sizeof(struct io_uring_buf),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(ur->txmem == MAP_FAILED || ur->rxmem == MAP_FAILED ||
+			ur->br == MAP_FAILED) {
+		return -1;
+	}
+
+	/* Place the memory before registering it faults the pages in */
+	rawio_mem_bind(io, ur->txmem, URING_TX_SLOTS * DATAGRAM_LEN);
+	rawio_mem_bind(io, ur->rxmem, URING_RX_BUFS * RAWIO_RX_LEN);
+	rawio_mem_bind(io, ur->br, URING_RX_BUFS * sizeof(struct io_uring_buf));
+
+	/* All send-slots are covered by a single registered buffer */
+	iov.iov_base = ur->txmem;
+	iov.iov_len = URING_TX_SLOTS * DATAGRAM_LEN;
+	if(sys_io_uring_register(ur->ringfd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+		return -1;
+	}
+
+	for(i = 0; i < URING_TX_SLOTS; i++) {
+		ur->txfree[i] = i;
+	}
+	ur->ntxfree = URING_TX_SLOTS;
+
+	/* Setup the ring of provided buffers */
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)ur->br;
+	reg.ring_entries = URING_RX_BUFS;
+	reg.bgid = URING_BGID;
+	if(sys_io_uring_register(ur->ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		return -1;
+	}
+
+	for(i = 0; i < URING_RX_BUFS; i++) {
+		uring_recycle(ur, i);
+	}
+
+	return 0;
+}
+
+
+static void uring_close(struct rawio *io)
+{
+	struct uring *ur = io->priv;
+
+	if(ur != NULL) {
+		if(ur->ringfd >= 0) close(ur->ringfd);
+		if(ur->sqes) munmap(ur->sqes, ur->sqes_sz);
+		if(ur->cq_ptr && ur->cq_ptr != ur->sq_ptr) munmap(ur->cq_ptr, ur->cq_sz);
+		if(ur->sq_ptr) munmap(ur->sq_ptr, ur->sq_sz);
+		if(ur->txmem && ur->txmem != MAP_FAILED)
+			munmap(ur->txmem, URING_TX_SLOTS * DATAGRAM_LEN);
+		if(ur->rxmem && ur->rxmem != MAP_FAILED)
+			munmap(ur->rxmem, URING_RX_BUFS * RAWIO_RX_LEN);
+		if(ur->br && (void *)ur->br != MAP_FAILED)
+			munmap(ur->br, URING_RX_BUFS * sizeof(struct io_uring_buf));
+		free(ur);
+	}
+	io->priv = NULL;
+
+	if(io->sockfd >= 0) {
+		close(io->sockfd);
+	}
+	io->sockfd = -1;
+}
+
+
+static int uring_open(struct rawio *io)
+{
+	struct io_uring_params p;
+	struct uring *ur;
+	int one = 1;
+
+	/* Create the raw socket, just like the default engine */
+	io->sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
+	if(io->sockfd < 0) {
+		perror("ERROR:");
+		return -1;
+	}
+
+	if(setsockopt(io->sockfd, IPPROTO_IP, IP_HDRINCL, &one, sizeof(one)) < 0) {
+		goto err_close;
+	}
+
+	if(rawio_busy_poll(io, io->sockfd) < 0) {
+		goto err_close;
+	}
+
+	/* Connect the socket, so datagrams can be written without an address */
+	if(connect(io->sockfd, (struct sockaddr *)&io->dst, sizeof(io->dst)) < 0) {
+		goto err_close;
+	}
+
+	if(!(ur = calloc(1, sizeof(struct uring)))) {
+		goto err_close;
+	}
+	io->priv = ur;
+	ur->ringfd = -1;
+	ur->multishot = 1;
+
+	memset(&p, 0, sizeof(p));
+	if(io->flags & RAWIO_F_SQPOLL) {
+		p.flags |= IORING_SETUP_SQPOLL;
+		p.sq_thread_idle = 2000;
+		ur->sqpoll = 1;
+	}
+
+	if((ur->ringfd = sys_io_uring_setup(URING_ENTRIES, &p)) < 0) {
+		goto err_close;
+	}
+
+	/* The ring becomes readable when completions are waiting */
+	io->rxfd = ur->ringfd;
+
+	/* Timeouts are passed using the extended arguments */
+	if(!(p.features & IORING_FEAT_EXT_ARG)) {
+		errno = ENOSYS;
+		goto err_close;
+	}
+
+	if(uring_map(ur, &p) < 0) {
+		goto err_close;
+	}
+
+	if(uring_register_buffers(io, ur) < 0) {
+		goto err_close;
+	}
+
+	/* Start receiving right away */
+	if(uring_arm_recv(io, ur) < 0 || uring_submit(ur, 0, NULL) < 0) {
+		goto err_close;
+	}
+
+	return 0;
+
+err_close:
+	perror("ERROR:");
+	uring_close(io);
+	return -1;
+}
+
+
+static int uring_send(struct rawio *io, char *pck, int pcklen)
+{
+	struct uring *ur = io->priv;
+	struct io_uring_sqe *sqe;
+	int slot;
+
+	if(pcklen > DATAGRAM_LEN) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	/* Wait for a previous send to finish, if all slots are in use */
+	while(ur->ntxfree == 0 || (sqe = uring_get_sqe(ur)) == NULL) {
+		if(uring_submit(ur, 1, NULL) < 0) {
+			return -1;
+		}
+		uring_reap(ur);
+	}
+
+	slot = ur->txfree[--ur->ntxfree];
+	memcpy(ur->txmem + slot * DATAGRAM_LEN, pck, pcklen);
+
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->fd = io->sockfd;
+	sqe->addr = (unsigned long)(ur->txmem + slot * DATAGRAM_LEN);
+	sqe->len = pcklen;
+	sqe->buf_index = 0;
+	sqe->user_data = URING_TAG_TX | slot;
+
+	return pcklen;
+}
+
+
+static int uring_flush(struct rawio *io)
+{
+	struct uring *ur = io->priv;
+
+	if(uring_submit(ur, 0, NULL) < 0) {
+		return -1;
+	}
+	uring_reap(ur);
+
+	return 0;
+}
+
+
+static int uring_recv(struct rawio *io, char *buf, int len, int timeout)
+{
+	struct uring *ur = io->priv;
+	struct __kernel_timespec ts;
+	struct uring_rxent *ent;
+	uint64_t start = 0;
+	int ret;
+
+	while(1) {
+		uring_reap(ur);
+
+		if(ur->error) {
+			errno = ur->error;
+			ur->error = 0;
+			return -1;
+		}
+
+		/* Pass the next received datagram to the caller */
+		if(ur->rxq_head != ur->rxq_tail) {
+			ent = &ur->rxq[ur->rxq_head++ & (URING_RX_BUFS - 1)];
+
+			ret = (ent->len < len) ? ent->len : len;
+			memcpy(buf, ur->rxmem + ent->bid * RAWIO_RX_LEN, ret);
+			uring_recycle(ur, ent->bid);
+
+			/* The raw socket only sees datagrams with a correct IP-header */
+			io->rxcsum = rawio_csum_raw(buf, ret);
+			return ret;
+		}
+
+		if(uring_arm_recv(io, ur) < 0) {
+			uring_submit(ur, 0, NULL);
+			continue;
+		}
+
+		if(ur->sqpoll) {
+			/* Spin on the completion-queue without any system-calls */
+			if(start == 0) {
+				start = get_timestamp();
+				uring_submit(ur, 0, NULL);
+			}
+
+			if(__atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE) != *ur->cq_head) {
+				continue;
+			}
+
+			if(timeout != RAWIO_WAIT &&
+					get_timestamp() - start >= (uint64_t)timeout * 1000) {
+				return 0;
+			}
+
+			if(get_timestamp() - start < URING_SPIN_USEC) {
+				continue;
+			}
+		}
+
+		/* Block until a completion arrives */
+		if(timeout != RAWIO_WAIT) {
+			uint64_t left = (uint64_t)timeout * 1000;
+
+			if(start != 0) {
+				left -= get_timestamp() - start;
+			}
+			ts.tv_sec = left / 1000000;
+			ts.tv_nsec = (left % 1000000) * 1000;
+		}
+
+		ret = uring_submit(ur, 1, (timeout != RAWIO_WAIT) ? &ts : NULL);
+		if(ret < 0) {
+			return -1;
+		}
+
+		if(ret == 1 && __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE) == *ur->cq_head) {
+			return 0;
+		}
+	}
+}
+
+
+const struct rawio_ops rawio_uring_ops = {
+	"uring",
+	uring_open,
+	uring_send,
+	uring_flush,
+	uring_recv,
+	uring_close,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
@@ -0,0 +1,94 @@
+#include "rawio.h"
+
+#include "vlink.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-= */
+/* ENGINE OF AN END OF A VIRTUAL LINK                           */
+
+static int vl_open(struct rawio *io)
+{
+	/* The engine needs the end of the link to attach to */
+	if(io->priv == NULL) {
+		errno = EINVAL;
+		perror("ERROR:");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int vl_send(struct rawio *io, char *pck, int pcklen)
+{
+	if(vlink_send(io->priv, pck, pcklen) < 0) {
+		return -1;
+	}
+
+	return pcklen;
+}
+
+
+static int vl_flush(struct rawio *io)
+{
+	if(io){/* The datagrams are on the link right away */}
+	return 0;
+}
+
+
+static int vl_recv_zc(struct rawio *io, char **pck, int timeout)
+{
+	/* The datagrams were built by ourselves, so the checksums are */
+	/* verified like those of any other engine */
+	return vlink_recv(io->priv, timeout, pck);
+}
+
+
+static void vl_release(struct rawio *io, char *pck)
+{
+	if(io){/* The datagrams don't belong to the handle */}
+	vlink_release(pck);
+}
+
+
+static int vl_recv(struct rawio *io, char *buf, int len, int timeout)
+{
+	char *pck;
+	int ret;
+
+	if((ret = vlink_recv(io->priv, timeout, &pck)) <= 0) {
+		return ret;
+	}
+
+	if(ret > len) {
+		ret = len;
+	}
+	memcpy(buf, pck, ret);
+	vlink_release(pck);
+	return ret;
+}
+
+
+static void vl_close(struct rawio *io)
+{
+	/* The link belongs to the caller */
+	io->priv = NULL;
+}
+
+
+const struct rawio_ops rawio_vlink_ops = {
+	"vlink",
+	vl_open,
+	vl_send,
+	vl_flush,
+	vl_recv,
+	vl_close,
+	NULL,
+	vl_recv_zc,
+	vl_release,
+	NULL,
+	NULL
+};
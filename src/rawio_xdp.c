@@ -0,0 +1,910 @@
+#include "rawio.h"
+
+#include "basic_utils.h"
+#include "packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+/* Every frame of the UMEM holds exactly one datagram */
+#define XSK_FRAME_SIZE DATAGRAM_LEN
+
+/* The number of frames in the UMEM, the first half is used for receiving */
+#define XSK_NUM_FRAMES 1024
+#define XSK_RX_FRAMES (XSK_NUM_FRAMES / 2)
+#define XSK_TX_FRAMES (XSK_NUM_FRAMES - XSK_RX_FRAMES)
+
+/* The number of descriptors in each ring (has to be a power of 2) */
+#define XSK_RING_SIZE 512
+
+/* The maximum number of connections redirected to the socket */
+#define XSK_MAX_FLOWS 65536
+
+/* The maximum number of queues of the network-interface */
+#define XSK_MAX_QUEUES 64
+
+/* The maximum number of instructions of the XDP-program */
+#define XSK_MAX_INSNS 64
+
+/*
+ * A ring shared with the kernel.
+ *
+ * @producer: The index of the next entry to be produced
+ * @consumer: The index of the next entry to be consumed
+ * @flags: The flags of the ring (XDP_RING_*)
+ * @ring: The entries of the ring
+ * @map: The start of the mapping
+ * @mapsz: The size of the mapping in bytes
+ */
+struct xsk_ring {
+	unsigned *producer;
+	unsigned *consumer;
+	unsigned *flags;
+	void *ring;
+	void *map;
+	size_t mapsz;
+};
+
+/*
+ * The key of the flow-table used by the XDP-program. All fields are
+ * stored in network-byte-order, just like they appear in the datagram.
+ */
+struct xsk_flow {
+	uint32_t saddr;
+	uint32_t daddr;
+	uint16_t sport;
+	uint16_t dport;
+};
+
+/*
+ * The private data of the AF_XDP-engine.
+ */
+struct xsk {
+	char *umem;
+	size_t umemsz;
+
+	struct xsk_ring fill;
+	struct xsk_ring comp;
+	struct xsk_ring rx;
+	struct xsk_ring tx;
+
+	/* The frames which can be used for sending */
+	uint64_t txfree[XSK_TX_FRAMES];
+	int ntxfree;
+	int tx_pending;
+
+	int ifindex;
+	unsigned char srcmac[ETH_ALEN];
+	unsigned char dstmac[ETH_ALEN];
+
+	/* The XDP-program and its maps */
+	int xsksfd;
+	int flowsfd;
+	int progfd;
+	int linkfd;
+};
+
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(union bpf_attr));
+}
+
+
+/* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-= */
+/* THE XDP-PROGRAM                                               */
+
+/*
+ * Append an instruction to the XDP-program.
+ */
+static void xsk_emit(struct bpf_insn *prog, int *n, int code, int dst,
+		int src, int off, int imm)
+{
+	struct bpf_insn *insn = &prog[(*n)++];
+
+	memset(insn, 0, sizeof(struct bpf_insn));
+	insn->code = code;
+	insn->dst_reg = dst;
+	insn->src_reg = src;
+	insn->off = off;
+	insn->imm = imm;
+}
+
+
+/*
+ * Load a map-descriptor into a register. This takes up two instructions.
+ */
+static void xsk_emit_map(struct bpf_insn *prog, int *n, int dst, int mapfd)
+{
+	xsk_emit(prog, n, BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, mapfd);
+	xsk_emit(prog, n, 0, 0, 0, 0, 0);
+}
+
+
+/*
+ * Create the maps and load the XDP-program. The program looks up the
+ * 4-tuple of every incoming TCP-segment in the flow-table and redirects
+ * the segments of our connections to the socket. Everything else is
+ * passed on to the network-stack of the kernel.
+ *
+ * @xs: The private data of the engine
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int xsk_load_prog(struct xsk *xs)
+{
+	struct bpf_insn prog[XSK_MAX_INSNS];
+	int pass[16];
+	int n = 0, npass = 0, i;
+	char log[4096];
+	union bpf_attr attr;
+
+	/* The socket for every queue of the interface */
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = XSK_MAX_QUEUES;
+	if((xs->xsksfd = sys_bpf(BPF_MAP_CREATE, &attr)) < 0) {
+		return -1;
+	}
+
+	/* The 4-tuples of our connections */
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_HASH;
+	attr.key_size = sizeof(struct xsk_flow);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = XSK_MAX_FLOWS;
+	if((xs->flowsfd = sys_bpf(BPF_MAP_CREATE, &attr)) < 0) {
+		return -1;
+	}
+
+	/* r6 = ctx, r2 = data, r3 = data_end */
+	xsk_emit(prog, &n, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0);
+	xsk_emit(prog, &n, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, 0, 0);
+	xsk_emit(prog, &n, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_6, 4, 0);
+
+	/* Both headers up to the ports have to be in the frame */
+	xsk_emit(prog, &n, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0);
+	xsk_emit(prog, &n, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0,
+			ETH_HLEN + sizeof(struct iphdr) + 4);
+	pass[npass++] = n;
+	xsk_emit(prog, &n, BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, 0);
+
+	/* Only IPv4 without options carrying TCP */
+	xsk_emit(prog, &n, BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 12, 0);
+	pass[npass++] = n;
+	xsk_emit(prog, &n, BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, htons(ETH_P_IP));
+	xsk_emit(prog, &n, BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, ETH_HLEN, 0);
+	pass[npass++] = n;
+	xsk_emit(prog, &n, BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, 0x45);
+	xsk_emit(prog, &n, BPF_LDX | BPF_MEM | BPF_B, BPF_REG_5, BPF_REG_2, ETH_HLEN + 9, 0);
+	pass[npass++] = n;
+	xsk_emit(prog, &n, BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, IPPROTO_TCP);
+
+	/* Copy the 4-tuple onto the stack */
+	xsk_emit(prog, &n, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_5, BPF_REG_2, ETH_HLEN + 12, 0);
+	xsk_emit(prog, &n, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_5, -16, 0);
+	xsk_emit(prog, &n, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_5, BPF_REG_2, ETH_HLEN + 16, 0);
+	xsk_emit(prog, &n, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_5, -12, 0);
+	xsk_emit(prog, &n, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_5, BPF_REG_2, ETH_HLEN + 20, 0);
+	xsk_emit(prog, &n, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_5, -8, 0);
+
+	/* Look up the 4-tuple in the flow-table */
+	xsk_emit_map(prog, &n, BPF_REG_1, xs->flowsfd);
+	xsk_emit(prog, &n, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0);
+	xsk_emit(prog, &n, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -16);
+	xsk_emit(prog, &n, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem);
+	pass[npass++] = n;
+	xsk_emit(prog, &n, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 0, 0);
+
+	/* Redirect to the socket of the receiving queue */
+	xsk_emit_map(prog, &n, BPF_REG_1, xs->xsksfd);
+	xsk_emit(prog, &n, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, 16, 0);
+	xsk_emit(prog, &n, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS);
+	xsk_emit(prog, &n, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+	xsk_emit(prog, &n, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	/* Pass everything else to the kernel */
+	for(i = 0; i < npass; i++) {
+		prog[pass[i]].off = n - pass[i] - 1;
+	}
+	xsk_emit(prog, &n, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS);
+	xsk_emit(prog, &n, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insn_cnt = n;
+	attr.insns = (unsigned long)prog;
+	attr.license = (unsigned long)"GPL";
+	attr.log_level = 1;
+	attr.log_size = sizeof(log);
+	attr.log_buf = (unsigned long)log;
+	log[0] = '\0';
+	if((xs->progfd = sys_bpf(BPF_PROG_LOAD, &attr)) < 0) {
+		fprintf(stderr, "%s", log);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Attach the XDP-program to the interface and register the socket for its
+ * queue. The program is detached again, once the link is closed.
+ *
+ * @io: The handle of the engine
+ * @xs: The private data of the engine
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int xsk_attach_prog(struct rawio *io, struct xsk *xs)
+{
+	union bpf_attr attr;
+	uint32_t key = io->queue;
+	uint32_t val = io->sockfd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = xs->xsksfd;
+	attr.key = (unsigned long)&key;
+	attr.value = (unsigned long)&val;
+	if(sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+		return -1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = xs->progfd;
+	attr.link_create.target_ifindex = xs->ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	if((xs->linkfd = sys_bpf(BPF_LINK_CREATE, &attr)) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-= */
+/* ADDRESS-RESOLUTION                                            */
+
+/*
+ * Find the next hop for a destination in the routing-table of the kernel.
+ *
+ * @ifname: The interface used to reach the destination
+ * @dst: The destination-IP-address
+ *
+ * Returns: The IP-address of the next hop
+ */
+static uint32_t xsk_next_hop(const char *ifname, uint32_t dst)
+{
+	FILE *fp;
+	char line[256], iface[IF_NAMESIZE + 1];
+	unsigned int net, gw, flags, mask;
+	unsigned int best_mask = 0;
+	uint32_t hop = dst;
+	int found = 0;
+
+	if(!(fp = fopen("/proc/net/route", "r"))) {
+		return dst;
+	}
+
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, "%16s %x %x %x %*d %*d %*d %x", iface, &net, &gw,
+					&flags, &mask) != 5) {
+			continue;
+		}
+
+		if(strcmp(iface, ifname) != 0 || (dst & mask) != net) {
+			continue;
+		}
+
+		/* Use the most specific route */
+		if(!found || ntohl(mask) > ntohl(best_mask)) {
+			best_mask = mask;
+			hop = (gw != 0) ? gw : dst;
+			found = 1;
+		}
+	}
+
+	fclose(fp);
+	return hop;
+}
+
+
+/*
+ * Look up the MAC-address of a neighbour in the ARP-cache of the kernel.
+ *
+ * @ifname: The interface the neighbour is connected to
+ * @ip: The IP-address of the neighbour
+ * @mac: A buffer to write the MAC-address to
+ *
+ * Returns: 0 if the address was found and -1 if not
+ */
+static int xsk_arp_lookup(const char *ifname, uint32_t ip, unsigned char *mac)
+{
+	FILE *fp;
+	char line[256], ipstr[INET_ADDRSTRLEN], dev[IF_NAMESIZE + 1];
+	unsigned int hw[ETH_ALEN], flags;
+	struct in_addr addr;
+	int i, ret = -1;
+
+	if(!(fp = fopen("/proc/net/arp", "r"))) {
+		return -1;
+	}
+
+	addr.s_addr = ip;
+	inet_ntop(AF_INET, &addr, ipstr, sizeof(ipstr));
+
+	while(fgets(line, sizeof(line), fp)) {
+		char entry[INET_ADDRSTRLEN + 1];
+
+		if(sscanf(line, "%16s %*x %x %x:%x:%x:%x:%x:%x %*s %16s", entry,
+					&flags, &hw[0], &hw[1], &hw[2], &hw[3], &hw[4], &hw[5],
+					dev) != 9) {
+			continue;
+		}
+
+		/* Skip incomplete entries */
+		if(strcmp(entry, ipstr) != 0 || strcmp(dev, ifname) != 0 || flags == 0) {
+			continue;
+		}
+
+		for(i = 0; i < ETH_ALEN; i++) {
+			mac[i] = hw[i];
+		}
+		ret = 0;
+		break;
+	}
+
+	fclose(fp);
+	return ret;
+}
+
+
+/*
+ * Get the MAC-addresses needed to build the Ethernet-header. If the next
+ * hop isn't in the ARP-cache yet, a UDP-datagram is sent to it, to make
+ * the kernel resolve the address.
+ *
+ * @io: The handle of the engine
+ * @xs: The private data of the engine
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int xsk_resolve(struct rawio *io, struct xsk *xs)
+{
+	struct ifreq ifr;
+	struct sockaddr_in probe;
+	uint32_t hop;
+	int fd, tries;
+
+	if((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		return -1;
+	}
+
+	/* The address of the local interface */
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", io->ifname);
+	if(ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+		close(fd);
+		return -1;
+	}
+	memcpy(xs->srcmac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+	/* The address of the next hop */
+	hop = xsk_next_hop(io->ifname, io->dst.sin_addr.s_addr);
+	memset(&probe, 0, sizeof(probe));
+	probe.sin_family = AF_INET;
+	probe.sin_port = htons(9);
+	probe.sin_addr.s_addr = hop;
+
+	for(tries = 0; tries < 10; tries++) {
+		if(xsk_arp_lookup(io->ifname, hop, xs->dstmac) == 0) {
+			close(fd);
+			return 0;
+		}
+
+		sendto(fd, "", 0, 0, (struct sockaddr *)&probe, sizeof(probe));
+		usleep(100000);
+	}
+
+	close(fd);
+	fprintf(stderr, "Failed to resolve the MAC-address of the next hop.\n");
+	errno = EHOSTUNREACH;
+	return -1;
+}
+
+
+/* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-= */
+/* THE UMEM AND ITS RINGS                                        */
+
+/*
+ * Map a ring of the socket into memory.
+ *
+ * @fd: The AF_XDP-socket
+ * @ring: The ring to initialize
+ * @off: The offsets of the ring
+ * @entsz: The size of a single entry
+ * @pgoff: The page-offset identifying the ring
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int xsk_map_ring(int fd, struct xsk_ring *ring,
+		struct xdp_ring_offset *off, size_t entsz, off_t pgoff)
+{
+	ring->mapsz = off->desc + XSK_RING_SIZE * entsz;
+	ring->map = mmap(NULL, ring->mapsz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if(ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		return -1;
+	}
+
+	ring->producer = (unsigned *)((char *)ring->map + off->producer);
+	ring->consumer = (unsigned *)((char *)ring->map + off->consumer);
+	ring->flags = (unsigned *)((char *)ring->map + off->flags);
+	ring->ring = (char *)ring->map + off->desc;
+
+	return 0;
+}
+
+
+/*
+ * Hand a frame to the kernel to receive the next datagram into.
+ *
+ * @xs: The private data of the engine
+ * @addr: The offset of the frame in the UMEM
+ */
+static void xsk_fill(struct xsk *xs, uint64_t addr)
+{
+	unsigned prod = *xs->fill.producer;
+
+	((uint64_t *)xs->fill.ring)[prod & (XSK_RING_SIZE - 1)] = addr;
+	__atomic_store_n(xs->fill.producer, prod + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Collect the frames of all datagrams the kernel finished sending.
+ *
+ * @xs: The private data of the engine
+ */
+static void xsk_reclaim(struct xsk *xs)
+{
+	unsigned cons, prod;
+
+	cons = *xs->comp.consumer;
+	prod = __atomic_load_n(xs->comp.producer, __ATOMIC_ACQUIRE);
+
+	for(; cons != prod; cons++) {
+		xs->txfree[xs->ntxfree++] =
+			((uint64_t *)xs->comp.ring)[cons & (XSK_RING_SIZE - 1)];
+	}
+
+	__atomic_store_n(xs->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Tell the kernel to process the send-ring. Thanks to the wakeup-flag this
+ * is only necessary, if the kernel isn't already working on it.
+ *
+ * @io: The handle of the engine
+ * @xs: The private data of the engine
+ */
+static void xsk_kick(struct rawio *io, struct xsk *xs)
+{
+	if(!(__atomic_load_n(xs->tx.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)) {
+		return;
+	}
+
+	if(sendto(io->sockfd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0) {
+		if(errno != EAGAIN && errno != EBUSY && errno != ENOBUFS &&
+				errno != ENETDOWN) {
+			perror("ERROR:");
+		}
+	}
+}
+
+
+/*
+ * Get the key of a connection in the flow-map of the XDP-program.
+ *
+ * @src: The local address of the connection
+ * @dst: The remote address of the connection
+ * @key: An address to write the key to
+ */
+static void xsk_flow_key(struct sockaddr_in *src, struct sockaddr_in *dst,
+		struct xsk_flow *key)
+{
+	/* The 4-tuple as it appears in incoming datagrams */
+	memset(key, 0, sizeof(struct xsk_flow));
+	key->saddr = dst->sin_addr.s_addr;
+	key->daddr = src->sin_addr.s_addr;
+	key->sport = dst->sin_port;
+	key->dport = src->sin_port;
+}
+
+
+static int xsk_add_flow(struct rawio *io, struct sockaddr_in *src,
+		struct sockaddr_in *dst)
+{
+	struct xsk *xs = io->priv;
+	struct xsk_flow key;
+	union bpf_attr attr;
+	uint32_t val = 1;
+
+	xsk_flow_key(src, dst, &key);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = xs->flowsfd;
+	attr.key = (unsigned long)&key;
+	attr.value = (unsigned long)&val;
+	attr.flags = BPF_ANY;
+
+	return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+
+static int xsk_del_flow(struct rawio *io, struct sockaddr_in *src,
+		struct sockaddr_in *dst)
+{
+	struct xsk *xs = io->priv;
+	struct xsk_flow key;
+	union bpf_attr attr;
+
+	xsk_flow_key(src, dst, &key);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = xs->flowsfd;
+	attr.key = (unsigned long)&key;
+
+	return sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+
+static void xsk_close(struct rawio *io)
+{
+	struct xsk *xs = io->priv;
+
+	if(xs != NULL) {
+		/* Closing the link detaches the program from the interface */
+		if(xs->linkfd >= 0) close(xs->linkfd);
+		if(xs->progfd >= 0) close(xs->progfd);
+		if(xs->flowsfd >= 0) close(xs->flowsfd);
+		if(xs->xsksfd >= 0) close(xs->xsksfd);
+		if(xs->fill.map) munmap(xs->fill.map, xs->fill.mapsz);
+		if(xs->comp.map) munmap(xs->comp.map, xs->comp.mapsz);
+		if(xs->rx.map) munmap(xs->rx.map, xs->rx.mapsz);
+		if(xs->tx.map) munmap(xs->tx.map, xs->tx.mapsz);
+		if(xs->umem) munmap(xs->umem, xs->umemsz);
+		free(xs);
+	}
+	io->priv = NULL;
+
+	if(io->sockfd >= 0) {
+		close(io->sockfd);
+	}
+	io->sockfd = -1;
+}
+
+
+static int xsk_open(struct rawio *io)
+{
+	struct xsk *xs;
+	struct xdp_umem_reg reg;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	struct xdp_options opts;
+	socklen_t optlen;
+	int ringsz = XSK_RING_SIZE;
+	int i;
+
+	if(io->ifname[0] == '\0') {
+		fprintf(stderr, "The xdp-engine requires an interface (-i).\n");
+		return -1;
+	}
+
+	if(!(xs = calloc(1, sizeof(struct xsk)))) {
+		return -1;
+	}
+	io->priv = xs;
+	xs->xsksfd = xs->flowsfd = xs->progfd = xs->linkfd = -1;
+
+	if(!(xs->ifindex = if_nametoindex(io->ifname))) {
+		goto err_close;
+	}
+
+	if(xsk_resolve(io, xs) < 0) {
+		goto err_close;
+	}
+
+	if((io->sockfd = socket(AF_XDP, SOCK_RAW, 0)) < 0) {
+		goto err_close;
+	}
+	io->rxfd = io->sockfd;
+
+	/* Polling the socket then drives the queue of the device directly */
+	if(rawio_busy_poll(io, io->sockfd) < 0) {
+		goto err_close;
+	}
+
+	/* Register the packet-memory shared with the kernel */
+	xs->umemsz = XSK_NUM_FRAMES * XSK_FRAME_SIZE;
+	xs->umem = mmap(NULL, xs->umemsz, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(xs->umem == MAP_FAILED) {
+		xs->umem = NULL;
+		goto err_close;
+	}
+	rawio_mem_bind(io, xs->umem, xs->umemsz);
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (unsigned long)xs->umem;
+	reg.len = xs->umemsz;
+	reg.chunk_size = XSK_FRAME_SIZE;
+	if(setsockopt(io->sockfd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+		goto err_close;
+	}
+
+	/* Create the four rings and map them */
+	if(setsockopt(io->sockfd, SOL_XDP, XDP_UMEM_FILL_RING, &ringsz, sizeof(ringsz)) < 0 ||
+			setsockopt(io->sockfd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ringsz, sizeof(ringsz)) < 0 ||
+			setsockopt(io->sockfd, SOL_XDP, XDP_RX_RING, &ringsz, sizeof(ringsz)) < 0 ||
+			setsockopt(io->sockfd, SOL_XDP, XDP_TX_RING, &ringsz, sizeof(ringsz)) < 0) {
+		goto err_close;
+	}
+
+	optlen = sizeof(off);
+	if(getsockopt(io->sockfd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+		goto err_close;
+	}
+
+	if(xsk_map_ring(io->sockfd, &xs->fill, &off.fr, sizeof(uint64_t),
+				XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+			xsk_map_ring(io->sockfd, &xs->comp, &off.cr, sizeof(uint64_t),
+				XDP_UMEM_PGOFF_COMPLETION_RING) < 0 ||
+			xsk_map_ring(io->sockfd, &xs->rx, &off.rx, sizeof(struct xdp_desc),
+				XDP_PGOFF_RX_RING) < 0 ||
+			xsk_map_ring(io->sockfd, &xs->tx, &off.tx, sizeof(struct xdp_desc),
+				XDP_PGOFF_TX_RING) < 0) {
+		goto err_close;
+	}
+
+	/* The first half of the frames is used for receiving */
+	for(i = 0; i < XSK_RX_FRAMES; i++) {
+		xsk_fill(xs, (uint64_t)i * XSK_FRAME_SIZE);
+	}
+	for(i = 0; i < XSK_TX_FRAMES; i++) {
+		xs->txfree[i] = (uint64_t)(XSK_RX_FRAMES + i) * XSK_FRAME_SIZE;
+	}
+	xs->ntxfree = XSK_TX_FRAMES;
+
+	/* Bind the socket to the queue of the interface */
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = xs->ifindex;
+	sxdp.sxdp_queue_id = io->queue;
+	sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+	if(io->flags & RAWIO_F_ZEROCOPY) {
+		sxdp.sxdp_flags |= XDP_ZEROCOPY;
+	}
+	if(bind(io->sockfd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+		goto err_close;
+	}
+
+	optlen = sizeof(opts);
+	if(getsockopt(io->sockfd, SOL_XDP, XDP_OPTIONS, &opts, &optlen) == 0) {
+		printf("(%s-mode) ", (opts.flags & XDP_OPTIONS_ZEROCOPY) ?
+				"zero-copy" : "copy");
+	}
+
+	/* Redirect our connection to the socket */
+	if(xsk_load_prog(xs) < 0 || xsk_add_flow(io, &io->src, &io->dst) < 0 ||
+			xsk_attach_prog(io, xs) < 0) {
+		goto err_close;
+	}
+
+	return 0;
+
+err_close:
+	perror("ERROR:");
+	xsk_close(io);
+	return -1;
+}
+
+
+static char *xsk_alloc(struct rawio *io)
+{
+	struct xsk *xs = io->priv;
+	int tries;
+
+	/* Wait for the kernel to finish sending previous datagrams */
+	for(tries = 0; xs->ntxfree == 0 && tries < 1000; tries++) {
+		xsk_kick(io, xs);
+		xsk_reclaim(xs);
+	}
+
+	if(xs->ntxfree == 0) {
+		errno = ENOBUFS;
+		return NULL;
+	}
+
+	/* Leave room for the Ethernet-header in front of the datagram */
+	return xs->umem + xs->txfree[--xs->ntxfree] + ETH_HLEN;
+}
+
+
+static int xsk_flush(struct rawio *io)
+{
+	struct xsk *xs = io->priv;
+
+	if(xs->tx_pending > 0) {
+		xsk_kick(io, xs);
+		xs->tx_pending = 0;
+	}
+	xsk_reclaim(xs);
+
+	return 0;
+}
+
+
+static int xsk_send(struct rawio *io, char *pck, int pcklen)
+{
+	struct xsk *xs = io->priv;
+	struct xdp_desc *desc;
+	struct ethhdr *eth;
+	unsigned prod, cons;
+	uint64_t addr;
+	char *frame;
+
+	if(pcklen + ETH_HLEN > XSK_FRAME_SIZE) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	/* Datagrams built outside of the UMEM have to be copied into a frame */
+	if(pck < xs->umem || pck >= xs->umem + xs->umemsz) {
+		char *buf;
+
+		if(!(buf = xsk_alloc(io))) {
+			return -1;
+		}
+		memcpy(buf, pck, pcklen);
+		pck = buf;
+	}
+
+	frame = pck - ETH_HLEN;
+	addr = frame - xs->umem;
+
+	/* Put the Ethernet-header in front of the datagram */
+	eth = (struct ethhdr *)frame;
+	memcpy(eth->h_dest, xs->dstmac, ETH_ALEN);
+	memcpy(eth->h_source, xs->srcmac, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_IP);
+
+	/* Wait for a free descriptor in the send-ring */
+	prod = *xs->tx.producer;
+	while(1) {
+		cons = __atomic_load_n(xs->tx.consumer, __ATOMIC_ACQUIRE);
+		if(prod - cons < XSK_RING_SIZE) {
+			break;
+		}
+		xsk_kick(io, xs);
+		xsk_reclaim(xs);
+	}
+
+	desc = &((struct xdp_desc *)xs->tx.ring)[prod & (XSK_RING_SIZE - 1)];
+	desc->addr = addr;
+	desc->len = pcklen + ETH_HLEN;
+	desc->options = 0;
+	__atomic_store_n(xs->tx.producer, prod + 1, __ATOMIC_RELEASE);
+	xs->tx_pending++;
+
+	return pcklen;
+}
+
+
+static void xsk_release(struct rawio *io, char *pck)
+{
+	struct xsk *xs = io->priv;
+	uint64_t addr = pck - xs->umem;
+
+	/* Give the whole frame back to the kernel */
+	xsk_fill(xs, addr - (addr % XSK_FRAME_SIZE));
+}
+
+
+static int xsk_recv_zc(struct rawio *io, char **pck, int timeout)
+{
+	struct xsk *xs = io->priv;
+	struct xdp_desc desc;
+	struct pollfd pfd;
+	struct ethhdr *eth;
+	unsigned cons, prod;
+	int ret;
+
+	while(1) {
+		cons = *xs->rx.consumer;
+		prod = __atomic_load_n(xs->rx.producer, __ATOMIC_ACQUIRE);
+
+		if(cons != prod) {
+			desc = ((struct xdp_desc *)xs->rx.ring)[cons & (XSK_RING_SIZE - 1)];
+			__atomic_store_n(xs->rx.consumer, cons + 1, __ATOMIC_RELEASE);
+
+			/* Skip the Ethernet-header and drop everything but IPv4 */
+			eth = (struct ethhdr *)(xs->umem + desc.addr);
+			if(desc.len <= ETH_HLEN || eth->h_proto != htons(ETH_P_IP)) {
+				xsk_fill(xs, desc.addr - (desc.addr % XSK_FRAME_SIZE));
+				continue;
+			}
+
+			*pck = (char *)eth + ETH_HLEN;
+			return desc.len - ETH_HLEN;
+		}
+
+		/* Wait for the kernel to fill the receive-ring */
+		pfd.fd = io->sockfd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		do {
+			ret = poll(&pfd, 1, timeout);
+		} while(ret < 0 && errno == EINTR);
+
+		if(ret <= 0) {
+			return ret;
+		}
+	}
+}
+
+
+static int xsk_recv(struct rawio *io, char *buf, int len, int timeout)
+{
+	char *pck;
+	int ret;
+
+	if((ret = xsk_recv_zc(io, &pck, timeout)) <= 0) {
+		return ret;
+	}
+
+	if(ret > len) {
+		ret = len;
+	}
+	memcpy(buf, pck, ret);
+	xsk_release(io, pck);
+
+	return ret;
+}
+
+
+const struct rawio_ops rawio_xdp_ops = {
+	"xdp",
+	xsk_open,
+	xsk_send,
+	xsk_flush,
+	xsk_recv,
+	xsk_close,
+	xsk_alloc,
+	xsk_recv_zc,
+	xsk_release,
+	xsk_add_flow,
+	xsk_del_flow
+};
@@ -0,0 +1,262 @@
+#include "ring.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+
+int ring_init(struct ring *r, unsigned size, int multi,
+		struct ring_waiter *waiter)
+{
+	unsigned n = 1;
+	unsigned i;
+
+	while(n < size) {
+		n <<= 1;
+	}
+
+	memset(r, 0, sizeof(struct ring));
+	if(!(r->slots = calloc(n, sizeof(struct ring_slot)))) {
+		return -1;
+	}
+	r->mask = n - 1;
+	r->multi = multi;
+	r->waiter = waiter;
+
+	/* Every slot is free for the first round of positions */
+	for(i = 0; i < n; i++) {
+		r->slots[i].seq = i;
+	}
+
+	return 0;
+}
+
+
+void ring_free(struct ring *r)
+{
+	free(r->slots);
+	r->slots = NULL;
+}
+
+
+/*
+ * Add an entry with a single producer.
+ */
+static int ring_enqueue_sp(struct ring *r, void *val)
+{
+	unsigned head = r->head;
+
+	/* Only look at the consumer, if the ring seems to be full */
+	if(head - r->tail_cache > r->mask) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if(head - r->tail_cache > r->mask) {
+			return -1;
+		}
+	}
+
+	r->slots[head & r->mask].val = val;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+
+/*
+ * Add an entry with multiple producers.
+ */
+static int ring_enqueue_mp(struct ring *r, void *val)
+{
+	struct ring_slot *slot;
+	unsigned pos, seq;
+
+	pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	while(1) {
+		slot = &r->slots[pos & r->mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+		/* The slot is free, try to reserve the position */
+		if(seq == pos) {
+			if(__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		}
+		/* The consumer didn't take the entry of the last round yet */
+		else if((int)(seq - pos) < 0) {
+			return -1;
+		}
+		/* Another producer was faster */
+		else {
+			pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->val = val;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+
+int ring_enqueue(struct ring *r, void *val)
+{
+	int ret;
+
+	ret = r->multi ? ring_enqueue_mp(r, val) : ring_enqueue_sp(r, val);
+
+	/* Pairs with the fence in ring_wait(), so either the consumer sees */
+	/* the entry, or we see that it sleeps */
+	if(ret == 0 && r->waiter != NULL) {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&r->waiter->sleeping, __ATOMIC_RELAXED)) {
+			ring_wake(r->waiter);
+		}
+	}
+
+	return ret;
+}
+
+
+int ring_dequeue_burst(struct ring *r, void **vals, int n)
+{
+	struct ring_slot *slot;
+	unsigned tail = r->tail;
+	unsigned avail;
+	int i;
+
+	if(r->multi) {
+		for(i = 0; i < n; i++) {
+			slot = &r->slots[(tail + i) & r->mask];
+			if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + i + 1) {
+				break;
+			}
+			vals[i] = slot->val;
+
+			/* Hand the slot to the producers of the next round */
+			__atomic_store_n(&slot->seq, tail + i + r->mask + 1, __ATOMIC_RELEASE);
+		}
+
+		__atomic_store_n(&r->tail, tail + i, __ATOMIC_RELEASE);
+		return i;
+	}
+
+	/* Only look at the producer, if the ring seems to be empty */
+	avail = r->head_cache - tail;
+	if(avail == 0) {
+		r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if((avail = r->head_cache - tail) == 0) {
+			return 0;
+		}
+	}
+
+	if((unsigned)n > avail) {
+		n = avail;
+	}
+
+	for(i = 0; i < n; i++) {
+		vals[i] = r->slots[(tail + i) & r->mask].val;
+	}
+
+	__atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+
+int ring_empty(struct ring *r)
+{
+	if(r->multi) {
+		return __atomic_load_n(&r->slots[r->tail & r->mask].seq,
+				__ATOMIC_ACQUIRE) != r->tail + 1;
+	}
+
+	if(r->head_cache != r->tail) {
+		return 0;
+	}
+
+	r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	return r->head_cache == r->tail;
+}
+
+
+unsigned ring_count(struct ring *r)
+{
+	unsigned tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;
+}
+
+
+int ring_waiter_init(struct ring_waiter *w)
+{
+	memset(w, 0, sizeof(struct ring_waiter));
+	if((w->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void ring_waiter_free(struct ring_waiter *w)
+{
+	if(w->fd >= 0) {
+		close(w->fd);
+	}
+	w->fd = -1;
+}
+
+
+void ring_wake(struct ring_waiter *w)
+{
+	uint64_t one = 1;
+
+	if(write(w->fd, &one, sizeof(one)) < 0) {
+		/* The counter is already set, so the thread wakes up anyway */
+	}
+}
+
+
+int ring_wait(struct ring_waiter *w, struct ring **rings, int n, int fd,
+		int timeout)
+{
+	struct pollfd pfd[2];
+	uint64_t cnt;
+	int i, ret;
+
+	/* Announce the sleep before the last look at the rings */
+	__atomic_store_n(&w->sleeping, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for(i = 0; i < n; i++) {
+		if(!ring_empty(rings[i])) {
+			__atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
+
+	pfd[0].fd = w->fd;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	pfd[1].fd = fd;
+	pfd[1].events = POLLIN;
+	pfd[1].revents = 0;
+
+	do {
+		ret = poll(pfd, (fd >= 0) ? 2 : 1, timeout);
+	} while(ret < 0 && errno == EINTR);
+
+	__atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+
+	if(ret < 0) {
+		return -1;
+	}
+
+	/* Reset the counter, so the next sleep isn't cut short */
+	if(pfd[0].revents & POLLIN && read(w->fd, &cnt, sizeof(cnt)) < 0 &&
+			errno != EAGAIN) {
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+#ifndef _RING_H
+#define _RING_H
+
+#include <stdint.h>
+
+/* The size of a cache-line, the parts written by different threads are */
+/* kept this far apart */
+#define RING_CACHELINE 64
+
+/* The maximum number of entries taken out of a ring at once */
+#define RING_BURST 32
+
+/*
+ * A thread taking entries out of one or more rings, which sleeps on an
+ * eventfd while all of them are empty. Producers only write to the
+ * eventfd, if the thread announced that it is going to sleep, so a busy
+ * thread is never woken up with a system-call.
+ *
+ * @fd: The eventfd the thread sleeps on
+ * @sleeping: The thread is about to sleep or sleeping
+ */
+struct ring_waiter {
+	int fd;
+	int sleeping;
+} __attribute__((aligned(RING_CACHELINE)));
+
+/*
+ * A slot of a ring. The sequence-number is only used by rings with
+ * multiple producers, and tells whether the slot is free for the
+ * producer, or filled for the consumer, at a given position.
+ *
+ * @seq: The position the slot is ready for
+ * @val: The entry
+ */
+struct ring_slot {
+	unsigned seq;
+	void *val;
+};
+
+/*
+ * A bounded lock-free queue of pointers with a single consumer. With a
+ * single producer (SPSC), both ends only publish their position with a
+ * release-store and keep a cached copy of the other end, so the
+ * cache-line of the other side is only read when the ring seems full or
+ * empty. With multiple producers (MPSC), a producer reserves a position
+ * with a compare-and-swap and marks the slot as filled afterwards, so the
+ * consumer never sees a slot still being written.
+ *
+ * The positions of the producers and of the consumer live on their own
+ * cache-lines, so the threads don't take the lines from each other on
+ * every operation.
+ *
+ * @head: The next position written by the producers
+ * @tail_cache: The last known position of the consumer (SPSC only)
+ * @tail: The next position read by the consumer
+ * @head_cache: The last known position of the producer (SPSC only)
+ * @slots: The slots
+ * @mask: The number of slots minus one
+ * @multi: There are multiple producers
+ * @waiter: The consumer to wake up, or NULL if it never sleeps
+ */
+struct ring {
+	unsigned head;
+	unsigned tail_cache;
+	char pad0[RING_CACHELINE - 2 * sizeof(unsigned)];
+
+	unsigned tail;
+	unsigned head_cache;
+	char pad1[RING_CACHELINE - 2 * sizeof(unsigned)];
+
+	struct ring_slot *slots;
+	unsigned mask;
+	int multi;
+	struct ring_waiter *waiter;
+} __attribute__((aligned(RING_CACHELINE)));
+
+
+/*
+ * Initialize a ring.
+ *
+ * @r: The ring to initialize
+ * @size: The number of slots, rounded up to a power of two
+ * @multi: Allow multiple producers
+ * @waiter: The consumer to wake up, or NULL if it never sleeps
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int ring_init(struct ring *r, unsigned size, int multi,
+		struct ring_waiter *waiter);
+
+
+/*
+ * Free the slots of a ring. The entries are not touched.
+ *
+ * @r: The ring
+ */
+void ring_free(struct ring *r);
+
+
+/*
+ * Add an entry to a ring and wake up the consumer, if it sleeps.
+ *
+ * @r: The ring
+ * @val: The entry
+ *
+ * Returns: 0 on success and -1 if the ring is full
+ */
+int ring_enqueue(struct ring *r, void *val);
+
+
+/*
+ * Take up to n entries out of a ring at once. Only the consumer may call
+ * this.
+ *
+ * @r: The ring
+ * @vals: An array for the entries
+ * @n: The maximum number of entries to take
+ *
+ * Returns: The number of entries taken
+ */
+int ring_dequeue_burst(struct ring *r, void **vals, int n);
+
+
+/*
+ * Check if a ring is empty. Only the consumer may call this.
+ *
+ * @r: The ring
+ *
+ * Returns: 1 if the ring is empty and 0 if not
+ */
+int ring_empty(struct ring *r);
+
+
+/*
+ * Get the number of entries in a ring. Any thread may call this, but the
+ * number is only a snapshot.
+ *
+ * @r: The ring
+ *
+ * Returns: The number of entries, including those still being added
+ */
+unsigned ring_count(struct ring *r);
+
+
+/*
+ * Initialize a waiter with a new eventfd.
+ *
+ * @w: The waiter to initialize
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int ring_waiter_init(struct ring_waiter *w);
+
+
+/*
+ * Close the eventfd of a waiter.
+ *
+ * @w: The waiter
+ */
+void ring_waiter_free(struct ring_waiter *w);
+
+
+/*
+ * Wake up the thread of a waiter, no matter if it sleeps.
+ *
+ * @w: The waiter
+ */
+void ring_wake(struct ring_waiter *w);
+
+
+/*
+ * Sleep until one of the rings of a waiter gets an entry, another
+ * descriptor becomes readable, or the time is up. Returns at once, if
+ * one of the rings already has entries.
+ *
+ * @w: The waiter
+ * @rings: The rings consumed by the thread
+ * @n: The number of rings
+ * @fd: Another descriptor to wait for, or -1
+ * @timeout: The maximum time to sleep in milliseconds, or -1 to sleep
+ *           until woken
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int ring_wait(struct ring_waiter *w, struct ring **rings, int n, int fd,
+		int timeout);
+
+#endif /* _RING_H */
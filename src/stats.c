@@ -0,0 +1,220 @@
+#include "stats.h"
+
+#include "rawio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*
+ * Change a record guarded by a sequence-lock. The sequence is odd while
+ * the record is changed.
+ *
+ * @seq: The sequence of the record
+ * @dst: The record
+ * @src: The new content
+ * @len: The size of the record
+ */
+static void stats_write(uint32_t *seq, void *dst, void *src, size_t len)
+{
+	uint32_t s = *seq;
+
+	__atomic_store_n(seq, s + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(dst, src, len);
+	__atomic_store_n(seq, s + 2, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Copy a record guarded by a sequence-lock, retrying while the writer
+ * changes it.
+ *
+ * @seq: The sequence of the record
+ * @dst: An address to copy the record to
+ * @src: The record
+ * @len: The size of the record
+ *
+ * Returns: 0 on success and -1 if no consistent copy was made
+ */
+static int stats_read(uint32_t *seq, void *dst, void *src, size_t len)
+{
+	uint32_t s1, s2;
+	int i;
+
+	for(i = 0; i < STATS_RETRIES; i++) {
+		s1 = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		if(s1 & 1) {
+			continue;
+		}
+
+		memcpy(dst, src, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		s2 = __atomic_load_n(seq, __ATOMIC_RELAXED);
+		if(s1 == s2) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+int stats_create(struct stats *s)
+{
+	int fd;
+
+	memset(s, 0, sizeof(struct stats));
+	sprintf(s->name, STATS_NAME, (int)getpid());
+
+	if((fd = shm_open(s->name, O_CREAT | O_TRUNC | O_RDWR, 0644)) < 0) {
+		return -1;
+	}
+
+	if(ftruncate(fd, sizeof(struct stats_shm)) < 0) {
+		goto err_unlink;
+	}
+
+	s->shm = mmap(NULL, sizeof(struct stats_shm), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if(s->shm == MAP_FAILED) {
+		goto err_unlink;
+	}
+	close(fd);
+	s->owner = 1;
+
+	/* The segment only counts as valid, once all of it is set */
+	s->shm->version = STATS_VERSION;
+	s->shm->size = sizeof(struct stats_shm);
+	s->shm->maxflows = STATS_FLOWS;
+	s->shm->pid = getpid();
+	__atomic_store_n(&s->shm->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+	return 0;
+
+err_unlink:
+	close(fd);
+	shm_unlink(s->name);
+	s->shm = NULL;
+	return -1;
+}
+
+
+int stats_attach(struct stats *s, int pid)
+{
+	struct stat st;
+	int fd;
+
+	memset(s, 0, sizeof(struct stats));
+	sprintf(s->name, STATS_NAME, pid);
+
+	if((fd = shm_open(s->name, O_RDONLY, 0)) < 0) {
+		return -1;
+	}
+
+	if(fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	/* A segment of another layout can't be read */
+	if(st.st_size != sizeof(struct stats_shm)) {
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+
+	s->shm = mmap(NULL, sizeof(struct stats_shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(s->shm == MAP_FAILED) {
+		s->shm = NULL;
+		return -1;
+	}
+
+	if(__atomic_load_n(&s->shm->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC ||
+			s->shm->version != STATS_VERSION ||
+			s->shm->size != sizeof(struct stats_shm)) {
+		stats_close(s);
+		errno = EPROTO;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void stats_close(struct stats *s)
+{
+	if(s->shm != NULL) {
+		munmap(s->shm, sizeof(struct stats_shm));
+		s->shm = NULL;
+	}
+
+	if(s->owner) {
+		shm_unlink(s->name);
+		s->owner = 0;
+	}
+}
+
+
+int stats_flow_slot(struct stats *s)
+{
+	uint32_t n = __atomic_load_n(&s->shm->nflows, __ATOMIC_RELAXED);
+
+	/* The threads of the pools take records at the same time */
+	do {
+		if(n >= STATS_FLOWS) {
+			return -1;
+		}
+	} while(!__atomic_compare_exchange_n(&s->shm->nflows, &n, n + 1, 0,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	return n;
+}
+
+
+void stats_put_proc(struct stats *s, struct rawio_stats *io, uint64_t drops,
+		uint32_t txqueue, uint32_t rxqueue, uint64_t now)
+{
+	struct stats_proc p;
+
+	memset(&p, 0, sizeof(p));
+	p.updated = now;
+	p.pkts_in = io->pkts_in;
+	p.bytes_in = io->bytes_in;
+	p.pkts_out = io->pkts_out;
+	p.bytes_out = io->bytes_out;
+	p.drops = io->drops + drops;
+	p.csum_bad = io->csum_bad;
+	p.txqueue = txqueue;
+	p.rxqueue = rxqueue;
+
+	stats_write(&s->shm->proc.seq, &s->shm->proc.data, &p, sizeof(p));
+}
+
+
+void stats_put_flow(struct stats *s, int slot, struct stats_flow *f)
+{
+	struct stats_flow_rec *r = &s->shm->flows[slot];
+
+	stats_write(&r->seq, &r->data, f, sizeof(struct stats_flow));
+}
+
+
+int stats_get_proc(struct stats *s, struct stats_proc *p)
+{
+	return stats_read(&s->shm->proc.seq, p, &s->shm->proc.data,
+			sizeof(struct stats_proc));
+}
+
+
+int stats_get_flow(struct stats *s, int slot, struct stats_flow *f)
+{
+	struct stats_flow_rec *r = &s->shm->flows[slot];
+
+	return stats_read(&r->seq, f, &r->data, sizeof(struct stats_flow));
+}
@@ -0,0 +1,237 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+
+/* Marks a valid segment, and the version of its layout. Readers refuse */
+/* segments of any other version. */
+#define STATS_MAGIC   0x52535354
+#define STATS_VERSION 2
+
+/* The name of the segment of a process in /dev/shm */
+#define STATS_NAME "/rawsock.%d"
+
+/* The maximum number of connections with their own counters */
+#define STATS_FLOWS 512
+
+/* How often the counters are published in milliseconds */
+#define STATS_INTERVAL 100
+
+/* How often a reader tries to get a consistent copy of a record */
+#define STATS_RETRIES 1000
+
+/* Records written by different threads live on their own cache-lines */
+#define STATS_CACHELINE 64
+
+struct rawio_stats;
+
+/*
+ * The counters of the whole process.
+ *
+ * @updated: The time the record was published in microseconds
+ * @pkts_in, @bytes_in: The datagrams of our connections received
+ * @pkts_out, @bytes_out: The datagrams sent
+ * @drops: The datagrams dropped, as they belonged to no connection or a
+ *         protocol-thread was too far behind
+ * @csum_bad: The datagrams dropped because of a wrong checksum
+ * @txqueue: The datagrams waiting for the I/O-thread (threads only)
+ * @rxqueue: The datagrams waiting for the protocol-threads (threads only)
+ */
+struct stats_proc {
+	uint64_t updated;
+	uint64_t pkts_in;
+	uint64_t bytes_in;
+	uint64_t pkts_out;
+	uint64_t bytes_out;
+	uint64_t drops;
+	uint64_t csum_bad;
+	uint32_t txqueue;
+	uint32_t rxqueue;
+};
+
+/*
+ * The counters of a single connection. There is no congestion-control,
+ * so the window of the other end is what limits sending.
+ *
+ * @updated: The time the record was published in microseconds
+ * @saddr, @daddr: The addresses of both ends in network-byte-order
+ * @sport, @dport: The ports of both ends in network-byte-order
+ * @state: The state of the connection (CONN_*)
+ * @pkts_in, @bytes_in: The datagrams received
+ * @pkts_out, @bytes_out: The datagrams sent
+ * @retrans: The segments sent again
+ * @requests: The requests sent
+ * @acks_sent: The ACKs sent, including piggybacked ones
+ * @acks_delayed: The ACKs sent, because the delay expired
+ * @acks_piggybacked: The ACKs sent along with our data
+ * @wnd: The send-window in bytes
+ * @space: The receive-space in bytes
+ * @srtt: The estimated round-trip-time in microseconds
+ * @txqueue: The bytes waiting to be sent
+ * @rxqueue: The bytes of the current response received
+ */
+struct stats_flow {
+	uint64_t updated;
+	uint32_t saddr;
+	uint32_t daddr;
+	uint16_t sport;
+	uint16_t dport;
+	uint32_t state;
+	uint64_t pkts_in;
+	uint64_t bytes_in;
+	uint64_t pkts_out;
+	uint64_t bytes_out;
+	uint64_t retrans;
+	uint64_t requests;
+	uint64_t acks_sent;
+	uint64_t acks_delayed;
+	uint64_t acks_piggybacked;
+	uint32_t wnd;
+	uint32_t space;
+	uint32_t srtt;
+	uint32_t txqueue;
+	uint32_t rxqueue;
+};
+
+/*
+ * A record guarded by a sequence-lock. The only writer makes the
+ * sequence odd while it changes the record, so a reader copies the record
+ * and retries, if the sequence was odd or changed in the meantime. The
+ * writer never waits for the readers.
+ */
+struct stats_proc_rec {
+	uint32_t seq;
+	struct stats_proc data;
+} __attribute__((aligned(STATS_CACHELINE)));
+
+struct stats_flow_rec {
+	uint32_t seq;
+	struct stats_flow data;
+} __attribute__((aligned(STATS_CACHELINE)));
+
+/*
+ * The layout of the segment.
+ *
+ * @magic: STATS_MAGIC, written last once the segment is ready
+ * @version: The version of the layout (STATS_VERSION)
+ * @size: The size of the segment in bytes
+ * @maxflows: The number of records for connections
+ * @nflows: The number of records handed out so far
+ * @pid: The process publishing the counters
+ * @proc: The counters of the process
+ * @flows: The counters of the connections
+ */
+struct stats_shm {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t maxflows;
+	uint32_t nflows;
+	int32_t pid;
+
+	struct stats_proc_rec proc;
+	struct stats_flow_rec flows[STATS_FLOWS];
+};
+
+/*
+ * A segment mapped by the process publishing the counters, or by a
+ * reader.
+ *
+ * @shm: The mapped segment
+ * @name: The name of the segment
+ * @owner: The segment was created by us, so it is removed when closing
+ */
+struct stats {
+	struct stats_shm *shm;
+	char name[32];
+	int owner;
+};
+
+
+/*
+ * Create the segment of the current process, without any connections.
+ *
+ * @s: The handle to initialize
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int stats_create(struct stats *s);
+
+
+/*
+ * Map the segment of another process for reading.
+ *
+ * @s: The handle to initialize
+ * @pid: The process publishing the counters
+ *
+ * Returns: 0 on success and -1 if an error occurred, with errno set to
+ *          EPROTO if the layout is unknown
+ */
+int stats_attach(struct stats *s, int pid);
+
+
+/*
+ * Unmap the segment, and remove it if we created it.
+ *
+ * @s: The handle
+ */
+void stats_close(struct stats *s);
+
+
+/*
+ * Hand out the record of a new connection.
+ *
+ * @s: The handle
+ *
+ * Returns: The index of the record or -1 if none is left
+ */
+int stats_flow_slot(struct stats *s);
+
+
+/*
+ * Publish the counters of the process.
+ *
+ * @s: The handle
+ * @io: The counters of the handle of the I/O-engine
+ * @drops: The datagrams dropped apart from the handle
+ * @txqueue, @rxqueue: The datagrams waiting in the queues
+ * @now: The current time in microseconds
+ */
+void stats_put_proc(struct stats *s, struct rawio_stats *io, uint64_t drops,
+		uint32_t txqueue, uint32_t rxqueue, uint64_t now);
+
+
+/*
+ * Publish the counters of a connection. Only a single thread may publish
+ * a record.
+ *
+ * @s: The handle
+ * @slot: The record of the connection
+ * @f: The counters
+ */
+void stats_put_flow(struct stats *s, int slot, struct stats_flow *f);
+
+
+/*
+ * Get a consistent copy of the counters of the process.
+ *
+ * @s: The handle
+ * @p: An address to write the counters to
+ *
+ * Returns: 0 on success and -1 if the writer kept changing the record
+ */
+int stats_get_proc(struct stats *s, struct stats_proc *p);
+
+
+/*
+ * Get a consistent copy of the counters of a connection.
+ *
+ * @s: The handle
+ * @slot: The record of the connection
+ * @f: An address to write the counters to
+ *
+ * Returns: 0 on success and -1 if the writer kept changing the record
+ */
+int stats_get_flow(struct stats *s, int slot, struct stats_flow *f);
+
+#endif /* _STATS_H */
@@ -0,0 +1,177 @@
+#include "tfo.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+
+/*
+ * Get the set an address maps to.
+ */
+static struct tfo_entry *tfo_set(struct tfo_cache *c, uint32_t addr,
+		int *idx)
+{
+	uint32_t h = addr * 0x9e3779b1U;
+
+	*idx = h >> 24;
+	return c->set[*idx];
+}
+
+
+void tfo_init(struct tfo_cache *c)
+{
+	memset(c, 0, sizeof(struct tfo_cache));
+}
+
+
+int tfo_get(struct tfo_cache *c, uint32_t addr, uint8_t *cookie)
+{
+	struct tfo_entry *set;
+	int i, idx;
+
+	set = tfo_set(c, addr, &idx);
+	for(i = 0; i < TFO_WAYS; i++) {
+		if(set[i].addr == addr && addr != 0) {
+			memcpy(cookie, set[i].cookie, set[i].len);
+			return set[i].len;
+		}
+	}
+
+	return 0;
+}
+
+
+void tfo_put(struct tfo_cache *c, uint32_t addr, const uint8_t *cookie,
+		int len)
+{
+	struct tfo_entry *set, *ent = NULL;
+	int i, idx;
+
+	if(addr == 0 || len < TFO_COOKIE_MIN || len > TFO_COOKIE_MAX) {
+		return;
+	}
+
+	/* Reuse the entry of the server or an empty one */
+	set = tfo_set(c, addr, &idx);
+	for(i = 0; i < TFO_WAYS; i++) {
+		if(set[i].addr == addr) {
+			ent = &set[i];
+			break;
+		}
+		if(set[i].addr == 0 && ent == NULL) {
+			ent = &set[i];
+		}
+	}
+
+	/* Otherwise replace the entries of the set in turns */
+	if(ent == NULL) {
+		ent = &set[c->next[idx]];
+		c->next[idx] = (c->next[idx] + 1) % TFO_WAYS;
+	}
+
+	if(ent->addr == addr && ent->len == len && !memcmp(ent->cookie, cookie, len)) {
+		return;
+	}
+
+	ent->addr = addr;
+	ent->len = len;
+	memcpy(ent->cookie, cookie, len);
+	c->dirty = 1;
+}
+
+
+void tfo_del(struct tfo_cache *c, uint32_t addr)
+{
+	struct tfo_entry *set;
+	int i, idx;
+
+	set = tfo_set(c, addr, &idx);
+	for(i = 0; i < TFO_WAYS; i++) {
+		if(set[i].addr == addr) {
+			memset(&set[i], 0, sizeof(struct tfo_entry));
+			c->dirty = 1;
+		}
+	}
+}
+
+
+int tfo_load(struct tfo_cache *c, const char *path)
+{
+	FILE *fp;
+	char line[128], ip[INET_ADDRSTRLEN], hex[2 * TFO_COOKIE_MAX + 1];
+	uint8_t cookie[TFO_COOKIE_MAX];
+	struct in_addr addr;
+	unsigned byte;
+	int i, len;
+
+	if(!(fp = fopen(path, "r"))) {
+		return 0;
+	}
+
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, "%15s %32s", ip, hex) != 2 ||
+				inet_pton(AF_INET, ip, &addr) != 1) {
+			continue;
+		}
+
+		/* Skip lines with a malformed cookie */
+		len = strlen(hex) / 2;
+		for(i = 0; i < len; i++) {
+			if(sscanf(hex + i * 2, "%2x", &byte) != 1) {
+				break;
+			}
+			cookie[i] = byte;
+		}
+
+		if(i == len && strlen(hex) % 2 == 0) {
+			tfo_put(c, addr.s_addr, cookie, len);
+		}
+	}
+
+	fclose(fp);
+	c->dirty = 0;
+	return 0;
+}
+
+
+int tfo_save(struct tfo_cache *c, const char *path)
+{
+	FILE *fp;
+	char tmp[4096], ip[INET_ADDRSTRLEN];
+	struct tfo_entry *ent;
+	int s, w, i;
+
+	if(strlen(path) + 5 > sizeof(tmp)) {
+		return -1;
+	}
+	sprintf(tmp, "%s.tmp", path);
+
+	if(!(fp = fopen(tmp, "w"))) {
+		return -1;
+	}
+
+	for(s = 0; s < TFO_SETS; s++) {
+		for(w = 0; w < TFO_WAYS; w++) {
+			ent = &c->set[s][w];
+			if(ent->addr == 0) {
+				continue;
+			}
+
+			inet_ntop(AF_INET, &ent->addr, ip, sizeof(ip));
+			fprintf(fp, "%s ", ip);
+			for(i = 0; i < ent->len; i++) {
+				fprintf(fp, "%02x", ent->cookie[i]);
+			}
+			fprintf(fp, "\n");
+		}
+	}
+
+	if(fclose(fp) != 0 || rename(tmp, path) < 0) {
+		remove(tmp);
+		return -1;
+	}
+
+	c->dirty = 0;
+	return 0;
+}
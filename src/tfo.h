@@ -0,0 +1,117 @@
+#ifndef _TFO_H
+#define _TFO_H
+
+#include <stdint.h>
+
+/* The kind of the Fast-Open-option (RFC 7413) */
+#define TCPOPT_FASTOPEN 34
+
+/* The valid lengths of a cookie */
+#define TFO_COOKIE_MIN 4
+#define TFO_COOKIE_MAX 16
+
+/* The number of sets and the number of cookies in a single set */
+#define TFO_SETS 256
+#define TFO_WAYS 4
+
+/* The data sent in a SYN, as the MSS of the server isn't known yet */
+#define TFO_SYN_MSS 536
+
+/* How long to wait for the SYN-ACK of a SYN with data in milliseconds */
+#define TFO_SYN_TIMEOUT 1000
+
+/*
+ * A cookie handed out by a server.
+ *
+ * @addr: The IP-address of the server in network-byte-order, 0 if unused
+ * @len: The length of the cookie in bytes
+ * @cookie: The cookie
+ */
+struct tfo_entry {
+	uint32_t addr;
+	uint8_t len;
+	uint8_t cookie[TFO_COOKIE_MAX];
+};
+
+/*
+ * The cookies of all servers we know, like the kernel keeps them per
+ * destination-address. The cache is set-associative: A server can only
+ * be stored in the TFO_WAYS entries of the set its address maps to, and
+ * when the set is full, the entries are replaced in turns.
+ *
+ * @set: The entries
+ * @next: The entry of each set to replace next
+ * @dirty: The cache was changed since it was loaded
+ */
+struct tfo_cache {
+	struct tfo_entry set[TFO_SETS][TFO_WAYS];
+	uint8_t next[TFO_SETS];
+	int dirty;
+};
+
+
+/*
+ * Initialize an empty cache.
+ *
+ * @c: The cache
+ */
+void tfo_init(struct tfo_cache *c);
+
+
+/*
+ * Get the cookie of a server.
+ *
+ * @c: The cache
+ * @addr: The IP-address of the server in network-byte-order
+ * @cookie: A buffer of TFO_COOKIE_MAX bytes to write the cookie to
+ *
+ * Returns: The length of the cookie or 0 if there is none
+ */
+int tfo_get(struct tfo_cache *c, uint32_t addr, uint8_t *cookie);
+
+
+/*
+ * Store the cookie of a server, replacing an older one.
+ *
+ * @c: The cache
+ * @addr: The IP-address of the server in network-byte-order
+ * @cookie: The cookie
+ * @len: The length of the cookie in bytes
+ */
+void tfo_put(struct tfo_cache *c, uint32_t addr, const uint8_t *cookie,
+		int len);
+
+
+/*
+ * Forget the cookie of a server, e.g. because it ignored it.
+ *
+ * @c: The cache
+ * @addr: The IP-address of the server in network-byte-order
+ */
+void tfo_del(struct tfo_cache *c, uint32_t addr);
+
+
+/*
+ * Read the cookies stored in a file. Every line holds the address of a
+ * server and the cookie as hex-digits. A missing file is not an error.
+ *
+ * @c: The cache
+ * @path: The file
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int tfo_load(struct tfo_cache *c, const char *path);
+
+
+/*
+ * Write all cookies to a file. The file is replaced at once, so it is
+ * never left half-written.
+ *
+ * @c: The cache
+ * @path: The file
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int tfo_save(struct tfo_cache *c, const char *path);
+
+#endif /* _TFO_H */
@@ -0,0 +1,303 @@
+/*
+ * FILE: flowbench.c
+ * MEASURE THE FLOW-TABLE WITH UP TO MILLIONS OF CONNECTIONS
+ *
+ * For every size the table is filled with random 4-tuples, then looked
+ * up one key at a time and in batches of FLOWTAB_BATCH keys, just like
+ * a received burst, both for stored and for unknown keys. At last all
+ * keys are removed again. The keys are looked up in random order, so
+ * with growing tables the lookups miss the cache just like they would
+ * with real traffic.
+ *
+ * usage: ./flowbench [-n <flows>] [-l <lookups>] [-s <seed>]
+ *
+ * Options:
+ *   -n <flows>    The largest table to measure (default 4194304), the
+ *                 sizes start at 1024 and grow by a factor of 4
+ *   -l <lookups>  The lookups per size and kind (default 4194304)
+ *   -s <seed>     The seed of the random keys (default 1)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../flowtab.h"
+
+
+/* The smallest table measured */
+#define BENCH_MIN_FLOWS 1024
+
+
+/*
+ * Get the next random number (xorshift64*). The state is never 0.
+ */
+static uint64_t bench_rand(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dUL;
+}
+
+
+/*
+ * Get a monotonic timestamp in nanoseconds.
+ */
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * Fill an array with random keys. Different positions never get the
+ * same key, as the position is part of the key.
+ */
+static void bench_keys(struct flow_key *keys, uint32_t n, uint32_t first,
+		uint64_t *state)
+{
+	uint64_t r;
+	uint32_t i;
+
+	for(i = 0; i < n; i++) {
+		r = bench_rand(state);
+		keys[i].saddr = (uint32_t)r;
+		keys[i].daddr = first + i;
+		keys[i].sport = (uint16_t)(r >> 32);
+		keys[i].dport = (uint16_t)(r >> 48);
+	}
+}
+
+
+/*
+ * Build the order of the lookups, picking random keys from an array.
+ * Copying them keeps the array of keys out of the measurement.
+ */
+static void bench_queries(struct flow_key *queries, uint32_t nq,
+		struct flow_key *keys, uint32_t n, uint64_t *state)
+{
+	uint32_t i;
+
+	for(i = 0; i < nq; i++) {
+		queries[i] = keys[bench_rand(state) % n];
+	}
+}
+
+
+/*
+ * Look up all queries one at a time.
+ *
+ * Returns: The number of keys found
+ */
+static uint32_t bench_single(struct flowtab *ft, struct flow_key *queries,
+		uint32_t nq)
+{
+	uint32_t i, found = 0;
+	void *val;
+
+	for(i = 0; i < nq; i++) {
+		found += flowtab_lookup(ft, &queries[i], &val);
+	}
+
+	return found;
+}
+
+
+/*
+ * Look up all queries in batches.
+ *
+ * Returns: The number of keys found
+ */
+static uint32_t bench_batch(struct flowtab *ft, struct flow_key *queries,
+		uint32_t nq)
+{
+	void *vals[FLOWTAB_BATCH];
+	uint32_t i, m, found = 0;
+	int n;
+
+	for(i = 0; i < nq; i += n) {
+		n = (nq - i < FLOWTAB_BATCH) ? (int)(nq - i) : FLOWTAB_BATCH;
+		m = flowtab_lookup_batch(ft, &queries[i], n, vals);
+
+		/* Count the bits set */
+		for(; m != 0; m &= m - 1) {
+			found++;
+		}
+	}
+
+	return found;
+}
+
+
+/*
+ * Get the time of an operation in nanoseconds.
+ */
+static double per_op(uint64_t start, uint64_t end, uint32_t ops)
+{
+	return (double)(end - start) / ops;
+}
+
+
+/*
+ * Measure a table of the given size.
+ *
+ * @n: The number of keys
+ * @nq: The number of lookups of each kind
+ * @state: The state of the random numbers
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+static int bench_size(uint32_t n, uint32_t nq, uint64_t *state)
+{
+	struct flowtab ft;
+	struct flow_key *keys, *unknown, *queries;
+	double t_insert, t_hit, t_batch, t_miss, t_batch_miss, t_delete;
+	uint32_t i, hit, batch, miss, batch_miss;
+	uint64_t t0, t1;
+	int ret = -1;
+
+	keys = malloc(sizeof(struct flow_key) * n);
+	unknown = malloc(sizeof(struct flow_key) * n);
+	queries = malloc(sizeof(struct flow_key) * nq);
+	if(!keys || !unknown || !queries) {
+		perror("ERROR:");
+		goto err_free;
+	}
+
+	/* The unknown keys never collide with the stored ones */
+	bench_keys(keys, n, 0, state);
+	bench_keys(unknown, n, n, state);
+
+	/* Start small, so the growing of the table is measured as well */
+	if(flowtab_init(&ft, BENCH_MIN_FLOWS) < 0) {
+		perror("ERROR:");
+		goto err_free;
+	}
+
+	t0 = bench_now();
+	for(i = 0; i < n; i++) {
+		if(flowtab_insert(&ft, &keys[i], (void *)(uintptr_t)(i + 1)) < 0) {
+			perror("ERROR:");
+			goto err_table;
+		}
+	}
+	t1 = bench_now();
+	t_insert = per_op(t0, t1, n);
+
+	bench_queries(queries, nq, keys, n, state);
+	t0 = bench_now();
+	hit = bench_single(&ft, queries, nq);
+	t1 = bench_now();
+	t_hit = per_op(t0, t1, nq);
+
+	t0 = bench_now();
+	batch = bench_batch(&ft, queries, nq);
+	t1 = bench_now();
+	t_batch = per_op(t0, t1, nq);
+
+	bench_queries(queries, nq, unknown, n, state);
+	t0 = bench_now();
+	miss = bench_single(&ft, queries, nq);
+	t1 = bench_now();
+	t_miss = per_op(t0, t1, nq);
+
+	t0 = bench_now();
+	batch_miss = bench_batch(&ft, queries, nq);
+	t1 = bench_now();
+	t_batch_miss = per_op(t0, t1, nq);
+
+	t0 = bench_now();
+	for(i = 0; i < n; i++) {
+		flowtab_delete(&ft, &keys[i]);
+	}
+	t1 = bench_now();
+	t_delete = per_op(t0, t1, n);
+
+	printf("%9u %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %9.1f\n", n, t_insert,
+			t_hit, t_batch, t_miss, t_batch_miss, t_delete,
+			(double)ft.cap * sizeof(struct flowtab_entry) / (1024 * 1024) +
+			(double)(ft.mask + 1) * sizeof(struct flowtab_bucket) / (1024 * 1024));
+
+	/* Every stored key has to be found, and no unknown one */
+	if(hit != nq || batch != nq || miss != 0 || batch_miss != 0 || ft.count != 0) {
+		printf("Wrong results: %u/%u/%u/%u found, %u left\n", hit, batch, miss,
+				batch_miss, ft.count);
+		goto err_table;
+	}
+	ret = 0;
+
+err_table:
+	flowtab_free(&ft);
+
+err_free:
+	free(keys);
+	free(unknown);
+	free(queries);
+	return ret;
+}
+
+
+int main(int argc, char **argv)
+{
+	uint32_t maxflows = 4194304;
+	uint32_t lookups = 4194304;
+	uint64_t state = 1;
+	uint32_t n;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:l:s:")) != -1) {
+		switch(opt) {
+			case 'n':
+				maxflows = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'l':
+				lookups = strtoul(optarg, NULL, 10);
+				break;
+
+			case 's':
+				state = strtoul(optarg, NULL, 10);
+				break;
+
+			default:
+				goto err_usage;
+		}
+	}
+
+	if(maxflows < BENCH_MIN_FLOWS || lookups == 0) {
+		goto err_usage;
+	}
+	if(state == 0) {
+		state = 1;
+	}
+
+	printf("Nanoseconds per operation, lookups in random order:\n");
+	printf("%9s %8s %8s %8s %8s %8s %8s %9s\n", "Flows", "Insert", "Lookup",
+			"Batch", "Miss", "BMiss", "Delete", "MB");
+
+	/* The largest size is always measured, even if not a power of 4 */
+	n = BENCH_MIN_FLOWS;
+	while(1) {
+		if(bench_size(n, lookups, &state) < 0) {
+			return 1;
+		}
+
+		if(n == maxflows) {
+			break;
+		}
+		n = (n > maxflows / 4) ? maxflows : n * 4;
+	}
+
+	return 0;
+
+err_usage:
+	printf("usage: %s [-n <flows>] [-l <lookups>] [-s <seed>]\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,187 @@
+/*
+ * FILE: rawstat.c
+ * SHOW THE LIVE COUNTERS OF A RUNNING RAWSOCK
+ *
+ * The counters are read from the shared memory of the process, which it
+ * creates when started with -S. Reading them needs no system-calls and
+ * never holds up the process.
+ *
+ * usage: ./rawstat [-i <ms>] [-c <count>] <pid>
+ *
+ * Options:
+ *   -i <ms>      Show the counters every <ms> milliseconds (default 1000)
+ *   -c <count>   Stop after showing them <count> times (default 0, until
+ *                the process ends)
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../conn.h"
+#include "../stats.h"
+
+
+/*
+ * Get the name of the state of a connection.
+ */
+static const char *state_name(uint32_t state)
+{
+	switch(state) {
+		case(CONN_CLOSED):      return "CLOSED";
+		case(CONN_SYN_SENT):    return "SYN_SENT";
+		case(CONN_ESTABLISHED): return "ESTABLISHED";
+		case(CONN_FIN_WAIT):    return "FIN_WAIT";
+		case(CONN_LISTEN):      return "LISTEN";
+		case(CONN_SYN_RCVD):    return "SYN_RCVD";
+	}
+
+	return "?";
+}
+
+
+/*
+ * Get the change of a counter per second.
+ */
+static double rate(uint64_t now, uint64_t before, int interval)
+{
+	return (double)(now - before) * 1000 / interval;
+}
+
+
+/*
+ * Show the counters of the process and of all connections.
+ *
+ * @s: The mapped segment
+ * @last: The counters of the process shown last time
+ * @interval: The time since then in milliseconds
+ */
+static void show(struct stats *s, struct stats_proc *last, int interval)
+{
+	struct stats_proc p;
+	struct stats_flow f;
+	char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+	uint32_t n;
+	uint32_t i;
+
+	if(stats_get_proc(s, &p) < 0) {
+		printf("Process: busy, skipped\n");
+		return;
+	}
+
+	printf("Process %d:\n", (int)s->shm->pid);
+	printf("  in:  %lu datagrams, %lu bytes (%.0f/s, %.0f bytes/s)\n",
+			(unsigned long)p.pkts_in, (unsigned long)p.bytes_in,
+			rate(p.pkts_in, last->pkts_in, interval),
+			rate(p.bytes_in, last->bytes_in, interval));
+	printf("  out: %lu datagrams, %lu bytes (%.0f/s, %.0f bytes/s)\n",
+			(unsigned long)p.pkts_out, (unsigned long)p.bytes_out,
+			rate(p.pkts_out, last->pkts_out, interval),
+			rate(p.bytes_out, last->bytes_out, interval));
+	printf("  drops: %lu, bad checksums: %lu, queued: %u tx, %u rx\n",
+			(unsigned long)p.drops, (unsigned long)p.csum_bad,
+			p.txqueue, p.rxqueue);
+	*last = p;
+
+	n = __atomic_load_n(&s->shm->nflows, __ATOMIC_ACQUIRE);
+	if(n > STATS_FLOWS) {
+		n = STATS_FLOWS;
+	}
+
+	printf("  %-21s %-21s %-11s %8s %8s %7s %8s %8s %7s %9s %8s %7s %5s %5s\n",
+			"Local", "Remote", "State", "In", "Out", "Retrans", "Requests",
+			"ACKs", "Delayed", "Piggyback", "Window", "SRTT", "TxQ", "RxQ");
+	for(i = 0; i < n; i++) {
+		if(stats_get_flow(s, i, &f) < 0 || f.updated == 0) {
+			continue;
+		}
+
+		inet_ntop(AF_INET, &f.saddr, src, sizeof(src));
+		inet_ntop(AF_INET, &f.daddr, dst, sizeof(dst));
+		printf("  %15s:%-5u %15s:%-5u %-11s %8lu %8lu %7lu %8lu %8lu %7lu %9lu %8u %7u %5u %5u\n",
+				src, ntohs(f.sport), dst, ntohs(f.dport), state_name(f.state),
+				(unsigned long)f.pkts_in, (unsigned long)f.pkts_out,
+				(unsigned long)f.retrans, (unsigned long)f.requests,
+				(unsigned long)f.acks_sent, (unsigned long)f.acks_delayed,
+				(unsigned long)f.acks_piggybacked, f.wnd, f.srtt, f.txqueue,
+				f.rxqueue);
+	}
+	printf("\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	struct stats stats;
+	struct stats_proc last;
+	struct timespec ts;
+	int interval = 1000;
+	int count = 0;
+	int pid;
+	int opt;
+	int i;
+
+	while((opt = getopt(argc, argv, "i:c:")) != -1) {
+		switch(opt) {
+			case 'i':
+				interval = atoi(optarg);
+				break;
+
+			case 'c':
+				count = atoi(optarg);
+				break;
+
+			default:
+				goto err_usage;
+		}
+	}
+
+	if(argc - optind < 1 || interval < 1 || count < 0) {
+		goto err_usage;
+	}
+	pid = atoi(argv[optind]);
+
+	if(stats_attach(&stats, pid) < 0) {
+		if(errno == EPROTO) {
+			printf("The statistics of %d have an unknown layout.\n", pid);
+		}
+		else {
+			perror("ERROR:");
+		}
+		return 1;
+	}
+
+	/* Rates are only known from the second time on */
+	memset(&last, 0, sizeof(last));
+	stats_get_proc(&stats, &last);
+	ts.tv_sec = interval / 1000;
+	ts.tv_nsec = (long)(interval % 1000) * 1000000;
+
+	/* The segment stays mapped after the process is gone, so check if */
+	/* it still runs */
+	for(i = 0; count == 0 || i < count; i++) {
+		if(i > 0) {
+			nanosleep(&ts, NULL);
+		}
+
+		if(kill(pid, 0) < 0 && errno == ESRCH) {
+			printf("Process %d ended.\n", pid);
+			break;
+		}
+
+		show(&stats, &last, interval);
+		fflush(stdout);
+	}
+
+	stats_close(&stats);
+	return 0;
+
+err_usage:
+	printf("usage: %s [-i <ms>] [-c <count>] <pid>\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,95 @@
+/*
+ * FILE: wintest.c
+ * CHECK THE WINDOW-FIELD AROUND THE WRAP OF THE SEQUENCE-SPACE
+ *
+ * Connections are set up with the sequence-numbers of the other end at
+ * different places of the sequence-space, especially right before the
+ * middle and the end, where the signed comparisons wrap. For each of
+ * them the advertised window has to match the receive-space, also once
+ * data moved the window across the wrap, and its right edge must never
+ * move to the left.
+ *
+ * usage: ./wintest
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../window.h"
+
+
+/* The window-scale offered by the other end */
+#define TEST_PEER_SCALE 7
+
+/* The data received per step, and the number of steps */
+#define TEST_STEP 1000
+#define TEST_STEPS 200
+
+
+/*
+ * Check a connection whose other end starts at the given number.
+ *
+ * @rcv_nxt: The sequence-number following the SYN of the other end
+ *
+ * Returns: The number of failed checks
+ */
+static int check_conn(uint32_t rcv_nxt)
+{
+	struct rcv_win w;
+	struct snd_win s;
+	uint32_t right, win, max;
+	uint16_t field;
+	int fails = 0;
+	int i;
+
+	win_init(&w, WIN_MAX);
+	win_established(&w, &s, rcv_nxt, TEST_PEER_SCALE, 0xffff, 0, 0);
+
+	/* The first window covers the space, rounded up to the scale */
+	max = ((w.space + (1U << w.wscale) - 1) >> w.wscale) << w.wscale;
+	right = rcv_nxt + WIN_INIT;
+	for(i = 0; i < TEST_STEPS; i++) {
+		field = win_field(&w, rcv_nxt, 0);
+		win = (uint32_t)field << w.wscale;
+
+		if(win > max && rcv_nxt + win != right) {
+			printf("0x%08x: window of %u bytes with a space of %u\n",
+					rcv_nxt, win, w.space);
+			fails++;
+		}
+		if((int32_t)(rcv_nxt + win - right) < 0) {
+			printf("0x%08x: right edge moved left by %d bytes\n", rcv_nxt,
+					(int)(right - (rcv_nxt + win)));
+			fails++;
+		}
+
+		right = rcv_nxt + win;
+		rcv_nxt += TEST_STEP;
+	}
+
+	win_free(&w);
+	return fails;
+}
+
+
+int main(void)
+{
+	uint32_t starts[] = {
+		0x00000001, 0x10000000, 0x7ffff000, 0x7fffffff, 0x80000000,
+		0x80001000, 0x90000000, 0xffff0000, 0xfffff000, 0xffffffff
+	};
+	int fails = 0;
+	unsigned int i;
+
+	for(i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+		fails += check_conn(starts[i]);
+	}
+
+	if(fails > 0) {
+		printf("%d checks failed.\n", fails);
+		return 1;
+	}
+
+	printf("All windows are correct.\n");
+	return 0;
+}
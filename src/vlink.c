@@ -0,0 +1,256 @@
+#include "vlink.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Get the next random number (xorshift64*). The state is never 0.
+ */
+static uint64_t vlink_rand(struct vlink *link)
+{
+	link->rng ^= link->rng >> 12;
+	link->rng ^= link->rng << 25;
+	link->rng ^= link->rng >> 27;
+	return link->rng * 0x2545f4914f6cdd1dUL;
+}
+
+
+/*
+ * Decide if something with the given share in parts per million happens.
+ */
+static int vlink_chance(struct vlink *link, uint32_t ppm)
+{
+	if(ppm == 0) {
+		return 0;
+	}
+
+	return (vlink_rand(link) >> 32) % 1000000 < ppm;
+}
+
+
+/*
+ * Read a share given in percent as parts per million.
+ */
+static int vlink_ppm(const char *val, uint32_t *ppm)
+{
+	char *end;
+	double pct = strtod(val, &end);
+
+	if(end == val || pct < 0 || pct > 100) {
+		return -1;
+	}
+
+	*ppm = (uint32_t)(pct * 10000 + 0.5);
+	return 0;
+}
+
+
+/*
+ * Keep the earlier of two points in time, where 0 means none.
+ */
+static void vlink_due(uint64_t *due, uint64_t t)
+{
+	if(*due == 0 || t < *due) {
+		*due = t;
+	}
+}
+
+
+int vlink_parse(struct vlink_conf *conf, const char *spec)
+{
+	const char *val;
+	char *end;
+	size_t len;
+
+	memset(conf, 0, sizeof(struct vlink_conf));
+	conf->seed = 1;
+
+	while(*spec != '\0') {
+		len = strcspn(spec, "=,");
+		if(spec[len] != '=') {
+			return -1;
+		}
+		val = spec + len + 1;
+
+		if(len == 3 && strncmp(spec, "lat", 3) == 0) {
+			conf->latency = strtoul(val, &end, 10);
+		}
+		else if(len == 2 && strncmp(spec, "bw", 2) == 0) {
+			conf->bandwidth = strtoul(val, &end, 10);
+		}
+		else if(len == 4 && strncmp(spec, "seed", 4) == 0) {
+			conf->seed = strtoul(val, &end, 10);
+		}
+		else if(len == 4 && strncmp(spec, "loss", 4) == 0) {
+			if(vlink_ppm(val, &conf->loss) < 0) {
+				return -1;
+			}
+			end = (char *)val + strcspn(val, ",");
+		}
+		else if(len == 7 && strncmp(spec, "reorder", 7) == 0) {
+			if(vlink_ppm(val, &conf->reorder) < 0) {
+				return -1;
+			}
+			end = (char *)val + strcspn(val, ",");
+		}
+		else {
+			return -1;
+		}
+
+		if(end == val || (*end != ',' && *end != '\0')) {
+			return -1;
+		}
+		spec = (*end == ',') ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+
+void vlink_init(struct vlink *link, struct vlink_conf *conf)
+{
+	memset(link, 0, sizeof(struct vlink));
+	link->conf = *conf;
+	link->now = VLINK_EPOCH;
+	link->rng = conf->seed ? conf->seed : 1;
+
+	link->ends[0].link = link;
+	link->ends[0].peer = &link->ends[1];
+	link->ends[0].drive = 1;
+	link->ends[1].link = link;
+	link->ends[1].peer = &link->ends[0];
+}
+
+
+void vlink_free(struct vlink *link)
+{
+	struct vlink_pkt *p;
+	int i;
+
+	for(i = 0; i < 2; i++) {
+		while((p = link->ends[i].in)) {
+			link->ends[i].in = p->next;
+			free(p);
+		}
+	}
+}
+
+
+void vlink_serve(struct vlink *link, int (*serve)(void *, uint64_t),
+		void *ctx)
+{
+	link->serve = serve;
+	link->ctx = ctx;
+}
+
+
+int vlink_send(struct vlink_end *end, char *pck, int pcklen)
+{
+	struct vlink *link = end->link;
+	struct vlink_end *to = end->peer;
+	struct vlink_pkt *p, **pos;
+	uint64_t start;
+
+	link->sent++;
+
+	/* The datagram waits for the ones before it to leave the wire */
+	start = link->now * 1000;
+	if(to->busy > start) {
+		start = to->busy;
+	}
+	to->busy = start;
+	if(link->conf.bandwidth > 0) {
+		to->busy += (uint64_t)pcklen * 8 * 1000000000UL / link->conf.bandwidth;
+	}
+
+	if(vlink_chance(link, link->conf.loss)) {
+		link->lost++;
+		return 0;
+	}
+
+	if(!(p = malloc(sizeof(struct vlink_pkt) + pcklen))) {
+		return -1;
+	}
+	memcpy(VLINK_DATA_OF(p), pck, pcklen);
+	p->len = pcklen;
+	p->seq = link->seq++;
+	p->due = (to->busy + 999) / 1000 + link->conf.latency;
+
+	/* A reordered datagram is held back behind the following ones */
+	if(vlink_chance(link, link->conf.reorder)) {
+		p->due += link->conf.latency ? link->conf.latency : VLINK_REORDER_DELAY;
+		link->reordered++;
+	}
+
+	for(pos = &to->in; *pos != NULL; pos = &(*pos)->next) {
+		if((*pos)->due > p->due) {
+			break;
+		}
+	}
+	p->next = *pos;
+	*pos = p;
+	return 0;
+}
+
+
+int vlink_recv(struct vlink_end *end, int timeout, char **pck)
+{
+	struct vlink *link = end->link;
+	struct vlink_pkt *p;
+	uint64_t deadline = 0;
+	uint64_t next;
+	int t;
+
+	if(timeout > 0) {
+		deadline = link->now + (uint64_t)timeout * 1000;
+	}
+
+	while(1) {
+		/* Let the other end handle what arrived there by now */
+		t = -1;
+		if(end->drive && link->serve != NULL) {
+			t = link->serve(link->ctx, link->now);
+		}
+
+		if((p = end->in) != NULL && p->due <= link->now) {
+			end->in = p->next;
+			*pck = VLINK_DATA_OF(p);
+			return p->len;
+		}
+
+		if(!end->drive || timeout == 0 || (timeout > 0 && link->now >= deadline)) {
+			return 0;
+		}
+
+		/* Jump to the next arrival or timer, whichever comes first */
+		next = 0;
+		if(link->ends[0].in != NULL) {
+			vlink_due(&next, link->ends[0].in->due);
+		}
+		if(link->ends[1].in != NULL) {
+			vlink_due(&next, link->ends[1].in->due);
+		}
+		if(t >= 0) {
+			vlink_due(&next, link->now + (uint64_t)t * 1000);
+		}
+		if(timeout > 0) {
+			vlink_due(&next, deadline);
+		}
+
+		if(next == 0) {
+			errno = EDEADLK;
+			return -1;
+		}
+
+		/* Time always moves on, even if a timer is already due */
+		link->now = (next > link->now) ? next : link->now + 1;
+	}
+}
+
+
+void vlink_release(char *pck)
+{
+	free(VLINK_PKT_OF(pck));
+}
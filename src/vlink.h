@@ -0,0 +1,181 @@
+#ifndef _VLINK_H
+#define _VLINK_H
+
+#include <stdint.h>
+
+/* The time the virtual clock starts at in microseconds, never 0 as that */
+/* marks an unset point in time for the connections */
+#define VLINK_EPOCH 1000000
+
+/* The extra delay of a reordered datagram without latency in microseconds */
+#define VLINK_REORDER_DELAY 100
+
+/*
+ * The properties of a virtual link, the same in both directions.
+ *
+ * @latency: The one-way delay in microseconds
+ * @bandwidth: The bandwidth in bits per second, 0 for unlimited
+ * @loss: The share of datagrams lost in parts per million
+ * @reorder: The share of datagrams delayed behind the following ones in
+ *           parts per million
+ * @seed: The seed of the random numbers, the same seed always gives the
+ *        same losses and reorderings
+ */
+struct vlink_conf {
+	uint32_t latency;
+	uint64_t bandwidth;
+	uint32_t loss;
+	uint32_t reorder;
+	uint64_t seed;
+};
+
+/*
+ * A datagram travelling over the link. The data follows the header.
+ *
+ * @due: The time the datagram arrives in microseconds
+ * @seq: The order the datagrams were sent in, for equal arrival times
+ * @len: The length of the datagram
+ * @next: The datagram arriving next
+ */
+struct vlink_pkt {
+	uint64_t due;
+	uint64_t seq;
+	int len;
+	struct vlink_pkt *next;
+};
+
+#define VLINK_DATA_OF(p) ((char *)((struct vlink_pkt *)(p) + 1))
+#define VLINK_PKT_OF(d)  ((struct vlink_pkt *)(d) - 1)
+
+struct vlink;
+
+/*
+ * One end of the link.
+ *
+ * @link: The link
+ * @peer: The other end
+ * @in: The datagrams on their way to this end, sorted by arrival
+ * @busy: The time the wire towards this end is free again in nanoseconds
+ * @drive: Receiving on this end advances the clock
+ */
+struct vlink_end {
+	struct vlink *link;
+	struct vlink_end *peer;
+	struct vlink_pkt *in;
+	uint64_t busy;
+	int drive;
+};
+
+/*
+ * A link between two ends in the same process, driven by a virtual clock.
+ * There is no real waiting: When the driving end waits for a datagram,
+ * the clock jumps straight to the next event, so a benchmark runs as fast
+ * as the CPU allows and gives the same result on every run. The other end
+ * is served in between by a callback, which handles the datagrams that
+ * arrived and returns the time until its next timer.
+ *
+ * @conf: The properties of the link
+ * @now: The virtual time in microseconds
+ * @rng: The state of the random numbers
+ * @seq: The number of datagrams sent so far
+ * @ends: Both ends, the first one drives the clock
+ * @serve: The callback serving the second end, or NULL
+ * @ctx: The context handed to the callback
+ * @sent, @lost, @reordered: Counters of the datagrams
+ */
+struct vlink {
+	struct vlink_conf conf;
+	uint64_t now;
+	uint64_t rng;
+	uint64_t seq;
+	struct vlink_end ends[2];
+
+	int (*serve)(void *ctx, uint64_t now);
+	void *ctx;
+
+	unsigned long sent;
+	unsigned long lost;
+	unsigned long reordered;
+};
+
+
+/*
+ * Read the properties of a link from a list like
+ * "lat=500,bw=100000000,loss=0.5,reorder=1,seed=7". The latency is given
+ * in microseconds, the bandwidth in bits per second, loss and reordering
+ * in percent. Properties left out are 0, except the seed.
+ *
+ * @conf: The properties to fill in
+ * @spec: The list
+ *
+ * Returns: 0 on success and -1 if the list is invalid
+ */
+int vlink_parse(struct vlink_conf *conf, const char *spec);
+
+
+/*
+ * Initialize a link with no datagrams on their way and the clock at
+ * VLINK_EPOCH.
+ *
+ * @link: The link to initialize
+ * @conf: The properties of the link
+ */
+void vlink_init(struct vlink *link, struct vlink_conf *conf);
+
+
+/*
+ * Free the datagrams still on their way.
+ *
+ * @link: The link
+ */
+void vlink_free(struct vlink *link);
+
+
+/*
+ * Set the callback serving the second end, while the first one waits.
+ *
+ * @link: The link
+ * @serve: The callback, returning the time until its next timer in
+ *         milliseconds or -1 if none is running
+ * @ctx: The context handed to the callback
+ */
+void vlink_serve(struct vlink *link, int (*serve)(void *, uint64_t),
+		void *ctx);
+
+
+/*
+ * Send a datagram to the other end. It arrives after waiting for the
+ * wire, the time to put it on the wire and the latency, unless it is lost.
+ *
+ * @end: The sending end
+ * @pck: The datagram
+ * @pcklen: The length of the datagram
+ *
+ * Returns: 0 on success and -1 if an error occurred
+ */
+int vlink_send(struct vlink_end *end, char *pck, int pcklen);
+
+
+/*
+ * Receive the next datagram, which arrived by now. The driving end
+ * advances the clock, until a datagram arrives or the time is up.
+ *
+ * @end: The receiving end
+ * @timeout: The maximum time to wait in milliseconds, or -1
+ * @pck: An address to write the datagram to, given back with
+ *       vlink_release()
+ *
+ * Returns: The length of the datagram, 0 if the time is up and -1 with
+ *          errno set to EDEADLK if nothing is left to wait for
+ */
+int vlink_recv(struct vlink_end *end, int timeout, char **pck);
+
+
+/*
+ * Give a received datagram back.
+ *
+ * @pck: The datagram
+ */
+void vlink_release(char *pck);
+
+#endif /* _VLINK_H */
@@ -0,0 +1,158 @@
+#include "window.h"
+
+#include "packet.h"
+
+#include <string.h>
+
+/* The receive-space of all connections of the process, shared by the */
+/* protocol-threads of a pipeline */
+static uint64_t win_mem;
+
+
+/*
+ * Change the receive-space of a connection and account the difference.
+ *
+ * @w: The receive-window
+ * @space: The new receive-space in bytes
+ */
+static void win_set_space(struct rcv_win *w, uint32_t space)
+{
+	__atomic_add_fetch(&win_mem, (uint64_t)space - w->space, __ATOMIC_RELAXED);
+	w->space = space;
+}
+
+
+/*
+ * Check if a sequence-number comes before another one, considering the
+ * wrap-around.
+ */
+static int seq_before(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) < 0;
+}
+
+
+void win_init(struct rcv_win *w, uint32_t max)
+{
+	memset(w, 0, sizeof(struct rcv_win));
+	w->max = (max < WIN_INIT) ? WIN_INIT : max;
+
+	/* The smallest scale, which still covers the maximum space */
+	while((w->max >> w->wscale) > 0xffff && w->wscale < WIN_MAX_SCALE) {
+		w->wscale++;
+	}
+
+	win_set_space(w, WIN_INIT);
+}
+
+
+void win_free(struct rcv_win *w)
+{
+	win_set_space(w, 0);
+}
+
+
+void win_established(struct rcv_win *w, struct snd_win *s, uint32_t rcv_nxt,
+		int wscale, uint16_t window, uint32_t rtt, uint64_t now)
+{
+	/* Scaling is only used, if both ends sent the option */
+	w->scaled = (wscale >= 0);
+	if(!w->scaled) {
+		w->wscale = 0;
+	}
+
+	/* The window of the SYN-ACK itself is never scaled */
+	s->wscale = (wscale > 0) ? wscale : 0;
+	s->wnd = window;
+
+	/* Until now the right edge was unknown, as the sequence-numbers of */
+	/* the other end were, so it starts where the SYN left it */
+	w->right = rcv_nxt + win_field(w, rcv_nxt, 1);
+
+	w->rtt = rtt;
+	w->mstamp = now;
+}
+
+
+uint16_t win_field(struct rcv_win *w, uint32_t rcv_nxt, int syn)
+{
+	uint32_t win = w->space;
+	uint32_t field;
+
+	if(syn) {
+		return (win > 0xffff) ? 0xffff : win;
+	}
+
+	/* Shrinking the space must not take back what was offered before */
+	if(seq_before(rcv_nxt + win, w->right)) {
+		win = w->right - rcv_nxt;
+	}
+
+	/* Scaling rounds down, which would take back up to 2^wscale - 1 */
+	/* bytes again. Round up to the next multiple of the scale instead, */
+	/* like ALIGN() in the tcp_select_window() of Linux. */
+	field = win >> w->wscale;
+	if(seq_before(rcv_nxt + (field << w->wscale), w->right)) {
+		field++;
+	}
+	if(field > 0xffff) {
+		field = 0xffff;
+	}
+
+	w->right = rcv_nxt + (field << w->wscale);
+	return field;
+}
+
+
+void win_on_data(struct rcv_win *w, uint32_t rcv_nxt, int len, uint64_t now)
+{
+	uint32_t sample, space;
+
+	w->copied += len;
+
+	/* The other end needs about one round-trip to fill the window */
+	if(w->rtt_stamp == 0) {
+		w->rtt_seq = rcv_nxt + w->space;
+		w->rtt_stamp = now;
+	}
+	else if(!seq_before(rcv_nxt, w->rtt_seq)) {
+		sample = now - w->rtt_stamp;
+
+		/* Follow a falling round-trip-time quickly and a rising slowly */
+		w->rtt = (w->rtt == 0 || sample < w->rtt) ? sample :
+			(w->rtt * 7 + sample) / 8;
+		w->rtt_stamp = 0;
+	}
+
+	if(w->rtt == 0 || now - w->mstamp < w->rtt) {
+		return;
+	}
+
+	/* More than half of the window per round-trip means the other end */
+	/* is limited by the window, so leave room for twice as much */
+	space = w->space;
+	if(w->copied * 2 > space) {
+		space = w->copied * 2 + 16 * ADVMSS;
+		if(space > w->max) {
+			space = w->max;
+		}
+	}
+
+	/* Under memory-pressure, give back half of the space */
+	if(__atomic_load_n(&win_mem, __ATOMIC_RELAXED) - w->space + space > WIN_MEM_LIMIT) {
+		space = w->space / 2;
+		if(space < WIN_MIN) {
+			space = WIN_MIN;
+		}
+	}
+
+	win_set_space(w, space);
+	w->copied = 0;
+	w->mstamp = now;
+}
+
+
+void snd_win_update(struct snd_win *s, uint16_t window)
+{
+	s->wnd = (uint32_t)window << s->wscale;
+}
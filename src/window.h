@@ -0,0 +1,133 @@
+#ifndef _WINDOW_H
+#define _WINDOW_H
+
+#include <stdint.h>
+
+/* The receive-space of a new connection, also the window of the SYN */
+#define WIN_INIT 65535
+
+/* The receive-space a single connection can grow to */
+#define WIN_MAX (6 * 1024 * 1024)
+
+/* The receive-space a connection never shrinks below */
+#define WIN_MIN (4 * 1024)
+
+/* The receive-space of all connections together, before shrinking them */
+#define WIN_MEM_LIMIT (64 * 1024 * 1024)
+
+/* RFC 7323 limits the window-scale to 14 */
+#define WIN_MAX_SCALE 14
+
+/*
+ * The receive-window of a connection. The receive-space is tuned to the
+ * bandwidth-delay-product, by measuring how much the other end sends per
+ * round-trip: If it sends more than half of the window, it is probably
+ * limited by our window and the space is doubled. When the space of all
+ * connections together exceeds WIN_MEM_LIMIT, it is halved instead.
+ *
+ * @space: The receive-space in bytes
+ * @max: The receive-space the window may grow to
+ * @wscale: The window-scale sent in our SYN
+ * @scaled: Both ends sent the window-scale, so the window is scaled
+ * @right: The right edge of the window advertised last
+ * @rtt: The estimated round-trip-time in microseconds
+ * @copied: The bytes received in the current measurement
+ * @mstamp: The start of the current measurement in microseconds
+ * @rtt_seq: The sequence-number ending the current round-trip-sample
+ * @rtt_stamp: The start of the current round-trip-sample, 0 if none
+ */
+struct rcv_win {
+	uint32_t space;
+	uint32_t max;
+	uint8_t wscale;
+	uint8_t scaled;
+	uint32_t right;
+
+	uint32_t rtt;
+	uint32_t copied;
+	uint64_t mstamp;
+	uint32_t rtt_seq;
+	uint64_t rtt_stamp;
+};
+
+/*
+ * The send-window, as advertised by the other end.
+ *
+ * @wscale: The window-scale of the other end, 0 if not scaled
+ * @wnd: The window in bytes
+ */
+struct snd_win {
+	uint8_t wscale;
+	uint32_t wnd;
+};
+
+
+/*
+ * Initialize the receive-window of a new connection. The window-scale is
+ * chosen, so the maximum space still fits into the window-field.
+ *
+ * @w: The window to initialize
+ * @max: The maximum receive-space in bytes
+ */
+void win_init(struct rcv_win *w, uint32_t max);
+
+
+/*
+ * Release the receive-space of a connection.
+ *
+ * @w: The window
+ */
+void win_free(struct rcv_win *w);
+
+
+/*
+ * Finish the negotiation after receiving the SYN-ACK. The window offered
+ * in our SYN or SYN-ACK becomes the right edge, which later windows never
+ * move to the left.
+ *
+ * @w: The receive-window
+ * @s: The send-window to initialize
+ * @rcv_nxt: The sequence-number following the SYN of the other end
+ * @wscale: The window-scale of the other end or -1 if it didn't send one
+ * @window: The window-field of the SYN-ACK
+ * @rtt: The round-trip-time of the handshake in microseconds
+ * @now: The current time in microseconds
+ */
+void win_established(struct rcv_win *w, struct snd_win *s, uint32_t rcv_nxt,
+		int wscale, uint16_t window, uint32_t rtt, uint64_t now);
+
+
+/*
+ * Get the value for the window-field of the next datagram. The right edge
+ * of the window is never moved to the left, neither when the
+ * receive-space shrank nor by the rounding of the window-scale.
+ *
+ * @w: The receive-window
+ * @rcv_nxt: The next sequence-number expected from the other end
+ * @syn: The datagram is a SYN, which is never scaled
+ *
+ * Returns: The value of the window-field in host-byte-order
+ */
+uint16_t win_field(struct rcv_win *w, uint32_t rcv_nxt, int syn);
+
+
+/*
+ * Account received data and tune the receive-space once per round-trip.
+ *
+ * @w: The receive-window
+ * @rcv_nxt: The next sequence-number expected after the data
+ * @len: The length of the data in bytes
+ * @now: The current time in microseconds
+ */
+void win_on_data(struct rcv_win *w, uint32_t rcv_nxt, int len, uint64_t now);
+
+
+/*
+ * Update the send-window from the window-field of a received segment.
+ *
+ * @s: The send-window
+ * @window: The window-field in host-byte-order
+ */
+void snd_win_update(struct snd_win *s, uint16_t window);
+
+#endif /* _WINDOW_H */